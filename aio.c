@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "fs_internal.h"
+#include "trace.h"
+
+/*
+Asynchronous requests:
+
+fs_aio_submit puts a request on the submission queue and returns. A background engine
+thread takes the requests in order, runs them like the matching fs_* call and moves them
+to the completion queue, where fs_aio_reap finds them. Each completion also adds one to
+an eventfd, so an event loop can wait for completions with poll or epoll alongside its
+other file descriptors.
+
+Both queues are rings of FS_AIO_DEPTH request pointers. A request counts against the
+depth from fs_aio_submit until it is reaped, so the completion ring never overflows.
+The file system itself runs one call at a time (fs_lock), a single engine thread keeps
+it busy and also keeps the requests of a file in the order they were submitted.
+*/
+
+static pthread_mutex_t aio_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  aio_cond  = PTHREAD_COND_INITIALIZER;   /* submitted or completed */
+static pthread_t       aio_thread;
+static bool            aio_running = false;
+static bool            aio_stopping = false;
+static int             aio_eventfd = -1;
+
+static struct fs_aio_req *submitted[FS_AIO_DEPTH];
+static struct fs_aio_req *completed[FS_AIO_DEPTH];
+static int sub_head, sub_count;     /* ring of submitted requests */
+static int comp_head, comp_count;   /* ring of completed requests */
+static int in_flight;               /* submitted and not reaped yet */
+
+/*additional function helps to run one request, the same way as the fs_* call. Reads and
+  writes at an offset have no fs_* call and are recorded as pread and pwrite
+*/
+static int run_request(struct fs_aio_req *req){
+	uint64_t start;
+	int rtn;
+
+	switch(req->op){
+	case FS_AIO_OPEN:
+		return fs_open(req->name);
+	case FS_AIO_CLOSE:
+		return fs_close(req->fildes);
+	case FS_AIO_SYNC:
+		return fs_sync();
+	case FS_AIO_READ:
+		if(req->offset < 0) return fs_read(req->fildes, req->buf, req->nbyte);
+		pthread_mutex_lock(&fs_lock);
+		start = trace_now();
+		rtn = fildes_file_index(req->fildes) == -1 ? -1 :
+		      fildes_pread(req->fildes, req->offset, req->buf, req->nbyte);
+		trace_record_ext(TRACE_PREAD, NULL, req->fildes, req->nbyte, NULL, -1, req->offset, 0, rtn, start);
+		pthread_mutex_unlock(&fs_lock);
+		return rtn;
+	case FS_AIO_WRITE:
+		if(req->offset < 0) return fs_write(req->fildes, req->buf, req->nbyte);
+		pthread_mutex_lock(&fs_lock);
+		start = trace_now();
+		rtn = fildes_file_index(req->fildes) == -1 ? -1 :
+		      fildes_pwrite(req->fildes, req->offset, req->buf, req->nbyte);
+		group_commit();
+		trace_record_ext(TRACE_PWRITE, NULL, req->fildes, req->nbyte, NULL, -1, req->offset, 0, rtn, start);
+		pthread_mutex_unlock(&fs_lock);
+		return rtn;
+	}
+	return -1;
+}
+
+static void *aio_main(void *arg){
+	pthread_mutex_lock(&aio_mutex);
+	while(true){
+		while(sub_count == 0 && !aio_stopping) pthread_cond_wait(&aio_cond, &aio_mutex);
+		//requests already submitted are run before stopping
+		if(sub_count == 0) break;
+
+		struct fs_aio_req *req = submitted[sub_head];
+		sub_head = (sub_head + 1) % FS_AIO_DEPTH;
+		sub_count --;
+		pthread_mutex_unlock(&aio_mutex);
+
+		req->rtn = run_request(req);
+
+		pthread_mutex_lock(&aio_mutex);
+		completed[(comp_head + comp_count) % FS_AIO_DEPTH] = req;
+		comp_count ++;
+		uint64_t one = 1;
+		write(aio_eventfd, &one, sizeof(one));
+		pthread_cond_broadcast(&aio_cond);
+	}
+	pthread_mutex_unlock(&aio_mutex);
+	return NULL;
+}
+
+int fs_aio_setup(){
+	pthread_mutex_lock(&aio_mutex);
+	if(aio_running){
+		pthread_mutex_unlock(&aio_mutex);
+		return -1;
+	}
+
+	aio_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(aio_eventfd == -1){
+		pthread_mutex_unlock(&aio_mutex);
+		return -1;
+	}
+	sub_head = sub_count = comp_head = comp_count = in_flight = 0;
+	aio_stopping = false;
+	if(pthread_create(&aio_thread, NULL, aio_main, NULL) != 0){
+		close(aio_eventfd);
+		aio_eventfd = -1;
+		pthread_mutex_unlock(&aio_mutex);
+		return -1;
+	}
+	aio_running = true;
+	int fd = aio_eventfd;
+	pthread_mutex_unlock(&aio_mutex);
+	return fd;
+}
+
+int fs_aio_submit(struct fs_aio_req *req){
+	if(req == NULL || req->op < FS_AIO_OPEN || req->op > FS_AIO_SYNC) return -1;
+
+	pthread_mutex_lock(&aio_mutex);
+	if(!aio_running || aio_stopping || in_flight == FS_AIO_DEPTH){
+		pthread_mutex_unlock(&aio_mutex);
+		return -1;
+	}
+	submitted[(sub_head + sub_count) % FS_AIO_DEPTH] = req;
+	sub_count ++;
+	in_flight ++;
+	pthread_cond_broadcast(&aio_cond);
+	pthread_mutex_unlock(&aio_mutex);
+	return 0;
+}
+
+int fs_aio_reap(struct fs_aio_req **done, int max, int wait){
+	if(done == NULL || max <= 0) return -1;
+
+	pthread_mutex_lock(&aio_mutex);
+	if(!aio_running){
+		pthread_mutex_unlock(&aio_mutex);
+		return -1;
+	}
+	while(wait && comp_count == 0 && in_flight > 0) pthread_cond_wait(&aio_cond, &aio_mutex);
+
+	int n = 0;
+	while(n < max && comp_count > 0){
+		done[n ++] = completed[comp_head];
+		comp_head = (comp_head + 1) % FS_AIO_DEPTH;
+		comp_count --;
+		in_flight --;
+	}
+
+	//the eventfd stays readable while completions are left
+	uint64_t count;
+	if(comp_count == 0) read(aio_eventfd, &count, sizeof(count));
+	pthread_mutex_unlock(&aio_mutex);
+	return n;
+}
+
+int fs_aio_teardown(){
+	pthread_mutex_lock(&aio_mutex);
+	if(!aio_running){
+		pthread_mutex_unlock(&aio_mutex);
+		return -1;
+	}
+	aio_stopping = true;
+	pthread_cond_broadcast(&aio_cond);
+	pthread_mutex_unlock(&aio_mutex);
+
+	pthread_join(aio_thread, NULL);
+
+	pthread_mutex_lock(&aio_mutex);
+	close(aio_eventfd);
+	aio_eventfd = -1;
+	aio_running = false;
+	pthread_mutex_unlock(&aio_mutex);
+	return 0;
+}
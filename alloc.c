@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_internal.h"
+
+/*
+Allocation groups:
+
+The data region is cut into ALLOC_GROUPS groups of consecutive blocks. Each group keeps
+the number of its free blocks and a hint, the lowest block of the group that may be free.
+They are counted from the FAT the first time a block is asked for after mount (so a lazy
+mount does not read the FAT for them) and kept up to date by set_fat_entry, so a full
+group is skipped without looking at its FAT entries, a search never goes over the taken
+blocks at the start of a group again, and num_free_entries does not scan the FAT.
+
+Every thread has a home group, given out in turn the first time the thread takes a
+block. Blocks come from the lowest free block of the home group, then from the next
+groups in turn when it is full. A single thread so gets the same first fit placement as
+before, while files written by several threads at once (aio workers, applications) end
+up in different groups instead of taking blocks in turn.
+
+The groups are about placement, not concurrency. Blocks are only taken under fs_lock,
+which keeps the groups consistent without a lock of their own, and writers on different
+files still run one at a time: the write path holds fs_lock for the FAT, the journal and
+the data blocks alike, and allocation is a small part of it. Per-group locks would only
+pay off once writes themselves no longer take fs_lock.
+
+alloc_extend grows a chain by several blocks at once (delayed allocation, fs_fallocate),
+in one run right after the last block of the file or in the first run long enough.
+*/
+
+#define ALLOC_GROUPS 8
+
+struct alloc_group{
+	int free;   /* free blocks in the group */
+	int hint;   /* no block of the group below it is free */
+};
+
+static struct alloc_group groups[ALLOC_GROUPS];
+static bool          built;
+static int           group_size;
+static int           next_home;
+static __thread int  home = -1;
+
+/*additional function helps to count the free blocks of every group from the FAT.
+  Entry 0 is never handed out, see num_free_entries
+*/
+static void build_groups(){
+	group_size = (superblock->num_data_blocks + ALLOC_GROUPS - 1) / ALLOC_GROUPS;
+	for(int g = 0; g < ALLOC_GROUPS; g ++){
+		groups[g].free = 0;
+		groups[g].hint = g == 0 ? 1 : g * group_size;
+	}
+	for(int i = 1; i < superblock->num_data_blocks; i ++){
+		if(get_fat_entry(i) == EMPTY) groups[i / group_size].free ++;
+	}
+	built = true;
+}
+
+/*additional function helps to find the lowest free block of group g. Return -1 if the
+  group is full
+*/
+static int group_find(int g){
+	struct alloc_group *group = &groups[g];
+	int end = (g + 1) * group_size;
+	if(end > superblock->num_data_blocks) end = superblock->num_data_blocks;
+
+	if(group->free == 0) return -1;
+	while(group->hint < end && get_fat_entry(group->hint) != EMPTY) group->hint ++;
+	return group->hint < end ? group->hint : -1;
+}
+
+int alloc_find(){
+	if(!built) build_groups();
+	if(home == -1) home = next_home ++ % ALLOC_GROUPS;
+
+	for(int i = 0; i < ALLOC_GROUPS; i ++){
+		int block = group_find((home + i) % ALLOC_GROUPS);
+		if(block != -1) return block;
+	}
+	return -1;
+}
+
+int alloc_free_blocks(){
+	int count = 0;
+
+	if(!built) build_groups();
+	for(int g = 0; g < ALLOC_GROUPS; g ++){
+		count += groups[g].free;
+	}
+	return count;
+}
+
+void alloc_update(int block, bool freed){
+	if(!built || block <= 0 || block >= superblock->num_data_blocks) return;
+
+	struct alloc_group *group = &groups[block / group_size];
+	if(freed){
+		group->free ++;
+		if(block < group->hint) group->hint = block;
+	}else{
+		group->free --;
+	}
+}
+
+int alloc_extend(struct rootDirectory *dir, int count, bool scatter){
+	if(count <= 0) return 0;
+
+	int last = END_OF_FILE;
+	for(int block = dir->first_data_block; block != END_OF_FILE; block = get_fat_entry(block)){
+		last = block;
+	}
+
+	//right after the last block, so the file stays one extent
+	int start = -1;
+	if(last != END_OF_FILE && last + count < superblock->num_data_blocks){
+		start = last + 1;
+		for(int i = 0; i < count; i ++){
+			if(get_fat_entry(last + 1 + i) != EMPTY){
+				start = -1;
+				break;
+			}
+		}
+	}
+	//otherwise the first run long enough
+	if(start == -1){
+		int run = 0;
+		for(int i = 1; i < superblock->num_data_blocks && start == -1; i ++){
+			run = get_fat_entry(i) == EMPTY ? run + 1 : 0;
+			if(run == count) start = i - count + 1;
+		}
+	}
+	if(start == -1 && (!scatter || alloc_free_blocks() < count)) return -1;
+
+	for(int i = 0; i < count; i ++){
+		int block = start != -1 ? start + i : alloc_find();
+		set_fat_entry(block, END_OF_FILE);
+		if(last == END_OF_FILE){
+			dir->first_data_block = block;
+			mark_meta_dirty(superblock->ind_root_dir);
+		}else{
+			set_fat_entry(last, block);
+		}
+		last = block;
+	}
+	return 0;
+}
+
+void alloc_reset(){
+	built = false;
+}
@@ -0,0 +1,149 @@
+/**
+ *
+ * bench.c: measures the cost of FS_FEATURE_CHECKSUMS. It times CRC32C on its
+ * own, then writes and reads back one file sequentially on a fresh image with
+ * and without checksums, and prints the throughput of both and the overhead.
+ *
+ * usage: bench [-m megabytes] [-r runs] [disk]
+ *
+ * Each number is the best of the runs, which alternate which of the two images
+ * is written first. The image (bench.disk by default) is removed at the end.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#include "fs.h"
+#include "trace.h"
+#include "crc32c.h"
+
+#define CHUNK (64 * 1024)
+
+static int saved_stdout;
+
+static void usage(char *prog){
+  fprintf(stderr, "usage: %s [-m megabytes] [-r runs] [disk]\n", prog);
+  exit(1);
+}
+
+/* the file system prints on most calls, only let the report through */
+static void quiet(int on){
+  fflush(stdout);
+  if(on){
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+  }else{
+    dup2(saved_stdout, STDOUT_FILENO);
+  }
+}
+
+static double mb_per_sec(long bytes, uint64_t ns){
+  return ns ? bytes / (ns / 1e9) / (1024 * 1024) : 0;
+}
+
+/* MB/s of a checksum function over a buffer of blocks */
+static double crc_throughput(uint32_t (*fn)(uint32_t, const void*, size_t), char *buf, long len){
+  uint32_t crc = 0;
+  uint64_t start = trace_now();
+  for(long off = 0; off < len; off += 4096){
+    crc ^= fn(0, buf + off, 4096);
+  }
+  uint64_t elapsed = trace_now() - start;
+  if(crc == 1) putchar(' ');   /* keep the loop from being optimized away */
+  return mb_per_sec(len, elapsed);
+}
+
+/* write then read back size bytes on a fresh image, return 0 on success */
+static int run_io(char *disk, int features, char *buf, long size, double *write_mbs, double *read_mbs){
+  if(make_fs_ext(disk, features) == -1 || mount_fs(disk) == -1) return -1;
+  fs_create("bench");
+  int fd = fs_open("bench");
+
+  uint64_t start = trace_now();
+  for(long off = 0; off < size; off += CHUNK){
+    if(fs_write(fd, buf + off, CHUNK) != CHUNK) return -1;
+  }
+  fs_sync();
+  *write_mbs = mb_per_sec(size, trace_now() - start);
+
+  fs_lseek(fd, 0);
+  start = trace_now();
+  for(long off = 0; off < size; off += CHUNK){
+    if(fs_read(fd, buf + off, CHUNK) != CHUNK) return -1;
+  }
+  *read_mbs = mb_per_sec(size, trace_now() - start);
+
+  fs_close(fd);
+  return umount_fs(disk);
+}
+
+int main(int argc, char **argv){
+  int megabytes = 8, runs = 5, opt;
+  char *disk = "bench.disk";
+
+  while((opt = getopt(argc, argv, "m:r:")) != -1){
+    switch(opt){
+    case 'm': megabytes = atoi(optarg);  break;
+    case 'r': runs = atoi(optarg);       break;
+    default:  usage(argv[0]);
+    }
+  }
+  if(argc - optind > 1) usage(argv[0]);
+  if(argc - optind == 1) disk = argv[optind];
+  if(megabytes <= 0 || megabytes > 15 || runs <= 0){
+    fprintf(stderr, "bench: megabytes must be 1-15 and runs positive\n");
+    return 1;
+  }
+
+  saved_stdout = dup(STDOUT_FILENO);
+  long size = (long)megabytes * 1024 * 1024;
+  char *buf = malloc(size);
+  if(buf == NULL) return 1;
+  for(long i = 0; i < size; i ++) buf[i] = (char)(i * 131 + 7);
+
+  double crc_hw = 0, crc_sw = 0;
+  for(int r = 0; r < runs; r ++){
+    double hw = crc_throughput(crc32c, buf, size);
+    double sw = crc_throughput(crc32c_sw, buf, size);
+    if(hw > crc_hw) crc_hw = hw;
+    if(sw > crc_sw) crc_sw = sw;
+  }
+  printf("crc32c %-6s       %8.1f MB/s\n", crc32c_impl(), crc_hw);
+  printf("crc32c table        %8.1f MB/s\n", crc_sw);
+
+  double best[2][2] = {{0}};   /* [checksums][write, read] */
+  for(int r = 0; r < runs; r ++){
+    //the second image of a pair reads slower (the host is still busy with the first), so
+    //each goes first in every other run
+    for(int i = 0; i < 2; i ++){
+      int c = (r + i) % 2;
+      double w, rd;
+      quiet(1);
+      int rtn = run_io(disk, c ? FS_FEATURE_CHECKSUMS : 0, buf, size, &w, &rd);
+      quiet(0);
+      if(rtn == -1){
+        fprintf(stderr, "bench: I/O on %s failed\n", disk);
+        return 1;
+      }
+      if(w  > best[c][0]) best[c][0] = w;
+      if(rd > best[c][1]) best[c][1] = rd;
+    }
+  }
+  remove(disk);
+
+  printf("%d MB sequential, best of %d\n", megabytes, runs);
+  printf("               plain    checksums  overhead\n");
+  printf("write   %8.1f MB/s %8.1f MB/s   %5.1f%%\n", best[0][0], best[1][0],
+         100 * (1 - best[1][0] / best[0][0]));
+  printf("read    %8.1f MB/s %8.1f MB/s   %5.1f%%\n", best[0][1], best[1][1],
+         100 * (1 - best[1][1] / best[0][1]));
+
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "fs_internal.h"
+
+/*
+Consistency checker:
+
+Phase 1 walks the FAT chain of every file. Files are handed out to the worker threads one
+at a time, and all threads share one bitmap of the data blocks they have visited; setting
+a bit that is already set means two chains (or one chain looping on itself) use the block.
+Phase 2 splits the FAT between the threads and reports every used entry no chain reached
+(leaked blocks). Both phases only read metadata (and, with FS_FEATURE_CHECKSUMS, the data
+blocks of the chains to verify them), the repairs are made afterwards by a single thread,
+walking the files in directory order so that the same image is always repaired the same
+way.
+*/
+
+/* most worker threads a check runs on, more would not have enough blocks to share out */
+#define CHECK_THREADS_MAX 64
+
+/* what the walk found for one file */
+enum chain_status{
+	CHAIN_OK,
+	CHAIN_BAD_POINTER,   /* link out of the data region, or into a free block */
+	CHAIN_CROSS_LINKED   /* block already used by another chain (or a loop) */
+};
+
+struct chain_result{
+	int status;
+	int length;          /* blocks walked before the chain ended or went bad */
+	int bad_checksums;   /* blocks of the chain that do not match their checksum */
+};
+
+struct check_state{
+	uint64_t            *visited;     /* one bit per data block */
+	struct chain_result *results;     /* one per directory entry */
+	int                  next_file;   /* next directory entry to walk */
+	int                  leaked;
+};
+
+/*additional function helps to mark a data block visited. Return true if it already was*/
+static bool test_and_set_visited(uint64_t *visited, int block){
+	uint64_t bit = 1ULL << (block % 64);
+	return __atomic_fetch_or(&visited[block / 64], bit, __ATOMIC_RELAXED) & bit;
+}
+
+static bool is_visited(uint64_t *visited, int block){
+	return visited[block / 64] & (1ULL << (block % 64));
+}
+
+static void walk_chain(uint64_t *visited, struct rootDirectory *entry, struct chain_result *result){
+	int block = entry->first_data_block;
+	bool verify = superblock->features & FS_FEATURE_CHECKSUMS;
+	int written = chain_data_blocks(entry);
+	char buf[BLOCK_SIZE];
+
+	result->status        = CHAIN_OK;
+	result->length        = 0;
+	result->bad_checksums = 0;
+
+	while(block != END_OF_FILE){
+		if(block <= 0 || block >= superblock->num_data_blocks){
+			result->status = CHAIN_BAD_POINTER;
+			return;
+		}
+		if(test_and_set_visited(visited, block)){
+			result->status = CHAIN_CROSS_LINKED;
+			return;
+		}
+		result->length ++;
+		if(verify && (written == -1 || result->length <= written) && data_block_read(block, buf) == -1){
+			result->bad_checksums ++;
+		}
+		block = get_fat_entry(block);
+		if(block == EMPTY){
+			result->status = CHAIN_BAD_POINTER;
+			return;
+		}
+	}
+}
+
+static void *walk_chains(void *arg){
+	struct check_state *state = arg;
+	int file;
+
+	while((file = __atomic_fetch_add(&state->next_file, 1, __ATOMIC_RELAXED)) < FILE_NUM_MAX){
+		if(entry_in_use(get_dir_entry(file))){
+			walk_chain(state->visited, get_dir_entry(file), &state->results[file]);
+		}
+	}
+	return NULL;
+}
+
+struct leak_range{
+	struct check_state *state;
+	int                 start;
+	int                 end;
+};
+
+static void *find_leaks(void *arg){
+	struct leak_range *range = arg;
+	int leaked = 0;
+
+	for(int i = range->start; i < range->end; i ++){
+		if(!is_visited(range->state->visited, i) && get_fat_entry(i) != EMPTY) leaked ++;
+	}
+	__atomic_fetch_add(&range->state->leaked, leaked, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/*additional function helps to tell if an entry cannot be reached from the root: a directory
+  on its path is missing, is not a directory, or the path loops
+*/
+static bool entry_orphaned(struct rootDirectory *entry){
+	for(int depth = 0; depth < FILE_NUM_MAX; depth ++){
+		if(entry->parent == 0) return false;
+		if(entry->parent > FILE_NUM_MAX) return true;
+
+		entry = get_dir_entry(entry->parent - 1);
+		if(!entry_in_use(entry) || !(entry->flags & ENTRY_DIRECTORY)) return true;
+	}
+	return true;
+}
+
+/*additional function helps to run one phase of the check on all threads, thread i gets
+  the i-th element of args (all get args when arg_size is 0)
+*/
+static void run_threads(int num_threads, void *(*fn)(void*), void *args, size_t arg_size){
+	pthread_t threads[num_threads];
+
+	for(int i = 0; i < num_threads; i ++){
+		if(pthread_create(&threads[i], NULL, fn, (char*)args + i * arg_size) != 0){
+			fn((char*)args + i * arg_size);
+			threads[i] = 0;
+		}
+	}
+	for(int i = 0; i < num_threads; i ++){
+		if(threads[i] != 0) pthread_join(threads[i], NULL);
+	}
+}
+
+/*additional function helps to repair the image after problems were found. Chains are
+  walked again in directory order: the first file to use a block keeps it, a chain is cut
+  before a bad link, a block used by an earlier file or the blocks past its file size, and
+  every used block that no chain kept is freed at the end
+*/
+static int repair(struct fs_check_report *report){
+	int repaired = 0;
+	uint64_t *visited = calloc((superblock->num_data_blocks + 63) / 64, sizeof(uint64_t));
+
+	if(visited == NULL) return -1;
+
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		struct rootDirectory *entry = get_dir_entry(i);
+		if(!entry_in_use(entry)) continue;
+
+		int blocks_for_size = expected_chain_length(entry);
+		int block = entry->first_data_block;
+		int prev = END_OF_FILE;
+		int length = 0;
+
+		while(block != END_OF_FILE){
+			if(block <= 0 || block >= superblock->num_data_blocks ||
+			   is_visited(visited, block) ||
+			   (length == blocks_for_size && !(entry->flags & ENTRY_PREALLOC))){
+				if(prev == END_OF_FILE){
+					entry->first_data_block = END_OF_FILE;
+					mark_meta_dirty(superblock->ind_root_dir);
+				}else{
+					set_fat_entry(prev, END_OF_FILE);
+				}
+				repaired ++;
+				break;
+			}
+			test_and_set_visited(visited, block);
+			length ++;
+			prev = block;
+			block = get_fat_entry(block);
+			if(block == EMPTY){
+				set_fat_entry(prev, END_OF_FILE);
+				repaired ++;
+				break;
+			}
+		}
+
+		//a file cannot be larger than its chain, unless it is kept inline or compressed
+		if(!entry_is_inline(entry) && !(entry->flags & ENTRY_COMPRESSED) &&
+		   (entry->file_size > length * BLOCK_SIZE || entry->file_size < 0)){
+			entry->file_size = length * BLOCK_SIZE;
+			mark_meta_dirty(superblock->ind_root_dir);
+			repaired ++;
+		}
+	}
+
+	//free what no chain kept, entry 0 is never allocated (see num_free_entries)
+	for(int i = 0; i < superblock->num_data_blocks; i ++){
+		if(!is_visited(visited, i) && get_fat_entry(i) != EMPTY){
+			set_fat_entry(i, EMPTY);
+			repaired ++;
+		}
+	}
+
+	//entries cut off from the root go back to it, then the ones that got the name of
+	//another entry there are renamed
+	bool orphaned[FILE_NUM_MAX];
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		orphaned[i] = entry_in_use(get_dir_entry(i)) && entry_orphaned(get_dir_entry(i));
+	}
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		if(orphaned[i]){
+			get_dir_entry(i)->parent = 0;
+			mark_meta_dirty(superblock->ind_root_dir);
+			repaired ++;
+		}
+	}
+
+	//give duplicate names a new unique name
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		struct rootDirectory *entry = get_dir_entry(i);
+		if(!entry_in_use(entry)) continue;
+		for(int j = 0; j < i; j ++){
+			struct rootDirectory *other = get_dir_entry(j);
+			if(entry_in_use(other) && other->parent == entry->parent &&
+			   strncmp(entry->fileName, other->fileName, FILENAME_LEN_MAX) == 0){
+				char name[FILENAME_LEN_MAX];
+				snprintf(name, sizeof(name), "fsck.%d", i);
+				memcpy(entry->fileName, name, sizeof(name));
+				mark_meta_dirty(superblock->ind_root_dir);
+				repaired ++;
+				break;
+			}
+		}
+	}
+
+	//shared blocks are counted again once the chains are fixed
+	if(superblock->ind_block_map != 0){
+		int fixed = dedup_check(1);
+		if(fixed > 0) repaired += fixed;
+	}
+
+	//metadata blocks get their checksum again when they are written
+	if(meta_bad_checksums > 0){
+		int end = superblock->ind_journal > 0 ? superblock->ind_journal : META_BLOCKS_MAX;
+		for(int i = 1; i < end; i ++){
+			if(meta_block_buf(i) != NULL) mark_meta_dirty(i);
+		}
+		repaired += meta_bad_checksums;
+		meta_bad_checksums = 0;
+	}
+
+	free(visited);
+	//names may have moved or changed
+	dcache_reset(false);
+	report->repaired = repaired;
+	return 0;
+}
+
+static int check(int repair_image, int num_threads, struct fs_check_report *report){
+	memset(report, 0, sizeof(*report));
+
+	if(num_threads <= 0) num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(num_threads <= 0) num_threads = 1;
+	if(num_threads > CHECK_THREADS_MAX) num_threads = CHECK_THREADS_MAX;
+
+	//bring every metadata block in before the threads share the cache, with every
+	//file on its blocks
+	if(!mount_readonly && delalloc_flush_all() == -1) return -1;
+	if(load_metadata() == -1) return -1;
+
+	size_t bitmap_size = (superblock->num_data_blocks + 63) / 64 * sizeof(uint64_t);
+	struct check_state state;
+	memset(&state, 0, sizeof(state));
+	state.visited = calloc(1, bitmap_size);
+	state.results = calloc(FILE_NUM_MAX, sizeof(struct chain_result));
+	if(state.visited == NULL || state.results == NULL){
+		free(state.visited);
+		free(state.results);
+		return -1;
+	}
+
+	//phase 1: walk all chains, every thread takes files from the shared state
+	run_threads(num_threads, walk_chains, &state, 0);
+
+	//phase 2: look for used blocks that no chain reached
+	struct leak_range ranges[num_threads];
+	int per_thread = (superblock->num_data_blocks + num_threads - 1) / num_threads;
+	for(int i = 0; i < num_threads; i ++){
+		ranges[i].state = &state;
+		ranges[i].start = i * per_thread;
+		ranges[i].end   = (i + 1) * per_thread;
+		if(ranges[i].start < 1) ranges[i].start = 1;
+		if(ranges[i].end > superblock->num_data_blocks) ranges[i].end = superblock->num_data_blocks;
+	}
+	run_threads(num_threads, find_leaks, ranges, sizeof(struct leak_range));
+	report->leaked_blocks = state.leaked + (get_fat_entry(0) != EMPTY);
+	report->bad_checksums = meta_bad_checksums;
+	//the reference counts of a mounted snapshot are those of the live file system
+	if(superblock->ind_block_map != 0 && !mount_readonly){
+		report->bad_refcounts = dedup_check(0);
+		if(report->bad_refcounts == -1){
+			free(state.visited);
+			free(state.results);
+			return -1;
+		}
+	}
+
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		struct rootDirectory *entry = get_dir_entry(i);
+		struct chain_result *result = &state.results[i];
+		if(!entry_in_use(entry)) continue;
+
+		report->files ++;
+		if(result->status == CHAIN_BAD_POINTER) report->bad_pointers ++;
+		if(result->status == CHAIN_CROSS_LINKED) report->cross_linked ++;
+		report->bad_checksums += result->bad_checksums;
+		int blocks_for_size = expected_chain_length(entry);
+		if(result->status == CHAIN_OK && result->length != blocks_for_size &&
+		   !((entry->flags & ENTRY_PREALLOC) && result->length > blocks_for_size)){
+			report->size_mismatches ++;
+		}
+		if(entry_orphaned(entry)) report->orphans ++;
+		for(int j = 0; j < i; j ++){
+			struct rootDirectory *other = get_dir_entry(j);
+			if(entry_in_use(other) && other->parent == entry->parent &&
+			   strncmp(entry->fileName, other->fileName, FILENAME_LEN_MAX) == 0){
+				report->duplicate_names ++;
+				break;
+			}
+		}
+	}
+	free(state.visited);
+	free(state.results);
+
+	int problems = report->bad_pointers + report->cross_linked + report->size_mismatches +
+	               report->leaked_blocks + report->duplicate_names + report->orphans +
+	               report->bad_checksums + report->bad_refcounts;
+	if(problems > 0 && repair_image && !mount_readonly){
+		if(repair(report) == -1) return -1;
+	}
+	return problems;
+}
+
+int fs_check(int repair_image, int num_threads, struct fs_check_report *report){
+	if(report == NULL) return -1;
+
+	pthread_mutex_lock(&fs_lock);
+	int rtn = check(repair_image, num_threads, report);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
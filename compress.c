@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "fs_internal.h"
+#include "lz.h"
+
+/*
+Compressed files:
+
+With FS_FEATURE_COMPRESSION, the content of a file is cut in chunks of CHUNK_SIZE bytes
+and every chunk is compressed on its own, so a read only decompresses the chunks it
+touches. The FAT chain of the file is
+
+  chunk map block | blocks of chunk 0 | blocks of chunk 1 | ...
+
+and the map gives, for every chunk, the position in the chain of its first block and the
+number of bytes stored for it. A chunk that does not compress well enough to save a
+block is stored as is. Positions in the chain do not change when the defragmenter moves
+the blocks, and the checker and the defragmenter see an ordinary chain.
+
+Rewriting a chunk reuses its blocks, takes free blocks or gives blocks back when its
+compressed size changes, and shifts the positions of the chunks after it.
+*/
+
+#define CHUNK_RAW 0x40000000   /* chunk_map_entry.length: the chunk is not compressed */
+
+struct chunk_map_entry{
+	int pos;      /* position in the chain of the first block of the chunk */
+	int length;   /* bytes stored for the chunk (0 if the file does not reach it) */
+};
+
+#define CHUNKS_PER_MAP (BLOCK_SIZE / sizeof(struct chunk_map_entry))
+
+/*additional function helps to get the number of blocks a chunk is stored in*/
+static int stored_blocks(int length){
+	return ((length & ~CHUNK_RAW) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+/*additional function helps to get the number of bytes of a file of size bytes in a chunk*/
+static int chunk_size(int size, int chunk){
+	int bytes = size - chunk * CHUNK_SIZE;
+	if(bytes < 0) return 0;
+	return bytes < CHUNK_SIZE ? bytes : CHUNK_SIZE;
+}
+
+/*additional function helps to get the block at a position of the chain of a file*/
+static int chain_block(struct rootDirectory *dir, int pos){
+	int block = dir->first_data_block;
+	for(int i = 0; i < pos && block != END_OF_FILE; i ++){
+		block = get_fat_entry(block);
+	}
+	return block;
+}
+
+/*additional function helps to take a free data block. Return -1 if there is none*/
+static int take_free_block(){
+	int block = alloc_find();
+	if(block != -1) set_fat_entry(block, END_OF_FILE);
+	return block;
+}
+
+/*additional function helps to read and decompress a chunk into raw (CHUNK_SIZE bytes)*/
+static int load_chunk(struct rootDirectory *dir, struct chunk_map_entry *entry, char *raw, int raw_size){
+	char stored[CHUNK_SIZE];
+	int length = entry->length & ~CHUNK_RAW;
+	int block = chain_block(dir, entry->pos);
+
+	memset(raw, 0, CHUNK_SIZE);
+	if(entry->length == 0) return 0;
+	for(int i = 0; i < stored_blocks(entry->length); i ++){
+		if(block == END_OF_FILE || data_block_read(block, stored + i * BLOCK_SIZE) == -1) return -1;
+		block = get_fat_entry(block);
+	}
+
+	if(entry->length & CHUNK_RAW){
+		memcpy(raw, stored, length);
+		return 0;
+	}
+	return lz_decompress(stored, length, raw, raw_size) == raw_size ? 0 : -1;
+}
+
+/*additional function helps to compress a chunk and store it in place of its old blocks*/
+static int store_chunk(struct rootDirectory *dir, struct chunk_map_entry *map, int chunk,
+                       char *raw, int raw_size){
+	char compressed[CHUNK_SIZE];
+	char *stored = compressed;
+	struct chunk_map_entry *entry = &map[chunk];
+
+	int length = lz_compress(raw, raw_size, compressed, raw_size);
+	if(length == 0 || stored_blocks(length) >= stored_blocks(raw_size)){
+		stored = raw;
+		length = raw_size | CHUNK_RAW;
+	}else{
+		memset(compressed + length, 0, CHUNK_SIZE - length);
+	}
+
+	//a new chunk goes right after the one before it
+	if(entry->length == 0){
+		entry->pos = chunk == 0 ? 1 : map[chunk - 1].pos + stored_blocks(map[chunk - 1].length);
+	}
+	int old_blocks = entry->length == 0 ? 0 : stored_blocks(entry->length);
+	int new_blocks = stored_blocks(length);
+	if(new_blocks > old_blocks &&
+	   num_free_entries() < new_blocks - old_blocks) return -1;
+
+	//reuse the old blocks, then link new ones in or cut the ones left over
+	int prev = chain_block(dir, entry->pos - 1);
+	for(int i = 0; i < new_blocks; i ++){
+		int block;
+		if(i < old_blocks){
+			block = get_fat_entry(prev);
+		}else{
+			block = take_free_block();
+			set_fat_entry(block, get_fat_entry(prev));
+			set_fat_entry(prev, block);
+		}
+		if(data_block_write(block, stored + i * BLOCK_SIZE) == -1){
+			//give back the blocks linked in for the chunk so far, the map still has
+			//the old length
+			if(i >= old_blocks){
+				int last = chain_block(dir, entry->pos + old_blocks - 1);
+				int cut = get_fat_entry(last);
+				for(int k = old_blocks; k <= i; k ++){
+					int next = get_fat_entry(cut);
+					set_fat_entry(cut, EMPTY);
+					cut = next;
+				}
+				set_fat_entry(last, cut);
+			}
+			return -1;
+		}
+		prev = block;
+	}
+	if(old_blocks > new_blocks){
+		int block = get_fat_entry(prev);
+		for(int i = new_blocks; i < old_blocks; i ++){
+			int next = get_fat_entry(block);
+			set_fat_entry(block, EMPTY);
+			block = next;
+		}
+		set_fat_entry(prev, block);
+	}
+
+	entry->length = length;
+	for(int i = chunk + 1; i < CHUNKS_PER_MAP && map[i].length != 0; i ++){
+		map[i].pos += new_blocks - old_blocks;
+	}
+	return 0;
+}
+
+int compressed_read(int index, off_t offset, char *buf, int nbyte){
+	struct rootDirectory *dir = get_dir_entry(index);
+	struct chunk_map_entry map[CHUNKS_PER_MAP];
+	char raw[CHUNK_SIZE];
+	int total_read = 0;
+
+	if(nbyte <= 0) return 0;
+	if(data_block_read(dir->first_data_block, (char*)map) == -1) return -1;
+
+	while(total_read < nbyte){
+		int chunk = (offset + total_read) / CHUNK_SIZE;
+		int in_chunk = (offset + total_read) % CHUNK_SIZE;
+		int n = CHUNK_SIZE - in_chunk;
+		if(n > nbyte - total_read) n = nbyte - total_read;
+
+		if(load_chunk(dir, &map[chunk], raw, chunk_size(dir->file_size, chunk)) == -1) return -1;
+		memcpy(buf + total_read, raw + in_chunk, n);
+		total_read += n;
+	}
+	return total_read;
+}
+
+int compressed_write(int index, off_t offset, char *buf, int nbyte){
+	struct rootDirectory *dir = get_dir_entry(index);
+	struct chunk_map_entry map[CHUNKS_PER_MAP];
+	char raw[CHUNK_SIZE];
+	int written = 0;
+
+	//the map block is the first block of the chain
+	if(dir->first_data_block == END_OF_FILE){
+		int block = take_free_block();
+		if(block == -1) return 0;
+		memset(map, 0, sizeof(map));
+		dir->first_data_block = block;
+		dir->file_size = 0;
+		mark_meta_dirty(superblock->ind_root_dir);
+	}else if(data_block_read(dir->first_data_block, (char*)map) == -1){
+		return -1;
+	}
+
+	while(written < nbyte){
+		int chunk = (offset + written) / CHUNK_SIZE;
+		int in_chunk = (offset + written) % CHUNK_SIZE;
+		int n = CHUNK_SIZE - in_chunk;
+		if(n > nbyte - written) n = nbyte - written;
+		if(chunk >= CHUNKS_PER_MAP) break;
+
+		int old_size = chunk_size(dir->file_size, chunk);
+		if(load_chunk(dir, &map[chunk], raw, old_size) == -1) break;
+		memcpy(raw + in_chunk, buf + written, n);
+		int new_size = in_chunk + n > old_size ? in_chunk + n : old_size;
+		if(store_chunk(dir, map, chunk, raw, new_size) == -1) break;
+
+		written += n;
+		if(offset + written > dir->file_size){
+			dir->file_size = offset + written;
+			mark_meta_dirty(superblock->ind_root_dir);
+		}
+	}
+
+	if(data_block_write(dir->first_data_block, (char*)map) == -1) return -1;
+	return written;
+}
+
+int compressed_truncate(int index, off_t length){
+	struct rootDirectory *dir = get_dir_entry(index);
+	struct chunk_map_entry map[CHUNKS_PER_MAP];
+	char raw[CHUNK_SIZE];
+
+	if(dir->first_data_block == END_OF_FILE || length >= dir->file_size) return 0;
+	if(data_block_read(dir->first_data_block, (char*)map) == -1) return -1;
+
+	//the chunks past the new end are the end of the chain, the map block stays
+	int last = length == 0 ? -1 : (length - 1) / CHUNK_SIZE;
+	int keep = last == -1 ? 1 : map[last].pos + stored_blocks(map[last].length);
+	int prev = chain_block(dir, keep - 1);
+	int block = get_fat_entry(prev);
+	set_fat_entry(prev, END_OF_FILE);
+	while(block != END_OF_FILE && block != EMPTY){
+		int next = get_fat_entry(block);
+		set_fat_entry(block, EMPTY);
+		block = next;
+	}
+	for(int i = last + 1; i < CHUNKS_PER_MAP; i ++){
+		map[i].pos = 0;
+		map[i].length = 0;
+	}
+
+	//the last chunk kept is stored again with fewer bytes
+	if(last >= 0){
+		int old_size = chunk_size(dir->file_size, last);
+		int new_size = chunk_size(length, last);
+		if(new_size < old_size &&
+		   (load_chunk(dir, &map[last], raw, old_size) == -1 ||
+		    store_chunk(dir, map, last, raw, new_size) == -1)){
+			return -1;
+		}
+	}
+	dir->file_size = length;
+	mark_meta_dirty(superblock->ind_root_dir);
+	return data_block_write(dir->first_data_block, (char*)map);
+}
+
+int compressed_chain_length(struct rootDirectory *dir){
+	struct chunk_map_entry map[CHUNKS_PER_MAP];
+	int length = 1;
+
+	if(dir->first_data_block == END_OF_FILE) return 0;
+	if(data_block_read(dir->first_data_block, (char*)map) == -1) return -1;
+	for(int i = 0; i < CHUNKS_PER_MAP && map[i].length != 0; i ++){
+		length += stored_blocks(map[i].length);
+	}
+	return length;
+}
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_internal.h"
+#include "trace.h"
+
+/*
+File copies:
+
+fs_copy_file and fs_copy_range copy inside the library, so the data never goes through a
+buffer of the caller. Whole blocks are copied from chain to chain: when the image has a
+block map (FS_FEATURE_DEDUP or FS_FEATURE_SNAPSHOTS) the blocks of the copy are mapped to
+the physical blocks of the original (see dedup_share), which are copied on write later,
+so nothing is written. Otherwise the blocks are read and written COPY_BATCH_BLOCKS at a
+time, each run of consecutive source blocks with one read (see data_blocks_read). A
+copied chain is a verbatim copy, so fs_copy_file works for compressed files as well
+without decompressing them.
+
+Ranges that do not start on a block boundary of both files, partial blocks at the end
+and inline or compressed files in fs_copy_range go through the usual read and write
+paths with a buffer of the same size.
+*/
+
+#define COPY_BATCH_BLOCKS 16
+
+/*additional function helps to copy count whole blocks of file src, starting at its block
+  src_pos, to file dst starting at its block dst_pos, growing the chain of dst when it
+  is shorter. Return the number of blocks copied (fewer when the disk is full), or -1
+  when a block cannot be read or written
+*/
+static int copy_blocks(int src, int src_pos, int dst, int dst_pos, int count){
+	struct rootDirectory *to = get_dir_entry(dst);
+	bool share = superblock->ind_block_map != 0;
+	int slots[COPY_BATCH_BLOCKS];
+	char *bufs[COPY_BATCH_BLOCKS];
+	int done = 0;
+
+	char *batch = malloc(COPY_BATCH_BLOCKS * BLOCK_SIZE);
+	if(batch == NULL) return -1;
+
+	int src_block = cur_fat_entry(get_dir_entry(src)->first_data_block, src_pos);
+	int prev = dst_pos > 0 ? cur_fat_entry(to->first_data_block, dst_pos - 1) : END_OF_FILE;
+	int dst_block = prev != END_OF_FILE ? get_fat_entry(prev) : to->first_data_block;
+
+	while(done < count){
+		//gather a batch of the source, read each run of consecutive blocks at once, then
+		//write the batch
+		int n = 0;
+		while(n < COPY_BATCH_BLOCKS && done + n < count && src_block != END_OF_FILE){
+			bufs[n] = batch + n * BLOCK_SIZE;
+			slots[n ++] = src_block;
+			src_block = get_fat_entry(src_block);
+		}
+		if(n == 0) break;
+		for(int i = 0, run; i < n && !share; i += run){
+			for(run = 1; i + run < n && slots[i + run] == slots[i] + run; run ++);
+			if(data_blocks_read(slots[i], bufs + i, run) == -1){
+				free(batch);
+				return -1;
+			}
+		}
+
+		for(int i = 0; i < n; i ++){
+			if(dst_block == END_OF_FILE){
+				dst_block = alloc_find();
+				if(dst_block == -1){
+					free(batch);
+					return done;
+				}
+				set_fat_entry(dst_block, END_OF_FILE);
+				if(prev == END_OF_FILE){
+					to->first_data_block = dst_block;
+					mark_meta_dirty(superblock->ind_root_dir);
+				}else{
+					set_fat_entry(prev, dst_block);
+				}
+			}
+
+			if(share){
+				dedup_share(dst_block, slots[i]);
+			}else if(data_block_write(dst_block, batch + i * BLOCK_SIZE) == -1){
+				free(batch);
+				return -1;
+			}
+			done ++;
+			prev = dst_block;
+			dst_block = get_fat_entry(dst_block);
+		}
+	}
+	free(batch);
+	return done;
+}
+
+/*additional function helps to remove a file whose copy failed*/
+static void remove_file(int index){
+	struct rootDirectory *entry = get_dir_entry(index);
+	int block = entry->first_data_block;
+
+	while(block != END_OF_FILE && block != EMPTY){
+		int next = get_fat_entry(block);
+		set_fat_entry(block, EMPTY);
+		block = next;
+	}
+	remove_entry(index);
+}
+
+static int do_copy_file(char *src, char *dst){
+	if(mount_readonly || src == NULL || dst == NULL || src[0] == '\0') return -1;
+
+	int from = find_file_index(src);
+	if(from == -1 || delalloc_flush(from) == -1 || do_fs_create(dst) == -1) return -1;
+	int to = find_file_index(dst);
+	struct rootDirectory *entry = get_dir_entry(from);
+	struct rootDirectory *copy = get_dir_entry(to);
+
+	//the copy does not keep the blocks reserved past the end of the original
+	copy->flags = entry->flags & ~ENTRY_PREALLOC;
+	if(entry_is_inline(entry)){
+		memcpy(inline_data(to), inline_data(from), entry->file_size);
+		mark_meta_dirty(superblock->ind_inline + to * INLINE_DATA_MAX / BLOCK_SIZE);
+	}else{
+		int length = 0;
+		for(int block = entry->first_data_block; block != END_OF_FILE && length < superblock->num_data_blocks;
+		    block = get_fat_entry(block)){
+			length ++;
+		}
+		if(chain_data_blocks(entry) != -1) length = chain_data_blocks(entry);
+		if(copy_blocks(from, 0, to, 0, length) != length){
+			remove_file(to);
+			return -1;
+		}
+	}
+	copy->file_size = entry->file_size;
+	mark_meta_dirty(superblock->ind_root_dir);
+	return 0;
+}
+
+static int do_copy_range(int fd_in, off_t off_in, int fd_out, off_t off_out, size_t len){
+	int from = fildes_file_index(fd_in);
+	int to = fildes_file_index(fd_out);
+	if(mount_readonly || from == -1 || to == -1 || off_in < 0 || off_out < 0) return -1;
+	if(delalloc_flush(from) == -1 || delalloc_flush(to) == -1) return -1;
+
+	struct rootDirectory *src = get_dir_entry(from);
+	struct rootDirectory *dst = get_dir_entry(to);
+	if(off_in > src->file_size || off_out > dst->file_size) return -1;
+	if(len > src->file_size - off_in) len = src->file_size - off_in;
+	if(len == 0) return 0;
+	if(from == to && off_in < off_out + len && off_out < off_in + len) return -1;
+
+	size_t done = 0;
+
+	//whole blocks go from chain to chain
+	if(off_in % BLOCK_SIZE == 0 && off_out % BLOCK_SIZE == 0 && len >= BLOCK_SIZE &&
+	   !entry_is_inline(src) && !entry_is_inline(dst) &&
+	   !((src->flags | dst->flags) & ENTRY_COMPRESSED)){
+		int blocks = len / BLOCK_SIZE;
+		int copied = copy_blocks(from, off_in / BLOCK_SIZE, to, off_out / BLOCK_SIZE, blocks);
+		if(copied == -1) return -1;
+
+		done = (size_t)copied * BLOCK_SIZE;
+		if(off_out + done > dst->file_size){
+			dst->file_size = off_out + done;
+			mark_meta_dirty(superblock->ind_root_dir);
+		}
+		if(copied < blocks) return done;
+	}
+
+	//the rest through a buffer
+	if(done == len) return done;
+	char *buf = malloc(COPY_BATCH_BLOCKS * BLOCK_SIZE);
+	if(buf == NULL) return done > 0 ? done : -1;
+	while(done < len){
+		size_t n = len - done;
+		if(n > COPY_BATCH_BLOCKS * BLOCK_SIZE) n = COPY_BATCH_BLOCKS * BLOCK_SIZE;
+
+		int nread = fildes_pread(fd_in, off_in + done, buf, n);
+		if(nread <= 0) break;
+		int written = fildes_pwrite(fd_out, off_out + done, buf, nread);
+		if(written > 0) done += written;
+		if(written < nread) break;
+	}
+	free(buf);
+	return done;
+}
+
+int fs_copy_file(char *src, char *dst){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_copy_file(src, dst);
+	group_commit();
+	trace_record_ext(TRACE_COPY_FILE, src, -1, 0, dst, -1, 0, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_copy_range(int fd_in, off_t off_in, int fd_out, off_t off_out, size_t len){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_copy_range(fd_in, off_in, fd_out, off_out, len);
+	group_commit();
+	trace_record_ext(TRACE_COPY_RANGE, NULL, fd_in, len, NULL, fd_out, off_in, off_out, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
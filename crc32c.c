@@ -0,0 +1,232 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
+#include "crc32c.h"
+
+/*
+CRC32C:
+
+The Castagnoli polynomial is the one the SSE4.2 crc32 instruction computes, so on x86-64
+CPUs that have it a block is checksummed 8 bytes per instruction. The instruction takes
+3 cycles but a new one can start every cycle, so the buffer is cut in three lanes that
+are checksummed at the same time, and the three results combined: the CRC of a lane
+followed by LANE more bytes is its CRC shifted over LANE zero bytes (a table lookup per
+byte of the CRC) xored with the CRC of those bytes. Other CPUs use a slicing-by-8 table,
+which is still several times faster than the bit-wise definition.
+
+CPUs with AVX-512 and VPCLMULQDQ go past the one crc32 per cycle: the buffer is read 256
+bytes at a time into four 512-bit registers, each holding four 16-byte lanes, and every
+lane is folded into the lane 256 bytes further with two carry-less multiplications by
+x^n mod P (the CRC of a lane followed by n zero bits). At the end the lanes are folded
+into a single one, whose 16 bytes and the tail of the buffer go through crc32.
+The implementation is picked once, the first time a checksum is computed.
+*/
+
+#define POLY 0x82f63b78   /* reflected Castagnoli polynomial */
+#define LANE 1360         /* three lanes cover a 4 KB block but 16 bytes */
+
+static uint32_t table[8][256];
+static uint32_t lane_shift[4][256];   /* CRC register -> same followed by LANE zero bytes */
+static uint64_t fold_512[2], fold_1024[2], fold_1536[2], fold_2048[2];  /* see fold_constant */
+static uint64_t fold_last[8];         /* lanes 0-2 of a 512-bit register to the last lane */
+static uint32_t (*impl)(uint32_t, const unsigned char*, size_t);
+static const char *impl_name;
+static pthread_once_t impl_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc_table(uint32_t crc, const unsigned char *p, size_t len){
+	//align to 8 bytes, then consume 8 bytes per step
+	while(len > 0 && ((uintptr_t)p & 7) != 0){
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len --;
+	}
+	while(len >= 8){
+		uint64_t word;
+		memcpy(&word, p, 8);
+		word ^= crc;
+		crc = table[7][ word        & 0xff] ^ table[6][(word >>  8) & 0xff] ^
+		      table[5][(word >> 16) & 0xff] ^ table[4][(word >> 24) & 0xff] ^
+		      table[3][(word >> 32) & 0xff] ^ table[2][(word >> 40) & 0xff] ^
+		      table[1][(word >> 48) & 0xff] ^ table[0][ word >> 56        ];
+		p += 8;
+		len -= 8;
+	}
+	while(len > 0){
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len --;
+	}
+	return crc;
+}
+
+static uint32_t shift_lane(uint32_t crc){
+	return lane_shift[0][crc & 0xff]         ^ lane_shift[1][(crc >> 8) & 0xff] ^
+	       lane_shift[2][(crc >> 16) & 0xff] ^ lane_shift[3][crc >> 24];
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const unsigned char *p, size_t len){
+	uint64_t crc64 = crc;
+
+	while(len > 0 && ((uintptr_t)p & 7) != 0){
+		crc64 = __builtin_ia32_crc32qi((uint32_t)crc64, *p++);
+		len --;
+	}
+	while(len >= 3 * LANE){
+		uint64_t crc1 = 0, crc2 = 0;
+		for(int i = 0; i < LANE; i += 8){
+			uint64_t w0, w1, w2;
+			memcpy(&w0, p + i, 8);
+			memcpy(&w1, p + LANE + i, 8);
+			memcpy(&w2, p + 2 * LANE + i, 8);
+			crc64 = __builtin_ia32_crc32di(crc64, w0);
+			crc1  = __builtin_ia32_crc32di(crc1, w1);
+			crc2  = __builtin_ia32_crc32di(crc2, w2);
+		}
+		crc64 = shift_lane(shift_lane((uint32_t)crc64) ^ (uint32_t)crc1) ^ (uint32_t)crc2;
+		p += 3 * LANE;
+		len -= 3 * LANE;
+	}
+	while(len >= 8){
+		uint64_t word;
+		memcpy(&word, p, 8);
+		crc64 = __builtin_ia32_crc32di(crc64, word);
+		p += 8;
+		len -= 8;
+	}
+	while(len > 0){
+		crc64 = __builtin_ia32_crc32qi((uint32_t)crc64, *p++);
+		len --;
+	}
+	return (uint32_t)crc64;
+}
+
+/*additional function helps to fold each 128-bit lane of x forward by the distance k was
+  built for (see fold_constant), and to add the lanes of y at their new place
+*/
+__attribute__((target("avx512f,vpclmulqdq")))
+static inline __m512i fold(__m512i x, __m512i k, __m512i y){
+	return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00),
+	                                 _mm512_clmulepi64_epi128(x, k, 0x11), y, 0x96);
+}
+
+__attribute__((target("avx512f,vpclmulqdq,sse4.2")))
+static uint32_t crc_vpclmul(uint32_t crc, const unsigned char *p, size_t len){
+	if(len < 256) return crc_sse42(crc, p, len);
+
+	__m512i k = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i*)fold_2048));
+	__m512i a0 = _mm512_xor_si512(_mm512_loadu_si512(p), _mm512_zextsi128_si512(_mm_cvtsi32_si128(crc)));
+	__m512i a1 = _mm512_loadu_si512(p + 64);
+	__m512i a2 = _mm512_loadu_si512(p + 128);
+	__m512i a3 = _mm512_loadu_si512(p + 192);
+	for(p += 256, len -= 256; len >= 256; p += 256, len -= 256){
+		a0 = fold(a0, k, _mm512_loadu_si512(p));
+		a1 = fold(a1, k, _mm512_loadu_si512(p + 64));
+		a2 = fold(a2, k, _mm512_loadu_si512(p + 128));
+		a3 = fold(a3, k, _mm512_loadu_si512(p + 192));
+	}
+	a3 = fold(a0, _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i*)fold_1536)), a3);
+	a3 = fold(a1, _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i*)fold_1024)), a3);
+	k  = _mm512_broadcast_i32x4(_mm_loadu_si128((__m128i*)fold_512));
+	a3 = fold(a2, k, a3);
+	for(; len >= 64; p += 64, len -= 64){
+		a3 = fold(a3, k, _mm512_loadu_si512(p));
+	}
+
+	//the four lanes to the last one, whose 16 bytes then go through crc32
+	__m512i last = fold(_mm512_maskz_mov_epi64(0x3f, a3), _mm512_loadu_si512(fold_last),
+	                    _mm512_maskz_mov_epi64(0xc0, a3));
+	__m128i r = _mm_xor_si128(_mm_xor_si128(_mm512_extracti32x4_epi32(last, 0),
+	                                        _mm512_extracti32x4_epi32(last, 1)),
+	                          _mm_xor_si128(_mm512_extracti32x4_epi32(last, 2),
+	                                        _mm512_extracti32x4_epi32(last, 3)));
+	unsigned char tail[16];
+	_mm_storeu_si128((__m128i*)tail, r);
+	return crc_sse42(crc_sse42(0, tail, 16), p, len);
+}
+#endif
+
+/*additional function helps to build the constant that folds a 128-bit lane forward by
+  bits bits. The CRC is reflected, so the low 64 bits of a lane hold its high degree
+  half, which is multiplied by x^(bits + 64) mod P, and the high 64 bits the other half,
+  multiplied by x^bits mod P. The carry-less product of two reflected values comes out
+  one bit short, which taking one power of x less makes up for
+*/
+static void fold_constant(uint64_t *k, int bits){
+	uint32_t r = 0x80000000;   /* x^0, reflected */
+	for(int n = 1; n <= bits + 63; n ++){
+		r = (r & 1) ? (r >> 1) ^ POLY : r >> 1;
+		if(n == bits - 1)  k[1] = (uint64_t)r << 32;
+		if(n == bits + 63) k[0] = (uint64_t)r << 32;
+	}
+}
+
+static void init_impl(){
+	for(int i = 0; i < 256; i ++){
+		uint32_t crc = i;
+		for(int bit = 0; bit < 8; bit ++){
+			crc = (crc & 1) ? (crc >> 1) ^ POLY : crc >> 1;
+		}
+		table[0][i] = crc;
+	}
+	for(int i = 0; i < 256; i ++){
+		for(int t = 1; t < 8; t ++){
+			table[t][i] = table[0][table[t - 1][i] & 0xff] ^ (table[t - 1][i] >> 8);
+		}
+	}
+
+	//the shift is linear: build it from the shift of each single bit
+	unsigned char zeros[LANE] = {0};
+	for(int byte = 0; byte < 4; byte ++){
+		uint32_t bit_shift[8];
+		for(int bit = 0; bit < 8; bit ++){
+			bit_shift[bit] = crc_table(1u << (8 * byte + bit), zeros, LANE);
+		}
+		for(int i = 0; i < 256; i ++){
+			lane_shift[byte][i] = 0;
+			for(int bit = 0; bit < 8; bit ++){
+				if(i & (1 << bit)) lane_shift[byte][i] ^= bit_shift[bit];
+			}
+		}
+	}
+
+	fold_constant(fold_512, 512);
+	fold_constant(fold_1024, 1024);
+	fold_constant(fold_1536, 1536);
+	fold_constant(fold_2048, 2048);
+	for(int lane = 0; lane < 3; lane ++){
+		fold_constant(fold_last + 2 * lane, 128 * (3 - lane));
+	}
+
+	impl = crc_table;
+	impl_name = "table";
+#if defined(__x86_64__) && defined(__GNUC__)
+	if(__builtin_cpu_supports("sse4.2")){
+		impl = crc_sse42;
+		impl_name = "sse4.2";
+	}
+	if(__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("avx512f") &&
+	   __builtin_cpu_supports("vpclmulqdq")){
+		impl = crc_vpclmul;
+		impl_name = "vpclmulqdq";
+	}
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len){
+	pthread_once(&impl_once, init_impl);
+	return ~impl(~crc, buf, len);
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len){
+	pthread_once(&impl_once, init_impl);
+	return ~crc_table(~crc, buf, len);
+}
+
+const char *crc32c_impl(){
+	pthread_once(&impl_once, init_impl);
+	return impl_name;
+}
@@ -0,0 +1,16 @@
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/******************************************************************************/
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+                               /* CRC32C (Castagnoli) of buf, continuing crc  */
+                               /* (start with 0)                              */
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len);
+                               /* same, always with the portable table code   */
+const char *crc32c_impl();     /* name of the implementation crc32c() uses    */
+/******************************************************************************/
+
+#endif
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_internal.h"
+#include "hash.h"
+
+/*
+Block sharing (deduplication and snapshots):
+
+With FS_FEATURE_DEDUP or FS_FEATURE_SNAPSHOTS a FAT entry no longer owns the physical
+block of the same index. The FAT still links the data blocks of a file, but each data
+block is stored in the physical block the block map gives, and several data blocks (of
+one file, of several, or of snapshots, see snapshot.c) can share a physical block.
+Regions of metadata, cached and journaled like the FAT, keep track of this:
+
+  block map   data block -> physical block (0 while nothing was written to it)
+  refcounts   physical block -> number of data blocks mapped to it (0: free)
+  hashes      physical block -> block_hash of its content (FS_FEATURE_DEDUP only)
+
+A block is written in place when its physical block is not shared, and to a free
+physical block otherwise (copy on write), so a shared block never changes.
+
+With FS_FEATURE_DEDUP a written block is first hashed and looked up in an in-memory
+index of the hashes, built from the hash region the first time it is needed. If a
+physical block with the same content exists (the blocks are compared, equal hashes are
+not trusted), the data block is mapped to it and nothing is written.
+
+Freeing a data block (set_fat_entry to EMPTY) drops the reference to its physical block.
+A copy made by fs_copy_file or fs_copy_range (see copy.c) takes references to the
+physical blocks of the original instead of writing them again (dedup_share).
+*/
+
+#define HASH_BUCKETS 4096   /* power of 2 */
+
+static int  index_head[HASH_BUCKETS];   /* bucket -> first physical block, 0 ends a bucket */
+static int  index_next[DISK_BLOCKS];    /* physical block -> next one in its bucket        */
+static bool index_built = false;        /* built on first use after mount */
+static int  alloc_hint = 1;             /* where the search for a free physical block starts */
+
+/*additional function helps to get an int entry of the block map or refcount region*/
+static int *region_entry(int start, int index){
+	int *region = (int*)meta_block_buf(start + index / (BLOCK_SIZE / sizeof(int)));
+	return &region[index % (BLOCK_SIZE / sizeof(int))];
+}
+
+static void set_region_entry(int start, int index, int value){
+	*region_entry(start, index) = value;
+	mark_meta_dirty(start + index / (BLOCK_SIZE / sizeof(int)));
+}
+
+static uint64_t *hash_entry(int phys){
+	uint64_t *region = (uint64_t*)meta_block_buf(superblock->ind_block_hash + phys / (BLOCK_SIZE / sizeof(uint64_t)));
+	return &region[phys % (BLOCK_SIZE / sizeof(uint64_t))];
+}
+
+static void set_hash(int phys, uint64_t hash){
+	*hash_entry(phys) = hash;
+	mark_meta_dirty(superblock->ind_block_hash + phys / (BLOCK_SIZE / sizeof(uint64_t)));
+}
+
+static int refcount(int phys){
+	return *region_entry(superblock->ind_refcount, phys);
+}
+
+static void set_refcount(int phys, int count){
+	set_region_entry(superblock->ind_refcount, phys, count);
+}
+
+int dedup_map(int block){
+	if(block <= 0 || block >= superblock->num_data_blocks) return 0;
+	return *region_entry(superblock->ind_block_map, block);
+}
+
+static bool dedup_on(){
+	return superblock->features & FS_FEATURE_DEDUP;
+}
+
+static void index_insert(int phys){
+	int bucket = *hash_entry(phys) & (HASH_BUCKETS - 1);
+	index_next[phys] = index_head[bucket];
+	index_head[bucket] = phys;
+}
+
+static void index_remove(int phys){
+	if(!index_built) return;
+	int *link = &index_head[*hash_entry(phys) & (HASH_BUCKETS - 1)];
+	while(*link != 0 && *link != phys) link = &index_next[*link];
+	if(*link == phys) *link = index_next[phys];
+}
+
+/*additional function helps to build the index of the hashes of the used physical blocks*/
+static int build_index(){
+	if(index_built || !dedup_on()) return 0;
+
+	memset(index_head, 0, sizeof(index_head));
+	memset(index_next, 0, sizeof(index_next));
+	index_built = true;
+	for(int phys = 1; phys < superblock->num_data_blocks; phys ++){
+		if(refcount(phys) > 0) index_insert(phys);
+	}
+	return 0;
+}
+
+void dedup_reset(){
+	index_built = false;
+	alloc_hint = 1;
+}
+
+/*additional function helps to find a physical block holding the content of buf. Return
+  0 if there is none
+*/
+static int find_block(uint64_t hash, char *buf){
+	char stored[BLOCK_SIZE];
+
+	for(int phys = index_head[hash & (HASH_BUCKETS - 1)]; phys != 0; phys = index_next[phys]){
+		if(*hash_entry(phys) != hash) continue;
+		if(physical_block_read(phys, stored) == 0 && memcmp(stored, buf, BLOCK_SIZE) == 0) return phys;
+	}
+	return 0;
+}
+
+/*additional function helps to drop one reference to a physical block*/
+static void release_physical(int phys){
+	if(phys == 0) return;
+	int count = refcount(phys) - 1;
+	if(count <= 0){
+		index_remove(phys);
+		discard_mark(phys);
+		count = 0;
+	}
+	set_refcount(phys, count);
+}
+
+void block_get(int phys){
+	if(phys != 0) set_refcount(phys, refcount(phys) + 1);
+}
+
+void block_put(int phys){
+	if(build_index() == -1) return;
+	release_physical(phys);
+}
+
+/*additional function helps to take a free physical block, the next block of the log with
+  FS_FEATURE_LOG (see log.c). Return 0 if there is none
+*/
+static int alloc_physical(){
+	if(superblock->features & FS_FEATURE_LOG) return log_alloc();
+
+	int n = superblock->num_data_blocks;
+	for(int i = 0; i < n - 1; i ++){
+		int phys = (alloc_hint - 1 + i) % (n - 1) + 1;
+		if(refcount(phys) == 0){
+			alloc_hint = phys + 1;
+			return phys;
+		}
+	}
+	return 0;
+}
+
+int dedup_write(int block, char *buf){
+	if(build_index() == -1) return -1;
+
+	uint64_t hash = dedup_on() ? block_hash(buf, BLOCK_SIZE) : 0;
+	int old = dedup_map(block);
+
+	//same content already stored: share it, nothing to write
+	int match = dedup_on() ? find_block(hash, buf) : 0;
+	if(match != 0){
+		if(match != old){
+			set_refcount(match, refcount(match) + 1);
+			set_region_entry(superblock->ind_block_map, block, match);
+			release_physical(old);
+		}
+		return 0;
+	}
+
+	//the only user of its physical block rewrites it in place, unless it goes to the log
+	if(old != 0 && refcount(old) == 1 && !(superblock->features & FS_FEATURE_LOG)){
+		if(dedup_on()){
+			index_remove(old);
+			set_hash(old, hash);
+			index_insert(old);
+		}
+		return physical_block_write(old, buf);
+	}
+
+	int phys = alloc_physical();
+	if(phys == 0) return -1;
+	set_refcount(phys, 1);
+	if(dedup_on()){
+		set_hash(phys, hash);
+		index_insert(phys);
+	}
+	set_region_entry(superblock->ind_block_map, block, phys);
+	release_physical(old);
+	return physical_block_write(phys, buf);
+}
+
+int block_refcount(int phys){
+	return refcount(phys);
+}
+
+int block_move(int phys){
+	int count = 0;
+
+	if(build_index() == -1) return 0;
+	for(int block = 1; block < superblock->num_data_blocks; block ++){
+		if(dedup_map(block) == phys) count ++;
+	}
+	//references from outside the block map (snapshots) would still point to phys
+	if(count == 0 || count != refcount(phys)) return 0;
+
+	char *buf = pool_get_block();
+	if(buf == NULL) return 0;
+	int to = alloc_physical();
+	if(to == 0 || physical_block_read(phys, buf) == -1 || physical_block_write(to, buf) == -1){
+		pool_put_block(buf);
+		return 0;
+	}
+	pool_put_block(buf);
+
+	for(int block = 1; block < superblock->num_data_blocks; block ++){
+		if(dedup_map(block) == phys) set_region_entry(superblock->ind_block_map, block, to);
+	}
+	set_refcount(to, count);
+	if(dedup_on()){
+		index_remove(phys);
+		set_hash(to, *hash_entry(phys));
+		index_insert(to);
+	}
+	set_refcount(phys, 0);
+	return to;
+}
+
+void dedup_release(int block){
+	int phys = dedup_map(block);
+	if(phys == 0) return;
+	if(build_index() == -1) return;
+
+	set_region_entry(superblock->ind_block_map, block, 0);
+	release_physical(phys);
+}
+
+void dedup_share(int block, int from){
+	int phys = dedup_map(from);
+	int old = dedup_map(block);
+	if(phys == old) return;
+
+	block_get(phys);
+	set_region_entry(superblock->ind_block_map, block, phys);
+	release_physical(old);
+}
+
+int dedup_check(int repair){
+	int *counts = calloc(superblock->num_data_blocks, sizeof(int));
+	int problems = 0;
+
+	if(counts == NULL) return -1;
+
+	//a block map entry only counts while its data block is in use
+	for(int block = 1; block < superblock->num_data_blocks; block ++){
+		int phys = dedup_map(block);
+		if(phys == 0) continue;
+		if(get_fat_entry(block) == EMPTY || phys >= superblock->num_data_blocks){
+			problems ++;
+			if(repair) set_region_entry(superblock->ind_block_map, block, 0);
+			continue;
+		}
+		counts[phys] ++;
+	}
+	if(snapshot_count_refs(counts) == -1){
+		free(counts);
+		return -1;
+	}
+	for(int phys = 1; phys < superblock->num_data_blocks; phys ++){
+		if(refcount(phys) != counts[phys]){
+			problems ++;
+			if(repair) set_refcount(phys, counts[phys]);
+		}
+	}
+	free(counts);
+
+	//the index follows the refcounts
+	if(repair && problems > 0) dedup_reset();
+	return problems;
+}
+
+int fs_space_stats(struct fs_space_stats *stats){
+	if(stats == NULL) return -1;
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&fs_lock);
+	for(int block = 1; block < superblock->num_data_blocks; block ++){
+		if(get_fat_entry(block) != EMPTY) stats->data_blocks ++;
+	}
+	if(superblock->ind_block_map != 0){
+		for(int phys = 1; phys < superblock->num_data_blocks; phys ++){
+			int count = refcount(phys);
+			if(count > 0) stats->physical_blocks ++;
+			if(count > 1) stats->shared_blocks ++;
+		}
+	}else{
+		stats->physical_blocks = stats->data_blocks;
+	}
+	stats->free_blocks = superblock->num_data_blocks - 1 - stats->physical_blocks;
+	pthread_mutex_unlock(&fs_lock);
+	return 0;
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fs_internal.h"
+
+/*
+Defragmenter:
+
+fs_write takes the lowest free blocks, so after files are created, grown and deleted their
+FAT chains end up scattered over the data region. A file is defragmented by copying its
+blocks, in order, to the first run of free blocks that is long enough, then pointing the
+directory entry at the new run and freeing the old blocks in a single journal commit. The
+old blocks are never overwritten before that commit, so a crash leaves either the old or
+the new chain.
+
+Each file is moved while holding fs_lock, so this runs while the file system is in use.
+A descriptor refers to an open file, which only holds the index of the directory entry
+and a count of its descriptors, and every read and write walks the chain from the
+directory entry under fs_lock, so moving the chain leaves open files valid. The
+background thread moves one file at a time and sleeps between files to stay under the
+requested number of blocks per second.
+*/
+
+static pthread_mutex_t defrag_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  defrag_cond  = PTHREAD_COND_INITIALIZER;
+static pthread_t       defrag_thread;
+static bool            defrag_started  = false; /* thread created and not joined yet  */
+static bool            defrag_running  = false; /* thread still has files to look at  */
+static bool            defrag_stopping = false; /* fs_defrag_stop asked it to finish  */
+static int             defrag_rate;             /* blocks per second                  */
+
+/*additional function helps to count the extents (runs of consecutive blocks on disk) of a
+  file, and the number of blocks in its chain. With a block map the runs are those of the
+  physical blocks, and blocks that were never written (physical block 0) take no seek
+*/
+static int count_extents(struct rootDirectory *entry, int *length){
+	int extents = 0;
+	int prev = -1;
+	int block = entry->first_data_block;
+
+	*length = 0;
+	while(block != END_OF_FILE && *length < superblock->num_data_blocks){
+		int phys = superblock->ind_block_map != 0 ? dedup_map(block) : block;
+		(*length) ++;
+		block = get_fat_entry(block);
+		if(phys == 0 && superblock->ind_block_map != 0) continue;
+		if(prev == -1 || phys != prev + 1) extents ++;
+		prev = phys;
+	}
+	return extents;
+}
+
+/*additional function helps to find the first run of count free data blocks. Return the
+  first block of the run, or -1 if there is none
+*/
+static int find_free_run(int count){
+	int run = 0;
+
+	for(int i = 1; i < superblock->num_data_blocks; i ++){
+		if(get_fat_entry(i) != EMPTY){
+			run = 0;
+			continue;
+		}
+		if(++run == count) return i - count + 1;
+	}
+	return -1;
+}
+
+/*additional function helps to move the file of a directory entry to consecutive blocks.
+  Return the number of blocks moved, 0 if the file does not need (or cannot find room) to
+  move, -1 on failure
+*/
+static int relocate_file(int index){
+	struct rootDirectory *entry = get_dir_entry(index);
+	char buf[BLOCK_SIZE];
+	int length;
+
+	if(!entry_in_use(entry) || delalloc_flush(index) == -1) return 0;
+	if(count_extents(entry, &length) <= 1) return 0;
+	int run = find_free_run(length);
+	if(run == -1) return 0;
+
+	//copy the data first, the old chain stays valid until the new one is committed.
+	//blocks reserved by fs_fallocate hold nothing to copy
+	int written = chain_data_blocks(entry);
+	int block = entry->first_data_block;
+	for(int i = 0; i < length && (written == -1 || i < written); i ++){
+		if(data_block_read(block, buf) == -1 || data_block_write(run + i, buf) == -1) return -1;
+		block = get_fat_entry(block);
+	}
+
+	//free the old chain and link the new one
+	block = entry->first_data_block;
+	for(int i = 0; i < length; i ++){
+		int next = get_fat_entry(block);
+		set_fat_entry(block, EMPTY);
+		block = next;
+	}
+	for(int i = 0; i < length; i ++){
+		set_fat_entry(run + i, i == length - 1 ? END_OF_FILE : run + i + 1);
+	}
+	entry->first_data_block = run;
+	mark_meta_dirty(superblock->ind_root_dir);
+
+	if(commit_metadata() == -1) return -1;
+	return length;
+}
+
+int fs_defrag(int max_blocks){
+	int moved = 0;
+
+	//with a block map, moving the FAT chain would leave the physical blocks where they are
+	if(mount_readonly || superblock->ind_block_map != 0) return -1;
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		if(max_blocks > 0 && moved >= max_blocks) break;
+
+		pthread_mutex_lock(&fs_lock);
+		int n = relocate_file(i);
+		pthread_mutex_unlock(&fs_lock);
+		if(n == -1) return -1;
+		moved += n;
+	}
+	return moved;
+}
+
+int fs_frag_stats(struct fs_frag_stats *stats){
+	if(stats == NULL) return -1;
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&fs_lock);
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		struct rootDirectory *entry = get_dir_entry(i);
+		int length;
+		if(!entry_in_use(entry) || entry->first_data_block == END_OF_FILE) continue;
+
+		int extents = count_extents(entry, &length);
+		stats->files ++;
+		stats->blocks += length;
+		stats->extents += extents;
+		if(extents > 1) stats->fragmented_files ++;
+	}
+	pthread_mutex_unlock(&fs_lock);
+
+	if(stats->files > 0) stats->avg_extents = (double)stats->extents / stats->files;
+	return 0;
+}
+
+static void *defrag_main(void *arg){
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		pthread_mutex_lock(&fs_lock);
+		int moved = relocate_file(i);
+		pthread_mutex_unlock(&fs_lock);
+
+		pthread_mutex_lock(&defrag_mutex);
+		if(moved > 0 && !defrag_stopping){
+			//rate limit: wait as long as moving that many blocks is allowed to take
+			struct timespec until;
+			long long delay = (long long)moved * 1000000000LL / defrag_rate;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_sec  += delay / 1000000000LL;
+			until.tv_nsec += delay % 1000000000LL;
+			if(until.tv_nsec >= 1000000000L){
+				until.tv_sec ++;
+				until.tv_nsec -= 1000000000L;
+			}
+			while(!defrag_stopping &&
+			      pthread_cond_timedwait(&defrag_cond, &defrag_mutex, &until) != ETIMEDOUT);
+		}
+		bool stop = defrag_stopping || moved == -1;
+		pthread_mutex_unlock(&defrag_mutex);
+		if(stop) break;
+	}
+
+	pthread_mutex_lock(&defrag_mutex);
+	defrag_running = false;
+	pthread_mutex_unlock(&defrag_mutex);
+	return NULL;
+}
+
+int fs_defrag_start(int blocks_per_sec){
+	if(blocks_per_sec <= 0 || mount_readonly || superblock->ind_block_map != 0) return -1;
+
+	pthread_mutex_lock(&defrag_mutex);
+	if(defrag_running){
+		pthread_mutex_unlock(&defrag_mutex);
+		return -1;
+	}
+	pthread_mutex_unlock(&defrag_mutex);
+
+	//a previous run that finished on its own still has to be joined
+	fs_defrag_stop();
+
+	pthread_mutex_lock(&defrag_mutex);
+	defrag_rate     = blocks_per_sec;
+	defrag_stopping = false;
+	defrag_running  = true;
+	if(pthread_create(&defrag_thread, NULL, defrag_main, NULL) != 0){
+		defrag_running = false;
+		pthread_mutex_unlock(&defrag_mutex);
+		return -1;
+	}
+	defrag_started = true;
+	pthread_mutex_unlock(&defrag_mutex);
+	return 0;
+}
+
+int fs_defrag_running(){
+	pthread_mutex_lock(&defrag_mutex);
+	bool running = defrag_running;
+	pthread_mutex_unlock(&defrag_mutex);
+	return running;
+}
+
+int fs_defrag_stop(){
+	pthread_mutex_lock(&defrag_mutex);
+	if(!defrag_started){
+		pthread_mutex_unlock(&defrag_mutex);
+		return 0;
+	}
+	defrag_stopping = true;
+	pthread_cond_signal(&defrag_cond);
+	pthread_mutex_unlock(&defrag_mutex);
+
+	pthread_join(defrag_thread, NULL);
+
+	pthread_mutex_lock(&defrag_mutex);
+	defrag_started = false;
+	pthread_mutex_unlock(&defrag_mutex);
+	return 0;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_internal.h"
+
+/*
+Delayed allocation:
+
+With MOUNT_DELALLOC, a write at the end of a file only copies the data to a buffer kept
+for the file in memory. Its size (fs_get_filesize) grows, but no block is taken and no
+metadata changes. When the data has to reach the disk (any other operation on the file,
+a journal commit, fs_sync, umount_fs) the file gets all the blocks it needs at once:
+the blocks right after its last block if they are free, otherwise the first run of free
+blocks that is long enough. Files appended in turn then end up in one extent each instead
+of taking blocks in turn, and a file deleted before that never takes blocks at all.
+
+The blocks buffered data will need are counted against the free blocks, so a write that
+would not fit is not buffered but goes through the usual path and comes back short. At
+most DELALLOC_MAX_BYTES are buffered, all files are written out when more would be.
+*/
+
+#define DELALLOC_MAX_BYTES (4 * 1024 * 1024)
+
+struct pending_data{
+	char *data;
+	int   bytes;
+	int   capacity;
+};
+
+static struct pending_data pending[FILE_NUM_MAX];
+static bool delalloc_on;
+static int  pending_total;   /* bytes buffered over all files */
+static int  reserved;        /* blocks the buffered data will take */
+
+/*additional function helps to count the blocks a file needs for bytes more data*/
+static int blocks_needed(struct rootDirectory *dir, int bytes){
+	int now = (dir->file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if(dir->first_data_block == END_OF_FILE) now = 0;
+	return (dir->file_size + bytes + BLOCK_SIZE - 1) / BLOCK_SIZE - now;
+}
+
+int delalloc_append(int index, off_t offset, char *buf, size_t nbyte){
+	if(!delalloc_on || mount_readonly || nbyte > DELALLOC_MAX_BYTES) return -1;
+
+	struct rootDirectory *dir = get_dir_entry(index);
+	struct pending_data *p = &pending[index];
+	//preallocated files already have their blocks
+	if(dir->flags & (ENTRY_COMPRESSED | ENTRY_PREALLOC)) return -1;
+	if(p->bytes == 0 && entry_is_inline(dir)) return -1;
+	if(offset != dir->file_size + p->bytes) return -1;
+	//small files stay inline
+	if(superblock->ind_inline != 0 && dir->first_data_block == END_OF_FILE &&
+	   offset + nbyte <= INLINE_DATA_MAX){
+		return -1;
+	}
+
+	if(pending_total + nbyte > DELALLOC_MAX_BYTES){
+		if(delalloc_flush_all() == -1) return -1;
+		if(offset != dir->file_size) return -1;
+	}
+
+	int extra = blocks_needed(dir, p->bytes + nbyte) - blocks_needed(dir, p->bytes);
+	if(extra > 0 && extra > num_free_entries() - reserved){
+		delalloc_flush(index);
+		return -1;
+	}
+
+	if(p->bytes + nbyte > p->capacity){
+		int capacity = p->capacity > 0 ? p->capacity : BLOCK_SIZE;
+		while(capacity < p->bytes + nbyte) capacity *= 2;
+		char *data = realloc(p->data, capacity);
+		if(data == NULL){
+			delalloc_flush(index);
+			return -1;
+		}
+		p->data = data;
+		p->capacity = capacity;
+	}
+	memcpy(p->data + p->bytes, buf, nbyte);
+	p->bytes += nbyte;
+	pending_total += nbyte;
+	reserved += extra;
+	return nbyte;
+}
+
+int delalloc_pending(int index){
+	return pending[index].bytes;
+}
+
+int delalloc_flush(int index){
+	struct pending_data p = pending[index];
+	if(p.bytes == 0) return 0;
+
+	struct rootDirectory *dir = get_dir_entry(index);
+	int count = blocks_needed(dir, p.bytes);
+	memset(&pending[index], 0, sizeof(struct pending_data));
+	pending_total -= p.bytes;
+	reserved -= count;
+
+	//blocks that cannot be placed in one run are left for file_write to take
+	alloc_extend(dir, count, false);
+	int written = file_write(index, dir->file_size, p.data, p.bytes);
+	free(p.data);
+	return written == p.bytes ? 0 : -1;
+}
+
+int delalloc_flush_all(){
+	int rtn = 0;
+
+	for(int i = 0; i < FILE_NUM_MAX && pending_total > 0; i ++){
+		if(delalloc_flush(i) == -1) rtn = -1;
+	}
+	return rtn;
+}
+
+void delalloc_discard(int index){
+	struct rootDirectory *dir = get_dir_entry(index);
+
+	reserved -= blocks_needed(dir, pending[index].bytes);
+	pending_total -= pending[index].bytes;
+	free(pending[index].data);
+	memset(&pending[index], 0, sizeof(struct pending_data));
+}
+
+void delalloc_reset(bool enabled){
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		free(pending[i].data);
+		memset(&pending[i], 0, sizeof(struct pending_data));
+	}
+	pending_total = 0;
+	reserved = 0;
+	delalloc_on = enabled;
+}
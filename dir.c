@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_internal.h"
+#include "trace.h"
+
+/*
+Directories:
+
+The directory block keeps every entry of the file system, files and directories alike.
+Each entry names the directory it is in (parent, the entry index + 1, 0 for the root), so
+a name only has to be unique within its directory and the 15 characters of
+FILENAME_LEN_MAX apply to each component of a path. Entries of older images have parent
+0 (it used to be padding) and stay in the root.
+
+A path is resolved one component at a time. Every step goes through the dentry cache, a
+direct-mapped table from (directory, name) to the entry found, or to no entry at all for
+names that do not exist (negative entries), so opening the same deep path again, or
+looking for a missing file again, does not scan the directory. Entries are updated when
+a name is created or removed, and the whole cache is dropped at mount, umount and when
+fs_check repairs the directory.
+
+fs_readdir and fs_stat report entries straight from the directory block and the FAT
+without opening the files: the block count is the length of the chain, so no data block
+is read even for compressed files.
+*/
+
+#define DCACHE_SIZE 256
+
+struct dentry{
+	int  parent;                      /* 0 when the slot is empty, otherwise parent + 1 */
+	int  len;
+	char name[FILENAME_LEN_MAX];
+	int  index;                       /* entry of the name, -1 when it does not exist */
+};
+
+static struct dentry          dcache[DCACHE_SIZE];
+static struct fs_dcache_stats stats;
+
+static unsigned dcache_hash(int parent, char *name, int len){
+	unsigned hash = 2166136261u ^ parent;
+	for(int i = 0; i < len; i ++){
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	}
+	return hash % DCACHE_SIZE;
+}
+
+/*additional function helps to tell if entry is the component name of length len in the
+  directory parent
+*/
+static bool entry_matches(struct rootDirectory *entry, int parent, char *name, int len){
+	if(!entry_in_use(entry) || entry->parent != parent) return false;
+	if(strncmp(entry->fileName, name, len) != 0) return false;
+	return len == FILENAME_LEN_MAX || entry->fileName[len] == '\0';
+}
+
+static void dcache_set(int parent, char *name, int len, int index){
+	struct dentry *d = &dcache[dcache_hash(parent, name, len)];
+	d->parent = parent + 1;
+	d->len = len;
+	memcpy(d->name, name, len);
+	d->index = index;
+}
+
+/*additional function helps to find the entry of a component name in the directory parent,
+  through the dentry cache. Return -1 if there is none
+*/
+static int lookup(int parent, char *name, int len){
+	struct dentry *d = &dcache[dcache_hash(parent, name, len)];
+	if(d->parent == parent + 1 && d->len == len && memcmp(d->name, name, len) == 0){
+		if(d->index == -1) stats.negative_hits ++;
+		else stats.hits ++;
+		return d->index;
+	}
+
+	stats.misses ++;
+	int index = -1;
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		if(entry_matches(get_dir_entry(i), parent, name, len)){
+			index = i;
+			break;
+		}
+	}
+	dcache_set(parent, name, len, index);
+	return index;
+}
+
+int lookup_path(char *path, int *parent, char **name, int *len){
+	int dir = 0;
+	int index = -1;
+
+	*parent = 0;
+	*name = NULL;
+	*len = 0;
+	for(;;){
+		while(*path == '/') path ++;
+		if(*path == '\0') return index;
+
+		int n = strcspn(path, "/");
+		//every component before the last one has to be an existing directory
+		if(*name != NULL){
+			if(index == -1 || !(get_dir_entry(index)->flags & ENTRY_DIRECTORY)) break;
+			dir = index + 1;
+		}
+		if(n > FILENAME_LEN_MAX) break;
+
+		*parent = dir;
+		*name = path;
+		*len = n;
+		index = lookup(dir, path, n);
+		path += n;
+	}
+	*name = NULL;
+	return -1;
+}
+
+int new_entry(char *path, unsigned char flags){
+	int parent, len;
+	char *name;
+
+	if(mount_readonly || path == NULL) return -1;
+	if(lookup_path(path, &parent, &name, &len) != -1 || name == NULL) return -1;
+
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		struct rootDirectory *entry = get_dir_entry(i);
+		if(entry_in_use(entry)) continue;
+
+		memset(entry->fileName, 0, FILENAME_LEN_MAX);
+		memcpy(entry->fileName, name, len);
+		entry->file_size = 0;
+		entry->isActive = true;
+		entry->first_data_block = END_OF_FILE;
+		entry->flags = flags;
+		entry->parent = parent;
+		mark_meta_dirty(superblock->ind_root_dir);
+		dcache_set(parent, name, len, i);
+		return i;
+	}
+	return -1;
+}
+
+void remove_entry(int index){
+	struct rootDirectory *entry = get_dir_entry(index);
+	int len = strnlen(entry->fileName, FILENAME_LEN_MAX);
+
+	dcache_set(entry->parent, entry->fileName, len, -1);
+	memset(entry->fileName, 0, FILENAME_LEN_MAX);
+	entry->file_size = 0;
+	entry->isActive = false;
+	entry->first_data_block = END_OF_FILE;
+	entry->flags = 0;
+	entry->parent = 0;
+	mark_meta_dirty(superblock->ind_root_dir);
+}
+
+void dcache_reset(bool mount){
+	memset(dcache, 0, sizeof(dcache));
+	if(mount) memset(&stats, 0, sizeof(stats));
+}
+
+int entry_path(int index, char *path, size_t size){
+	char *end = path + size;
+	char *start = end;
+	int depth = 0;
+
+	if(size == 0) return -1;
+	*-- start = '\0';
+	//from the entry up to the root, a broken directory cannot loop forever
+	while(index != -1 && depth ++ < FILE_NUM_MAX){
+		struct rootDirectory *entry = get_dir_entry(index);
+		int len = strnlen(entry->fileName, FILENAME_LEN_MAX);
+		if(start - path < len + 1) return -1;
+		start -= len;
+		memcpy(start, entry->fileName, len);
+		*-- start = '/';
+		index = entry->parent - 1;
+	}
+	if(index != -1) return -1;
+	memmove(path, start, end - start);
+	return 0;
+}
+
+/*additional function helps to fill st from a directory entry*/
+static void fill_stat(int index, struct fs_stat *st){
+	struct rootDirectory *entry = get_dir_entry(index);
+
+	memset(st, 0, sizeof(*st));
+	memcpy(st->name, entry->fileName, strnlen(entry->fileName, FILENAME_LEN_MAX));
+	st->is_dir = (entry->flags & ENTRY_DIRECTORY) != 0;
+	st->size = entry->file_size + delalloc_pending(index);
+	for(int block = entry->first_data_block; block != END_OF_FILE && block != EMPTY &&
+	    st->blocks < superblock->num_data_blocks; block = get_fat_entry(block)){
+		st->blocks ++;
+	}
+}
+
+/*additional function helps to resolve the directory at path. Return its parent value
+  (index + 1, 0 for the root), or -1 if path is not a directory
+*/
+static int resolve_dir(char *path){
+	int parent, len;
+	char *name;
+
+	if(path == NULL || path[strspn(path, "/")] == '\0') return 0;
+	int index = lookup_path(path, &parent, &name, &len);
+	if(index == -1 || !(get_dir_entry(index)->flags & ENTRY_DIRECTORY)) return -1;
+	return index + 1;
+}
+
+static int do_stat(char *path, struct fs_stat *st){
+	int parent, len;
+	char *name;
+
+	if(resolve_dir(path) == 0){
+		memset(st, 0, sizeof(*st));
+		st->is_dir = 1;
+		return 0;
+	}
+	int index = lookup_path(path, &parent, &name, &len);
+	if(index == -1) return -1;
+	fill_stat(index, st);
+	return 0;
+}
+
+static int do_readdir(char *path, int *cursor, struct fs_stat *entries, int max){
+	int dir = resolve_dir(path);
+	if(dir == -1 || *cursor < 0) return -1;
+
+	int n = 0;
+	while(n < max && *cursor < FILE_NUM_MAX){
+		struct rootDirectory *entry = get_dir_entry(*cursor);
+		if(entry_in_use(entry) && entry->parent == dir) fill_stat(*cursor, &entries[n ++]);
+		(*cursor) ++;
+	}
+	return n;
+}
+
+static int do_mkdir(char *path){
+	return new_entry(path, ENTRY_DIRECTORY) == -1 ? -1 : 0;
+}
+
+static int do_rmdir(char *path){
+	int parent, len;
+	char *name;
+
+	if(mount_readonly || path == NULL) return -1;
+	int index = lookup_path(path, &parent, &name, &len);
+	if(index == -1 || !(get_dir_entry(index)->flags & ENTRY_DIRECTORY)) return -1;
+
+	//only empty directories
+	for(int i = 0; i < FILE_NUM_MAX; i ++){
+		struct rootDirectory *entry = get_dir_entry(i);
+		if(entry_in_use(entry) && entry->parent == index + 1) return -1;
+	}
+	remove_entry(index);
+	return 0;
+}
+
+int fs_mkdir(char *path){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_mkdir(path);
+	group_commit();
+	trace_record(TRACE_MKDIR, path, -1, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_rmdir(char *path){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_rmdir(path);
+	group_commit();
+	trace_record(TRACE_RMDIR, path, -1, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_stat(char *path, struct fs_stat *st){
+	if(st == NULL) return -1;
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_stat(path, st);
+	trace_record(TRACE_STAT, path, -1, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_readdir(char *path, int *cursor, struct fs_stat *entries, int max){
+	if(cursor == NULL || entries == NULL || max <= 0) return -1;
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int from = *cursor;
+	int rtn = do_readdir(path, cursor, entries, max);
+	trace_record_ext(TRACE_READDIR, path, -1, max, NULL, -1, from, *cursor, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_dcache_stats(struct fs_dcache_stats *out){
+	if(out == NULL) return -1;
+	pthread_mutex_lock(&fs_lock);
+	*out = stats;
+	pthread_mutex_unlock(&fs_lock);
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_internal.h"
+
+/*
+Discard:
+
+With MOUNT_DISCARD the blocks freed by fs_delete, fs_truncate and every other operation
+that lets go of data blocks are punched out of the image file, so it stays sparse and a
+backup or copy of it does not carry dead data. A freed block is only marked here: it is
+punched once the change that freed it is committed (or checkpointed) and if it is still
+free then, so a crash never leaves committed metadata pointing to a hole, and a block
+taken again before the commit is left alone. Marked blocks next to each other are
+punched together, one system call per run.
+
+With a block map (see dedup.c) it is the physical block that is marked, when its last
+reference goes away, so blocks still shared with other files or snapshots stay.
+*/
+
+static uint64_t pending[(DISK_BLOCKS + 63) / 64];   /* physical data blocks to punch */
+static bool     discard_on;
+static bool     any_pending;
+
+void discard_mark(int phys){
+	if(!discard_on || phys <= 0 || phys >= superblock->num_data_blocks) return;
+	pending[phys / 64] |= 1ULL << (phys % 64);
+	any_pending = true;
+}
+
+/*additional function helps to tell if a marked block is still free*/
+static bool still_free(int phys){
+	if(superblock->ind_block_map != 0) return block_refcount(phys) == 0;
+	return get_fat_entry(phys) == EMPTY;
+}
+
+void discard_flush(){
+	int start = -1;
+
+	if(!any_pending) return;
+	any_pending = false;
+	for(int phys = 1; phys <= superblock->num_data_blocks; phys ++){
+		bool punch = phys < superblock->num_data_blocks &&
+		             (pending[phys / 64] & (1ULL << (phys % 64))) && still_free(phys);
+		if(punch && start == -1) start = phys;
+		if(!punch && start != -1){
+			//the image stays correct without the hole, a file system that cannot punch
+			//holes only stops discarding
+			if(block_discard(superblock->ind_start_data_block + start, phys - start) == -1){
+				discard_on = false;
+				break;
+			}
+			start = -1;
+		}
+	}
+	memset(pending, 0, sizeof(pending));
+}
+
+void discard_reset(bool enabled){
+	memset(pending, 0, sizeof(pending));
+	any_pending = false;
+	discard_on = enabled;
+}
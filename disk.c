@@ -1,81 +1,362 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 #include "disk.h"
 
+/* A disk can be striped over several image files, named together separated by commas.
+   The blocks before the stripe start given to make_disk_ext and open_disk_ext (the file
+   system keeps its metadata there) are all on the first file, the blocks from there on
+   go to the files in turn, one block each. block_readv, block_writev and sync_disk hand
+   the part of every other file to a thread of that file, so the files are read and
+   written in parallel. */
+
+#define DISK_NAME_MAX 256      /* longest name of one image file              */
+
+enum { MEMBER_IDLE, MEMBER_READV, MEMBER_WRITEV, MEMBER_SYNC, MEMBER_EXIT };
+
+struct member {
+  int             handle;      /* file handle to the image file               */
+  pthread_t       thread;      /* its I/O thread, for all files but the first */
+  int             running;     /* is the thread there                         */
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+  int             op;          /* MEMBER_* job, MEMBER_IDLE once done         */
+  int             result;
+  off_t           offset;      /* where the job reads or writes               */
+  struct iovec    iov[WRITEV_BLOCKS_MAX];
+  int             iovcnt;
+};
+
 /******************************************************************************/
 static int active = 0;  /* is the virtual disk open (active) */
-static int handle;      /* file handle to virtual disk       */
+static int direct = 0;  /* opened with O_DIRECT              */
+static int members = 0; /* number of image files             */
+static int stripe_start;/* first block striped over them     */
+static struct member member[DISK_MEMBERS_MAX];
+static pthread_mutex_t stripe_mutex = PTHREAD_MUTEX_INITIALIZER;
+                        /* one parallel job at a time        */
+
+/* O_DIRECT needs block aligned buffers: the others go through a bounce buffer of the
+   calling thread, so no I/O allocates */
+static __thread char bounce[BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
+
+static int aligned(char *buf)
+{
+  return ((uintptr_t)buf % BLOCK_SIZE) == 0;
+}
+
+/* split a disk name into the names of its image files, return their number */
+static int split_name(char *name, char paths[][DISK_NAME_MAX])
+{
+  int count = 0;
+
+  for (;;) {
+    int len = strcspn(name, ",");
+    if (len == 0 || len >= DISK_NAME_MAX || count == DISK_MEMBERS_MAX) return -1;
+    memcpy(paths[count], name, len);
+    paths[count++][len] = '\0';
+    if (name[len] == '\0') return count;
+    name += len + 1;
+  }
+}
+
+/* number of blocks image file m of count files holds when the blocks from start on are
+   striped */
+static int member_blocks(int m, int count, int start)
+{
+  int striped = (DISK_BLOCKS - start - m + count - 1) / count;
+  return m == 0 ? start + striped : striped;
+}
+
+/* find the image file of a block and the byte offset of the block in it */
+static int locate(int block, off_t *offset)
+{
+  if (block < stripe_start) {
+    *offset = (off_t)block * BLOCK_SIZE;
+    return 0;
+  }
+
+  int stripe = block - stripe_start;
+  int m = stripe % members;
+  off_t pos = stripe / members;
+  if (m == 0) pos += stripe_start;
+  *offset = pos * BLOCK_SIZE;
+  return m;
+}
+
+/* do the job of an image file, short reads and writes are finished block by block */
+static int member_io(struct member *m, int op)
+{
+  if (op == MEMBER_SYNC) {
+    if (fsync(m->handle) < 0) {
+      perror("sync_disk: failed to fsync");
+      return -1;
+    }
+    return 0;
+  }
+
+  if (op == MEMBER_READV) {
+    ssize_t nread = preadv(m->handle, m->iov, m->iovcnt, m->offset);
+    if (nread < 0) {
+      perror("block_readv: failed to read");
+      return -1;
+    }
+    for (int i = nread / BLOCK_SIZE; i < m->iovcnt; i++) {
+      if (pread(m->handle, m->iov[i].iov_base, BLOCK_SIZE, m->offset + (off_t)i * BLOCK_SIZE) < 0) {
+        perror("block_readv: failed to read");
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  ssize_t written = pwritev(m->handle, m->iov, m->iovcnt, m->offset);
+  if (written < 0) {
+    perror("block_writev: failed to write");
+    return -1;
+  }
+  for (int i = written / BLOCK_SIZE; i < m->iovcnt; i++) {
+    if (pwrite(m->handle, m->iov[i].iov_base, BLOCK_SIZE, m->offset + (off_t)i * BLOCK_SIZE) < 0) {
+      perror("block_writev: failed to write");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void *member_thread(void *arg)
+{
+  struct member *m = arg;
+
+  pthread_mutex_lock(&m->mutex);
+  for (;;) {
+    while (m->op == MEMBER_IDLE)
+      pthread_cond_wait(&m->cond, &m->mutex);
+    if (m->op == MEMBER_EXIT) break;
+
+    int op = m->op;
+    pthread_mutex_unlock(&m->mutex);
+    int result = member_io(m, op);
+    pthread_mutex_lock(&m->mutex);
+    m->result = result;
+    m->op = MEMBER_IDLE;
+    pthread_cond_broadcast(&m->cond);
+  }
+  pthread_mutex_unlock(&m->mutex);
+  return NULL;
+}
+
+static void member_post(struct member *m, int op)
+{
+  pthread_mutex_lock(&m->mutex);
+  m->op = op;
+  pthread_cond_broadcast(&m->cond);
+  pthread_mutex_unlock(&m->mutex);
+}
+
+static int member_wait(struct member *m)
+{
+  pthread_mutex_lock(&m->mutex);
+  while (m->op != MEMBER_IDLE)
+    pthread_cond_wait(&m->cond, &m->mutex);
+  int result = m->result;
+  pthread_mutex_unlock(&m->mutex);
+  return result;
+}
+
+/* run op on every image file with a job (all of them for MEMBER_SYNC), the first one
+   and any without a thread in the calling thread. Takes stripe_mutex */
+static int run_jobs(int op)
+{
+  int rtn = 0;
+
+  for (int i = 1; i < members; i++) {
+    if (member[i].running && (op == MEMBER_SYNC || member[i].iovcnt > 0))
+      member_post(&member[i], op);
+  }
+  for (int i = 0; i < members; i++) {
+    if (i > 0 && member[i].running) continue;
+    if ((op == MEMBER_SYNC || member[i].iovcnt > 0) && member_io(&member[i], op) < 0) rtn = -1;
+  }
+  for (int i = 1; i < members; i++) {
+    if (member[i].running && (op == MEMBER_SYNC || member[i].iovcnt > 0) && member_wait(&member[i]) < 0)
+      rtn = -1;
+  }
+  return rtn;
+}
+
+/* the threads are not there in a child process, its jobs are done in the calling thread */
+static void fork_prepare() { pthread_mutex_lock(&stripe_mutex); }
+static void fork_parent()  { pthread_mutex_unlock(&stripe_mutex); }
+static void fork_child()
+{
+  pthread_mutex_unlock(&stripe_mutex);
+  for (int i = 0; i < DISK_MEMBERS_MAX; i++) {
+    if (!member[i].running) continue;
+    pthread_mutex_init(&member[i].mutex, NULL);
+    pthread_cond_init(&member[i].cond, NULL);
+    member[i].running = 0;
+  }
+}
+
+static void register_fork_handlers()
+{
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+/* stop the threads and close the first count image files */
+static void close_members(int count)
+{
+  for (int i = 0; i < count; i++) {
+    if (member[i].running) {
+      member_post(&member[i], MEMBER_EXIT);
+      pthread_join(member[i].thread, NULL);
+      pthread_mutex_destroy(&member[i].mutex);
+      pthread_cond_destroy(&member[i].cond);
+      member[i].running = 0;
+    }
+    close(member[i].handle);
+  }
+}
 
 /******************************************************************************/
 int make_disk(char *name)
-{ 
-  int f, cnt;
+{
+  return make_disk_ext(name, 0);
+}
+
+int make_disk_ext(char *name, int start)
+{
+  int f, cnt, count;
   char buf[BLOCK_SIZE];
+  char paths[DISK_MEMBERS_MAX][DISK_NAME_MAX];
 
-  if (!name) {
+  if (!name || (count = split_name(name, paths)) < 0) {
     fprintf(stderr, "make_disk: invalid file name\n");
     return -1;
   }
 
-  if ((f = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
-    perror("make_disk: cannot open file");
+  if ((start < 0) || (start > DISK_BLOCKS)) {
+    fprintf(stderr, "make_disk: stripe start out of bounds\n");
     return -1;
   }
 
   memset(buf, 0, BLOCK_SIZE);
-  for (cnt = 0; cnt < DISK_BLOCKS; ++cnt)
-    write(f, buf, BLOCK_SIZE);
+  for (int i = 0; i < count; i++) {
+    if ((f = open(paths[i], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+      perror("make_disk: cannot open file");
+      return -1;
+    }
+
+    for (cnt = 0; cnt < member_blocks(i, count, start); ++cnt)
+      write(f, buf, BLOCK_SIZE);
 
-  close(f);
+    close(f);
+  }
 
   return 0;
 }
 
 int open_disk(char *name)
 {
-  int f;
+  return open_disk_ext(name, 0, 0);
+}
+
+int open_disk_ext(char *name, int flags, int start)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  int f, count;
+  char paths[DISK_MEMBERS_MAX][DISK_NAME_MAX];
 
-  if (!name) {
+  if (!name || (count = split_name(name, paths)) < 0) {
     fprintf(stderr, "open_disk: invalid file name\n");
     return -1;
-  }  
-  
+  }
+
   if (active) {
     fprintf(stderr, "open_disk: disk is already open\n");
     return -1;
   }
-  
-  if ((f = open(name, O_RDWR, 0644)) < 0) {
-    perror("open_disk: cannot open file");
+
+  if ((start < 0) || (start > DISK_BLOCKS)) {
+    fprintf(stderr, "open_disk: stripe start out of bounds\n");
     return -1;
   }
 
-  handle = f;
+  pthread_once(&once, register_fork_handlers);
+
+  /* a host file system without O_DIRECT (tmpfs) gets the usual buffered I/O */
+  direct = 0;
+  for (int i = 0; i < count; i++) {
+    if ((flags & DISK_DIRECT) && (f = open(paths[i], O_RDWR | O_DIRECT, 0644)) >= 0) {
+      direct = 1;
+    } else if ((f = open(paths[i], O_RDWR, 0644)) < 0) {
+      perror("open_disk: cannot open file");
+      close_members(i);
+      return -1;
+    }
+
+    member[i].handle = f;
+    member[i].op = MEMBER_IDLE;
+    member[i].iovcnt = 0;
+    if (i > 0) {
+      pthread_mutex_init(&member[i].mutex, NULL);
+      pthread_cond_init(&member[i].cond, NULL);
+      member[i].running = pthread_create(&member[i].thread, NULL, member_thread, &member[i]) == 0;
+    }
+  }
+
+  members = count;
+  stripe_start = start;
   active = 1;
 
   return 0;
 }
 
+int disk_members()
+{
+  return active ? members : 0;
+}
+
 int close_disk()
 {
   if (!active) {
     fprintf(stderr, "close_disk: no open disk\n");
     return -1;
   }
-  
-  close(handle);
 
-  active = handle = 0;
+  close_members(members);
+
+  active = members = direct = 0;
 
   return 0;
 }
 
+int sync_disk()
+{
+  if (!active) {
+    fprintf(stderr, "sync_disk: no open disk\n");
+    return -1;
+  }
+
+  pthread_mutex_lock(&stripe_mutex);
+  int rtn = run_jobs(MEMBER_SYNC);
+  pthread_mutex_unlock(&stripe_mutex);
+
+  return rtn;
+}
+
 int block_write(int block, char *buf)
 {
+  off_t offset;
+
   if (!active) {
     fprintf(stderr, "block_write: disk not active\n");
     return -1;
@@ -86,12 +367,14 @@ int block_write(int block, char *buf)
     return -1;
   }
 
-  if (lseek(handle, block * BLOCK_SIZE, SEEK_SET) < 0) {
-    perror("block_write: failed to lseek");
-    return -1;
+  if (direct && !aligned(buf)) {
+    memcpy(bounce, buf, BLOCK_SIZE);
+    buf = bounce;
   }
 
-  if (write(handle, buf, BLOCK_SIZE) < 0) {
+  /* positioned I/O, so that several threads can use the disk at once */
+  int m = locate(block, &offset);
+  if (pwrite(member[m].handle, buf, BLOCK_SIZE, offset) < 0) {
     perror("block_write: failed to write");
     return -1;
   }
@@ -99,8 +382,122 @@ int block_write(int block, char *buf)
   return 0;
 }
 
+int block_writev(int block, char **bufs, int count)
+{
+  if (!active) {
+    fprintf(stderr, "block_writev: disk not active\n");
+    return -1;
+  }
+
+  if ((block < 0) || (count <= 0) || (count > WRITEV_BLOCKS_MAX) || (block + count > DISK_BLOCKS)) {
+    fprintf(stderr, "block_writev: block index out of bounds\n");
+    return -1;
+  }
+
+  /* O_DIRECT cannot take an unaligned buffer, block_write bounces it */
+  for (int i = 0; i < count; i++) {
+    if (direct && !aligned(bufs[i])) {
+      for (int j = 0; j < count; j++) {
+        if (block_write(block + j, bufs[j]) < 0) return -1;
+      }
+      return 0;
+    }
+  }
+
+  /* consecutive blocks are consecutive in each image file, so every file gets one
+     system call for its part of the run */
+  pthread_mutex_lock(&stripe_mutex);
+  for (int i = 0; i < members; i++)
+    member[i].iovcnt = 0;
+  for (int i = 0; i < count; i++) {
+    off_t offset;
+    struct member *m = &member[locate(block + i, &offset)];
+    if (m->iovcnt == 0) m->offset = offset;
+    m->iov[m->iovcnt].iov_base = bufs[i];
+    m->iov[m->iovcnt++].iov_len = BLOCK_SIZE;
+  }
+  int rtn = run_jobs(MEMBER_WRITEV);
+  pthread_mutex_unlock(&stripe_mutex);
+
+  return rtn;
+}
+
+int block_readv(int block, char **bufs, int count)
+{
+  if (!active) {
+    fprintf(stderr, "block_readv: disk not active\n");
+    return -1;
+  }
+
+  if ((block < 0) || (count <= 0) || (count > WRITEV_BLOCKS_MAX) || (block + count > DISK_BLOCKS)) {
+    fprintf(stderr, "block_readv: block index out of bounds\n");
+    return -1;
+  }
+
+  /* O_DIRECT cannot take an unaligned buffer, block_read bounces it */
+  for (int i = 0; i < count; i++) {
+    if (direct && !aligned(bufs[i])) {
+      for (int j = 0; j < count; j++) {
+        if (block_read(block + j, bufs[j]) < 0) return -1;
+      }
+      return 0;
+    }
+  }
+
+  /* as in block_writev, every file gets one system call for its part of the run */
+  pthread_mutex_lock(&stripe_mutex);
+  for (int i = 0; i < members; i++)
+    member[i].iovcnt = 0;
+  for (int i = 0; i < count; i++) {
+    off_t offset;
+    struct member *m = &member[locate(block + i, &offset)];
+    if (m->iovcnt == 0) m->offset = offset;
+    m->iov[m->iovcnt].iov_base = bufs[i];
+    m->iov[m->iovcnt++].iov_len = BLOCK_SIZE;
+  }
+  int rtn = run_jobs(MEMBER_READV);
+  pthread_mutex_unlock(&stripe_mutex);
+
+  return rtn;
+}
+
+int block_discard(int block, int count)
+{
+  off_t first[DISK_MEMBERS_MAX];
+  int   blocks[DISK_MEMBERS_MAX] = {0};
+
+  if (!active) {
+    fprintf(stderr, "block_discard: disk not active\n");
+    return -1;
+  }
+
+  if ((block < 0) || (count <= 0) || (block + count > DISK_BLOCKS)) {
+    fprintf(stderr, "block_discard: block index out of bounds\n");
+    return -1;
+  }
+
+  /* like block_writev, each image file gets one hole for its part of the run */
+  for (int i = 0; i < count; i++) {
+    off_t offset;
+    int m = locate(block + i, &offset);
+    if (blocks[m]++ == 0) first[m] = offset;
+  }
+  for (int m = 0; m < members; m++) {
+    if (blocks[m] > 0 &&
+        fallocate(member[m].handle, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, first[m],
+                  (off_t)blocks[m] * BLOCK_SIZE) < 0) {
+      perror("block_discard: failed to punch a hole");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 int block_read(int block, char *buf)
 {
+  off_t offset;
+
   if (!active) {
     fprintf(stderr, "block_read: disk not active\n");
     return -1;
@@ -111,15 +508,19 @@ int block_read(int block, char *buf)
     return -1;
   }
 
-  if (lseek(handle, block * BLOCK_SIZE, SEEK_SET) < 0) {
-    perror("block_read: failed to lseek");
-    return -1;
-  }
-
-  if (read(handle, buf, BLOCK_SIZE) < 0) {
+  /* positioned I/O, so that several threads can use the disk at once */
+  int m = locate(block, &offset);
+  char *target = (direct && !aligned(buf)) ? bounce : buf;
+  if (pread(member[m].handle, target, BLOCK_SIZE, offset) < 0) {
     perror("block_read: failed to read");
     return -1;
   }
+  if (target != buf) memcpy(buf, target, BLOCK_SIZE);
 
   return 0;
 }
+
+int disk_direct()
+{
+  return active && direct;
+}
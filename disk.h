@@ -4,16 +4,35 @@
 /******************************************************************************/
 #define DISK_BLOCKS  8192      /* number of blocks on the disk                */
 #define BLOCK_SIZE   4096      /* block size on "disk"                        */
+#define WRITEV_BLOCKS_MAX 64   /* most blocks block_readv/writev take at once */
+#define DISK_DIRECT  0x1       /* open_disk_ext: bypass the host page cache   */
+#define DISK_MEMBERS_MAX 8     /* most image files a disk is striped over     */
 
 /******************************************************************************/
-int make_disk(char *name);     /* create an empty, virtual disk file          */
+int make_disk(char *name);     /* create an empty, virtual disk file, or the
+                                  image files of a name like "a,b" (striped)  */
+int make_disk_ext(char *name, int stripe_start);
+                               /* same, the blocks before stripe_start all on
+                                  the first image file                        */
 int open_disk(char *name);     /* open a virtual disk (file)                  */
+int open_disk_ext(char *name, int flags, int stripe_start);
+                               /* open a virtual disk with DISK_* flags and
+                                  the stripe start it was made with           */
+int disk_direct();             /* is the open disk bypassing the page cache   */
+int disk_members();            /* number of image files of the open disk      */
 int close_disk();              /* close a previously opened disk (file)       */
+int sync_disk();               /* flush written blocks to stable storage      */
 
 int block_write(int block, char *buf);
                                /* write a block of size BLOCK_SIZE to disk    */
+int block_writev(int block, char **bufs, int count);
+                               /* write count consecutive blocks at once      */
 int block_read(int block, char *buf);
                                /* read a block of size BLOCK_SIZE from disk   */
+int block_readv(int block, char **bufs, int count);
+                               /* read count consecutive blocks at once       */
+int block_discard(int block, int count);
+                               /* punch count blocks out of the image files   */
 /******************************************************************************/
 
 #endif
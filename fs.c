@@ -3,99 +3,325 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <pthread.h>
 #include "disk.h"
 #include "fs.h"
+#include "trace.h"
+#include "journal.h"
+#include "crc32c.h"
+#include "fs_internal.h"
 
-#define EMPTY 0
-#define END_OF_FILE -1
+/* number of metadata-changing operations batched into one journal transaction */
+#define JOURNAL_GROUP_OPS 16
 
 /*
-super_block:
-This is the first block of the disk and it contains informataion about the location of the other
-data structures (FAT, root directory, and the start of the data blocks).
+openFile:
+It represents a file that is open, shared by all the file descriptors of that file, indexed
+by directory entry. refs counts those descriptors, a file cannot be deleted while it is open
 
-ind_root_dir         - index of root directory
-ind_start_data_block - index of the first data block
-ind_FAT              - index of FAT
-num_FAT_blocks       - total number of FAT blocks
-num_data_blocks      - total number of data blocks 
+fileDescriptor:
+It represents an array of structs which define, for each file descriptor, the open file it
+refers to (NULL when the descriptor is free) and its file offset. The table starts with
+FILDES_INITIAL descriptors and doubles when they are all in use, up to FILE_OPEN_MAX. Free
+descriptors are linked through next_free, so fs_open and fs_close never scan the table
 */
-struct super_block{
-	int ind_root_dir;
-	int ind_start_data_block;
-	int ind_FAT;
-	int num_FAT_blocks;
-	int num_data_blocks;
+#define FILDES_INITIAL 32
+
+struct openFile{
+	int ind;
+	int refs;
 };
 
+struct fileDescriptor{
+	struct openFile *file;
+	off_t offset;
+	int next_free;
+};
+/*
+Initialize variables
+
+*/
+struct super_block    *superblock;
+struct openFile       open_files[FILE_NUM_MAX];
+struct fileDescriptor *file_descriptors;
+int                   num_fildes;         /* descriptors in the table */
+int                   free_fildes = -1;   /* first free descriptor, -1 when none is left */
 
 /*
-File allocation table (FAT):
+Metadata block cache:
+In-memory copies of the FAT and directory blocks, indexed by block number. A block is read
+the first time it is used (see meta_block_buf), so a lazy mount only reads the super block.
+Every block has its own slot in the memory pool (see pool.c), NULL here until it is read
+*/
+char *meta_cache[META_BLOCKS_MAX];
+
+/*
+Metadata changed since the last journal commit, indexed by block number, and the number
+of operations that changed metadata since then.
+meta_home_dirty tracks the blocks changed since they were last written to their home
+location, so that a checkpoint only writes those
+*/
+bool meta_dirty[META_BLOCKS_MAX];
+bool meta_home_dirty[META_BLOCKS_MAX];
+int  meta_ops;
+
+/* metadata blocks read from disk that did not match their checksum since mount */
+int meta_bad_checksums;
 
-This is the block after superblock. FAT can take more than one block on the disk depends on the number
-of data blocks. It is used to keep track of empty blocks and the mapping between files and their data blocks.
+/* mounted by mount_snapshot: nothing may be changed or written */
+bool mount_readonly;
 
-It presents an array of structs containing entry
-ind_entry            
+/* serializes the public fs_* calls with background work */
+pthread_mutex_t fs_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/*this additional function helps to get an open file descriptor. Return NULL if fildes is not open*/
+static struct fileDescriptor *get_fildes(int fildes){
+	if(fildes < 0 || fildes >= num_fildes || file_descriptors[fildes].file == NULL) return NULL;
+	return &file_descriptors[fildes];
+}
+
+/*additional function helps to double the file descriptor table and put the new descriptors
+  on the free list. Return -1 if there are already FILE_OPEN_MAX descriptors
 */
+static int grow_fildes(){
+	int count = num_fildes > 0 ? num_fildes * 2 : FILDES_INITIAL;
+	if(count > FILE_OPEN_MAX) count = FILE_OPEN_MAX;
+	if(count <= num_fildes) return -1;
+
+	struct fileDescriptor *table = realloc(file_descriptors, count * sizeof(struct fileDescriptor));
+	if(table == NULL) return -1;
+	//lowest numbers first
+	for(int i = count - 1; i >= num_fildes; i --){
+		table[i].file = NULL;
+		table[i].offset = 0;
+		table[i].next_free = free_fildes;
+		free_fildes = i;
+	}
+	file_descriptors = table;
+	num_fildes = count;
+	return 0;
+}
 
-struct FAT{
-	int ind_entry;
-};
+/*additional function helps to close every file descriptor*/
+static void reset_fildes(){
+	free(file_descriptors);
+	file_descriptors = NULL;
+	num_fildes = 0;
+	free_fildes = -1;
+	memset(open_files, 0, sizeof(open_files));
+}
 
-/*
-rootDirectory:
+/*additional function helps to get the in-memory copy of a metadata block, reading it into
+  the metadata cache on first use. Return NULL if block does not hold metadata or cannot be read
+*/
+char *meta_block_buf(int block){
+	if(block == 0) return (char*)superblock;
+	if(block < 0 || block >= META_BLOCKS_MAX) return NULL;
+	if(meta_cache[block] != NULL) return meta_cache[block];
+
+	//a mounted snapshot has its own copy of some blocks. The others belong to the file
+	//system that may be written meanwhile, their checksums cannot be trusted
+	uint32_t checksum = superblock->meta_checksum[block];
+	int source = snapshot_source(block, &checksum);
+	bool verify = !mount_readonly || source != block;
+
+	char *buf = pool_meta_block(block);
+	if(buf == NULL || block_read(source, buf) == -1) return NULL;
+
+	if((superblock->features & FS_FEATURE_CHECKSUMS) && verify &&
+	   crc32c(0, buf, BLOCK_SIZE) != checksum){
+		fprintf(stderr, "metadata block %d: checksum mismatch\n", block);
+		meta_bad_checksums ++;
+	}
+
+	//isActive only tells an entry is in use, older images also set it for open files
+	if(block == superblock->ind_root_dir){
+		struct rootDirectory *dir = (struct rootDirectory*)buf;
+		for(int i = 0; i < FILE_NUM_MAX; i++){
+			dir[i].isActive = entry_in_use(&dir[i]);
+		}
+	}
+	meta_cache[block] = buf;
+	return buf;
+}
+
+/*additional function helps to drop the metadata cache once everything is written, the
+  slots stay in the pool for the next mount
+*/
+void free_meta_cache(){
+	for(int i = 0; i < META_BLOCKS_MAX; i ++){
+		meta_cache[i] = NULL;
+	}
+	alloc_reset();
+}
+
+/*additional function helps to get a directory entry*/
+struct rootDirectory *get_dir_entry(int index){
+	return (struct rootDirectory*)meta_block_buf(superblock->ind_root_dir) + index;
+}
 
-The block next to FAT block/blocks locates root directory.
-It represents an array of structs which define, for each file, the file size and the head of the list of corresponding
-data blocks.
+/*additional function helps to tell if a directory entry holds a file*/
+bool entry_in_use(struct rootDirectory *entry){
+	return entry->fileName[0] != '\0';
+}
 
-fileName           - the name of the file
-file_size          - the size of the file
-first_data_block   - the location of the first data block for this file
+/*additional function helps to tell if the content of a file is kept in the inline area*/
+bool entry_is_inline(struct rootDirectory *entry){
+	return superblock->ind_inline != 0 && entry->first_data_block == END_OF_FILE &&
+	       entry->file_size > 0 && entry->file_size <= INLINE_DATA_MAX;
+}
+
+/*additional function helps to get the inline slot of a directory entry*/
+char *inline_data(int index){
+	int offset = index * INLINE_DATA_MAX;
+	return meta_block_buf(superblock->ind_inline + offset / BLOCK_SIZE) + offset % BLOCK_SIZE;
+}
 
+/*additional function helps to get the number of blocks the chain of a file should have.
+  Return -1 if it cannot be told
 */
-struct rootDirectory{
-	char fileName[FILENAME_LEN_MAX];
-	int file_size;
-	int first_data_block;
-	bool isActive;	
-};
+int expected_chain_length(struct rootDirectory *entry){
+	if(entry_is_inline(entry)) return 0;
+	if(entry->flags & ENTRY_COMPRESSED) return compressed_chain_length(entry);
+	return (entry->file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
 
-/*
-fileDescriptor:
-It represents an array of structs which define, for each file descriptor, an index in the range between 0 and 31 (inclusive)
-A file descriptor contains a file offset, the name of the file it is associated with, and a boolean variable to update its 
-status
+/*additional function helps to get the number of blocks at the start of the chain of a
+  file that hold data, the others were reserved by fs_fallocate and never written.
+  Return -1 if it cannot be told (all of them may hold data)
 */
-struct fileDescriptor{
-	char fileName[FILENAME_LEN_MAX];
-	bool isUsed;
-	off_t offset;
-	int ind;
-};
-/*
-Initialize variables
+int chain_data_blocks(struct rootDirectory *entry){
+	if(!(entry->flags & ENTRY_PREALLOC)) return -1;
+	return (entry->file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+/*additional function helps to get the checksum region entry of a data block*/
+static uint32_t *data_checksum(int block){
+	uint32_t *region = (uint32_t*)meta_block_buf(superblock->ind_checksum + block / CHECKSUMS_PER_BLOCK);
+	return &region[block % CHECKSUMS_PER_BLOCK];
+}
+
+/*additional function helps to tell if the content of a physical block matches its checksum*/
+static bool data_checksum_ok(int phys, char *buf){
+	if(!(superblock->features & FS_FEATURE_CHECKSUMS)) return true;
+	return crc32c(0, buf, BLOCK_SIZE) == *data_checksum(phys);
+}
 
+/*additional function helps to read a physical block of the data region, verifying its
+  checksum
 */
-struct super_block    *superblock;
-struct rootDirectory  *root_dir;
-struct FAT            *fat;
-struct fileDescriptor file_descriptors[FILE_OPEN_MAX];
+int physical_block_read(int phys, char *buf){
+	if(wb_read(phys + superblock->ind_start_data_block, buf) == -1) return -1;
+	if(!data_checksum_ok(phys, buf)){
+		fprintf(stderr, "data block %d: checksum mismatch\n", phys);
+		return -1;
+	}
+	return 0;
+}
+
+/*additional function helps to read count consecutive physical blocks of the data region
+  at once, verifying their checksums
+*/
+int physical_blocks_read(int phys, char **bufs, int count){
+	if(wb_readv(phys + superblock->ind_start_data_block, bufs, count) == -1) return -1;
+	if(!(superblock->features & FS_FEATURE_CHECKSUMS)) return 0;
+
+	//the checksums of a run are consecutive in the checksum region, the block of the
+	//region holding them is only looked up again when the run crosses into the next one
+	uint32_t *checksum = NULL;
+	for(int i = 0; i < count; i ++){
+		if(checksum == NULL || (phys + i) % CHECKSUMS_PER_BLOCK == 0) checksum = data_checksum(phys + i);
+		else checksum ++;
+		if(crc32c(0, bufs[i], BLOCK_SIZE) != *checksum){
+			fprintf(stderr, "data block %d: checksum mismatch\n", phys + i);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*additional function helps to write a physical block of the data region, updating its
+  checksum. The block goes to the write-back buffer, and the checksum region is metadata,
+  so both are durable with the next journal commit
+*/
+int physical_block_write(int phys, char *buf){
+	if(superblock->features & FS_FEATURE_CHECKSUMS){
+		*data_checksum(phys) = crc32c(0, buf, BLOCK_SIZE);
+		mark_meta_dirty(superblock->ind_checksum + phys / CHECKSUMS_PER_BLOCK);
+	}
+	return wb_write(phys + superblock->ind_start_data_block, buf);
+}
+
+/*additional function helps to read a data block*/
+int data_block_read(int block, char *buf){
+	if(superblock->ind_block_map != 0){
+		block = dedup_map(block);
+		//allocated but never written
+		if(block == 0){
+			memset(buf, 0, BLOCK_SIZE);
+			return 0;
+		}
+	}
+	return physical_block_read(block, buf);
+}
 
+/*additional function helps to read count data blocks of consecutive indices, at most
+  WRITEV_BLOCKS_MAX. The blocks that are consecutive on disk are read at once
+*/
+int data_blocks_read(int block, char **bufs, int count){
+	for(int i = 0; i < count; ){
+		int phys = superblock->ind_block_map != 0 ? dedup_map(block + i) : block + i;
+		//allocated but never written
+		if(phys == 0){
+			memset(bufs[i ++], 0, BLOCK_SIZE);
+			continue;
+		}
+		int run = 1;
+		while(i + run < count &&
+		      (superblock->ind_block_map != 0 ? dedup_map(block + i + run) : block + i + run) == phys + run){
+			run ++;
+		}
+		if(physical_blocks_read(phys, bufs + i, run) == -1) return -1;
+		i += run;
+	}
+	return 0;
+}
+
+/*additional function helps to write a data block*/
+int data_block_write(int block, char *buf){
+	if(superblock->ind_block_map != 0) return dedup_write(block, buf);
+	return physical_block_write(block, buf);
+}
+
+/*additional function helps to get the value of a FAT entry*/
+int get_fat_entry(int fat_index){
+	if(fat_index < 0 || fat_index >= superblock->num_data_blocks) return END_OF_FILE;
+	struct FAT *fat = (struct FAT*)meta_block_buf(superblock->ind_FAT + fat_index / FAT_ENTRIES_PER_BLOCK);
+	return fat[fat_index % FAT_ENTRIES_PER_BLOCK].ind_entry;
+}
 
 /*make_fs
 ind_root_dir         - index of root directory
 ind_start_data_block - index of the first data block
 ind_FAT              - index of FAT
 num_FAT_entries      - total number of FAT entries
-num_data_blocks      - total number of data blocks */ 
-int make_fs(char *disk_name){
+num_data_blocks      - total number of data blocks
+ind_inline           - index of the inline area for small files (blocks 6-7)
+ind_checksum         - index of the checksum region (blocks 8-11), if asked for
+ind_block_map        - index of the block map (blocks 12-15), reference counts (16-19) and
+ind_refcount           content hashes (20-27), if asked for
+ind_block_hash
+ind_snapshots        - index of the snapshot table (block 28) and of the snapshots (blocks
+ind_snapshot_area      128-303, after the journal), if asked for
+ind_journal          - index of the metadata journal, blocks 29-63 are left for metadata to grow
+num_disks            - number of image files of disk_name */ 
+static int do_make_fs(char *disk_name, int features){
 	if(disk_name == NULL) return -1;
-	 //create and open new disk
-	 make_disk(disk_name);
-	 open_disk(disk_name);
+	wb_stop();
+	 //create and open new disk, the data region is striped over its image files
+	 int start_data_block = 4096; // 4096 data blocks, index in the range between [4096, 8191]
+	 if(make_disk_ext(disk_name, start_data_block) == -1 ||
+	    open_disk_ext(disk_name, 0, start_data_block) == -1) return -1;
    
 	 //initialize and write meta-information for file system
 
@@ -108,17 +334,43 @@ int make_fs(char *disk_name){
 
 	 */
 
-	 superblock = malloc(BLOCK_SIZE);
+	 superblock = (struct super_block*)pool_meta_block(0);
 	 if(superblock == NULL) return -1;
+	 memset(superblock, 0, BLOCK_SIZE);
 	 superblock -> ind_FAT              = 1;
 	 superblock -> num_FAT_blocks       = 4;
 	 superblock -> ind_root_dir         = 5;
-	 superblock -> ind_start_data_block = 4096; // 4096 data blocks, index in the range between [4096, 8191]
+	 superblock -> ind_start_data_block = start_data_block;
 	 superblock -> num_data_blocks      = 4096;
-
-	 /*write superblock to disk*/
+	 superblock -> ind_inline           = 6;
+	 superblock -> ind_journal          = META_BLOCKS_MAX;
+	 superblock -> num_journal_blocks   = JOURNAL_BLOCKS;
+	 superblock -> features             = features;
+	 superblock -> num_disks            = disk_members();
+
+	 /*every other metadata block starts out as zeros*/
+	 if(features & FS_FEATURE_CHECKSUMS){
+	 	char zero[BLOCK_SIZE] = {0};
+	 	superblock -> ind_checksum = 8;
+	 	for(int i = 1; i < META_BLOCKS_MAX; i ++){
+	 		superblock->meta_checksum[i] = crc32c(0, zero, BLOCK_SIZE);
+	 	}
+	 }
+	 if(features & (FS_FEATURE_DEDUP | FS_FEATURE_SNAPSHOTS | FS_FEATURE_LOG)){
+	 	superblock -> ind_block_map  = 12;
+	 	superblock -> ind_refcount   = 16;
+	 }
+	 if(features & FS_FEATURE_DEDUP){
+	 	superblock -> ind_block_hash = 20;
+	 }
+	 if(features & FS_FEATURE_SNAPSHOTS){
+	 	superblock -> ind_snapshots     = 28;
+	 	superblock -> ind_snapshot_area = META_BLOCKS_MAX + JOURNAL_BLOCKS;
+	 }
+
+	 /*write superblock and an empty journal to disk*/
 	 block_write(0, (void*)superblock);
-	 free(superblock);
+	 journal_format(superblock->ind_journal, superblock->num_journal_blocks);
 	 close_disk();
 	 printf("//======make_fs======//\n");
 	 printf("make successfully\n");
@@ -126,35 +378,81 @@ int make_fs(char *disk_name){
     return 0;
  } 
 
-/*mount_fs*/
-int mount_fs(char *disk_name){
+/*mount_fs, or mount_snapshot when snapshot is not NULL*/
+static int do_mount_fs(char *disk_name, int flags, char *snapshot){
 	if(disk_name == NULL) return -1;
-	if(open_disk(disk_name) == -1) return -1;
+	wb_stop();
+	int disk_flags = (flags & MOUNT_DIRECT) ? DISK_DIRECT : 0;
+	if(open_disk_ext(disk_name, disk_flags, 0) == -1) return -1;
 	
-	//read super block
-	superblock = malloc(BLOCK_SIZE);
+	//read super block, block 0 is at the start of the first image file whatever the
+	//stripe start
+	superblock = (struct super_block*)pool_meta_block(0);
+	if(superblock == NULL){
+		close_disk();
+		return -1;
+	}
 	block_read(0, (void*)superblock);
-  
+
+	//a striped file system needs all of its image files, in the same order, opened
+	//with the data region striped
+	if((superblock->num_disks > 0 ? superblock->num_disks : 1) != disk_members()){
+		close_disk();
+		return -1;
+	}
+	if(disk_members() > 1){
+		close_disk();
+		if(open_disk_ext(disk_name, disk_flags, superblock->ind_start_data_block) == -1) return -1;
+	}
+
+	//replay committed metadata transactions before trusting any metadata block.
+	//the journal never moves, so its location is valid even in a stale superblock.
+	//a snapshot does not need the journal, which may be in use by another process
+	mount_readonly = snapshot != NULL;
+	if(!mount_readonly &&
+	   (journal_open(superblock->ind_journal, superblock->num_journal_blocks) == -1 ||
+	    journal_recover() == -1)){
+		close_disk();
+		return -1;
+	}
+	block_read(0, (void*)superblock);
+	memset(meta_dirty, 0, sizeof(meta_dirty));
+	memset(meta_home_dirty, 0, sizeof(meta_home_dirty));
+	free_meta_cache();
+	dedup_reset();
+	log_reset();
+	snapshot_close();
+	delalloc_reset(!snapshot && (flags & MOUNT_DELALLOC));
+	discard_reset(!snapshot && (flags & MOUNT_DISCARD));
+	dcache_reset(true);
+	meta_ops = 0;
+	meta_bad_checksums = 0;
+
+	if(mount_readonly && snapshot_open(snapshot) == -1){
+		free_meta_cache();
+		close_disk();
+		mount_readonly = false;
+		return -1;
+	}
    
-  //initialize FAT blocks
-  fat = malloc((superblock->num_FAT_blocks) * BLOCK_SIZE);
-  for(int i = 0; i < superblock -> num_FAT_blocks; i ++){
-   	block_read(i+1, (void*)fat + (i*BLOCK_SIZE)); // read four consecutive 4096-bytes blocks  
+  //initialize FAT blocks and directory information
+  //a lazy mount leaves them to be read on first use
+  if(!(flags & MOUNT_LAZY)){
+  	load_metadata();
   }
 
-	/*initialize directory information*/
-  root_dir = malloc(BLOCK_SIZE);
-  block_read((superblock->num_FAT_blocks) + 1, (void*)root_dir);
-
-  for(int i = 0; i <FILE_NUM_MAX; i++){
-  	root_dir[i].isActive = false;
+  //data blocks are written back in the background, a snapshot writes nothing
+  if(!mount_readonly && wb_start() == -1){
+  	free_meta_cache();
+  	close_disk();
+  	return -1;
   }
+  //and segments of the log cleaned
+  log_start();
 
 
    /*get file descriptor ready*/
-  for(int i = 0; i < FILE_OPEN_MAX ; i++){
-   	file_descriptors[i].isUsed = false;
-  }
+  reset_fildes();
 
   printf("//======mount_fs()======//\n");
   printf("%s mounted successfully\n",disk_name);
@@ -164,23 +462,154 @@ int mount_fs(char *disk_name){
 	return 0;
 }
 
-int umount_fs(char *disk_name){
+/*additional function helps to read one region of metadata blocks into the cache*/
+static int load_region(int start, int count){
+	for(int i = 0; start != 0 && i < count; i ++){
+		if(meta_block_buf(start + i) == NULL) return -1;
+	}
+	return 0;
+}
+
+/*additional function helps to read every metadata block of the image into the cache.
+  Return -1 if one cannot be read
+*/
+int load_metadata(){
+	if(load_region(superblock->ind_FAT, superblock->num_FAT_blocks) == -1) return -1;
+	if(load_region(superblock->ind_root_dir, 1) == -1) return -1;
+	if(load_region(superblock->ind_inline, INLINE_BLOCKS) == -1) return -1;
+	if(load_region(superblock->ind_checksum, CHECKSUM_BLOCKS) == -1) return -1;
+	if(load_region(superblock->ind_block_map, BLOCK_MAP_BLOCKS) == -1) return -1;
+	if(load_region(superblock->ind_refcount, REFCOUNT_BLOCKS) == -1) return -1;
+	if(load_region(superblock->ind_block_hash, BLOCK_HASH_BLOCKS) == -1) return -1;
+	return load_region(superblock->ind_snapshots, 1);
+}
+
+/*additional function helps to remember that a metadata block has to go into the next
+  journal transaction and the next checkpoint
+*/
+void mark_meta_dirty(int block){
+	meta_dirty[block] = true;
+	meta_home_dirty[block] = true;
+}
+
+/*additional function helps to update a FAT entry and mark the FAT block holding it dirty*/
+void set_fat_entry(int fat_index, int value){
+	int block = superblock->ind_FAT + fat_index / FAT_ENTRIES_PER_BLOCK;
+	struct FAT *fat = (struct FAT*)meta_block_buf(block);
+
+	//a freed data block gives up its physical block
+	int old = fat[fat_index % FAT_ENTRIES_PER_BLOCK].ind_entry;
+	if(value == EMPTY && old != EMPTY){
+		if(superblock->ind_block_map != 0) dedup_release(fat_index);
+		else discard_mark(fat_index);
+	}
+	if((value == EMPTY) != (old == EMPTY)) alloc_update(fat_index, value == EMPTY);
+	fat[fat_index % FAT_ENTRIES_PER_BLOCK].ind_entry = value;
+	mark_meta_dirty(block);
+}
+
+/*additional function helps to mark the block holding the inline slot of a directory entry dirty*/
+static void mark_inline_dirty(int index){
+	mark_meta_dirty(superblock->ind_inline + index * INLINE_DATA_MAX / BLOCK_SIZE);
+}
+
+/*additional function helps to record the checksums of the metadata blocks about to be
+  written in the super block, which is then written with them
+*/
+static void update_meta_checksums(bool *dirty){
+	if(!(superblock->features & FS_FEATURE_CHECKSUMS)) return;
+
+	for(int i = 1; i < META_BLOCKS_MAX; i ++){
+		if(dirty[i]){
+			superblock->meta_checksum[i] = crc32c(0, meta_block_buf(i), BLOCK_SIZE);
+			mark_meta_dirty(0);
+		}
+	}
+}
+
+/*additional function helps to write metadata to its home location. Only the super block,
+  FAT and directory blocks changed since the last checkpoint are written. Once they are on
+  disk the transactions in the journal are no longer needed
+*/
+int checkpoint_metadata(){
+	int written = 0;
+
+	if(delalloc_flush_all() == -1 || wb_flush() == -1) return -1;
+	update_meta_checksums(meta_home_dirty);
+	for(int i = 0; i < META_BLOCKS_MAX; i ++){
+		if(meta_home_dirty[i]){
+			if(block_write(i, meta_block_buf(i)) == -1) return -1;
+			meta_home_dirty[i] = false;
+			written ++;
+		}
+	}
+
+	if(written > 0 && sync_disk() == -1) return -1;
+	memset(meta_dirty, 0, sizeof(meta_dirty));
+	meta_ops = 0;
+	if(journal_checkpoint() == -1) return -1;
+	discard_flush();
+	return 0;
+}
+
+/*additional function helps to make all metadata changes so far durable with a single
+  journal transaction. Falls back to a checkpoint when the journal is full or the image
+  has no journal
+*/
+int commit_metadata(){
+	int  blocks[META_BLOCKS_MAX];
+	char *bufs[META_BLOCKS_MAX];
+	int  count = 0;
+
+	//data first, the chains committed below may point to it
+	if(delalloc_flush_all() == -1 || wb_flush() == -1) return -1;
+	update_meta_checksums(meta_dirty);
+	for(int i = 0; i < META_BLOCKS_MAX; i ++){
+		if(meta_dirty[i]){
+			blocks[count] = i;
+			bufs[count] = meta_block_buf(i);
+			count ++;
+		}
+	}
+	meta_ops = 0;
+	if(count == 0) return 0;
+
+	if(journal_space() < count + 2) return checkpoint_metadata();
+	if(journal_commit(blocks, bufs, count) == -1) return -1;
+	memset(meta_dirty, 0, sizeof(meta_dirty));
+	discard_flush();
+	return 0;
+}
+
+/*additional function helps to batch the metadata changes of several operations into one
+  journal transaction (group commit)
+*/
+int group_commit(){
+	for(int i = 0; i < META_BLOCKS_MAX; i ++){
+		if(meta_dirty[i]){
+			if(++meta_ops >= JOURNAL_GROUP_OPS) return commit_metadata();
+			break;
+		}
+	}
+	return 0;
+}
+
+static int do_umount_fs(char *disk_name){
 	 if(disk_name == NULL) return -1;
    
-   /*write super block*/
-   block_write(0,(void*)superblock);
-   
-	/*write FAT table*/
-	for(int i = 0; i <= superblock-> num_FAT_blocks; i ++){
-		block_write(i+1, (void*)fat + (i * BLOCK_SIZE));
-	}
-	/*write directory*/
-	block_write((superblock->num_FAT_blocks)+1,(void*)root_dir);
+   /*write the super block, FAT and directory blocks that changed*/
+   if(!mount_readonly && checkpoint_metadata() == -1) return -1;
+   if(wb_stop() == -1) return -1;
+   delalloc_reset(false);
+   discard_reset(false);
+   dcache_reset(true);
+   free_meta_cache();
+   dedup_reset();
+   snapshot_close();
+   mount_readonly = false;
 
    /*clear file descriptor*/
-   for(int i = 0; i < FILE_OPEN_MAX; i++){
-   	file_descriptors[i].isUsed = false;
-   }
+   reset_fildes();
 	printf("//======umount_fs======//\n");
 	printf("umount successfully\n");
 	printf("\n");
@@ -188,42 +617,25 @@ int umount_fs(char *disk_name){
    return 0;
 }
 
-/*this additional function helps to find the index of the file with given name*/
+/*this additional function helps to find the index of the file with given path (see dir.c).
+  Return -1 if there is no such file, or it is a directory
+*/
 int find_file_index(char *name){
-	int index = -1;
-	for(int i = 0; i < FILE_NUM_MAX; i++){
-		if(strcmp(root_dir[i].fileName,name) == 0){
-			index = i;
-			break;
-		}
-	}
+	int parent, len;
+	char *last;
+
+	if(name == NULL) return -1;
+	int index = lookup_path(name, &parent, &last, &len);
+	if(index == -1 || (get_dir_entry(index)->flags & ENTRY_DIRECTORY)) return -1;
 	return index;
 }
 
 
-/*this additional function helps to find the available file descriptor. Return the index of the available file descriptor.
-  Return -1 if none is available
+/*additional function helps to get number of available fat entries, kept by the
+  allocation groups. Entry 0 is never handed out: a link to it would read as EMPTY
 */
-int find_unused_fildes(){
-	int index = -1;
-	for(int i = 0; i < FILE_OPEN_MAX; i ++){
-		if(file_descriptors[i].isUsed == false){
-			index = i;
-			break;
-		}
-	}
-	return index;
-}
-
-/*additional function helps to get number of available fat entries*/
 int num_free_entries(){
-	int counter = 0;
-	for(int i = 0; i < superblock -> num_data_blocks; i++){
-		if(fat[i].ind_entry == EMPTY){
-			counter ++;
-		}
-	}
-	return counter;
+	return alloc_free_blocks();
 }
 
 /*addtional function helps to get the current FAT entry, for writing and reading*/
@@ -233,7 +645,7 @@ int cur_fat_entry(int fat_index, int iteration){
 		if(fat_index == END_OF_FILE){
 			return -1;
 		}
-		fat_index = fat[fat_index].ind_entry;
+		fat_index = get_fat_entry(fat_index);
 	}
 	return fat_index;
 }
@@ -244,106 +656,114 @@ int free_FAT_entries(int fat_index, int iteration){
 		if(fat_index == END_OF_FILE){
 			return -1;
 		}
-		fat_index = fat[fat_index].ind_entry;
-		fat[fat_index].ind_entry = EMPTY;
+		int next = get_fat_entry(fat_index);
+		set_fat_entry(fat_index, EMPTY);
+		fat_index = next;
 	}
 	return fat_index;
 }
+/*additional function helps to move the content of an inline file to a data block once it
+  grows past INLINE_DATA_MAX. Return -1 if the disk is full
+*/
+static int spill_inline(int index){
+	struct rootDirectory *dir = get_dir_entry(index);
+	char buf[BLOCK_SIZE];
+
+	if(dir->flags & ENTRY_COMPRESSED){
+		int size = dir->file_size;
+		memcpy(buf, inline_data(index), size);
+		return compressed_write(index, 0, buf, size) == size ? 0 : -1;
+	}
+
+	int block = alloc_find();
+	if(block == -1) return -1;
+	memset(buf, 0, BLOCK_SIZE);
+	memcpy(buf, inline_data(index), dir->file_size);
+	if(data_block_write(block, buf) == -1) return -1;
+	set_fat_entry(block, END_OF_FILE);
+	dir->first_data_block = block;
+	mark_meta_dirty(superblock->ind_root_dir);
+	return 0;
+}
+
 //file operations
 
-int fs_open(char *name){
-	int fildes_index = -1;
-	//look for file index using given name, and check if file is already opened
+static int do_fs_open(char *name){
+	//look for file index using given name
 	int index = find_file_index(name);
 	if(index == -1) return -1;
-   if(root_dir[index].isActive == true){
-   	//look for file descriptor associated with the file and return the value
-   	for(int i = 0; i < FILE_OPEN_MAX ; i++){
-   		if(file_descriptors[i].ind == index){
-   			fildes_index = i;
-   			break;
-   		}
-   	}
-   }
+
+   //return -1 if none file descriptor is available
+   //else, take the first free descriptor and share the open file with its other descriptors
+   if(free_fildes == -1 && grow_fildes() == -1) return -1;
+   int fildes_index = free_fildes;
+   struct fileDescriptor *fd = &file_descriptors[fildes_index];
+   free_fildes = fd->next_free;
+   fd->file = &open_files[index];
+   fd->offset = 0;
+   open_files[index].ind = index;
+   open_files[index].refs ++;
+
    printf("//======fs_open======//\n");
    printf("file descriptor index of %s is %d\n", name, fildes_index);
    printf("\n");
-   //return -1 if none file descriptor is available
-   //else, initialize the available file descriptor and activate/open file.
-   if(find_unused_fildes() == -1){
-   	return -1;
-   }else{
-   	fildes_index = find_unused_fildes();
-   	file_descriptors[fildes_index].ind = index;
-   	file_descriptors[fildes_index].offset = 0;
-   	file_descriptors[fildes_index].isUsed = true;
-   	strcpy(file_descriptors[fildes_index].fileName,name);
-   	root_dir[index].isActive = true;
-   }
 	return fildes_index;
 }
 
-int fs_close(int fildes){
-	if(fildes < 0 || fildes >31) return -1;
-	if(file_descriptors[fildes].isUsed == false) return -1;
+static int do_fs_close(int fildes){
+	struct fileDescriptor *fd = get_fildes(fildes);
+	if(fd == NULL) return -1;
    
-   file_descriptors[fildes].isUsed = false;
-   int index_file = file_descriptors[fildes].ind;
-   root_dir[index_file].isActive = false;
-
+   fd->file->refs --;
+   fd->file = NULL;
+   fd->next_free = free_fildes;
+   free_fildes = fildes;
 	return 0;
 }
 
-int fs_create(char *name){
-	if(strlen(name) > FILENAME_LEN_MAX) return -1;
-
-	if(find_file_index(name) != -1) return -1;
-
-	for(int i = 0; i < FILE_NUM_MAX; i ++){
-		if(root_dir[i].isActive == false){
-			root_dir[i].file_size = 0;
-			strcpy(root_dir[i].fileName,name);
-			root_dir[i].isActive = true;
-			root_dir[i].first_data_block = END_OF_FILE;
-			printf("//======fs_create()======//\n");
-			printf("Create %s\n",root_dir[i].fileName);
-			printf("root_dir[%d].file_size = %d\n",i, root_dir[i].file_size);
-			printf("root_dir[%d].isActive = %d\n",i, root_dir[i].isActive);
-			printf("root_dir[%d].first_data_block = %d\n",i, root_dir[i].first_data_block);
-			printf("\n");
-			return 0;
-		}
-	}
-
-	return -1;
+int do_fs_create(char *name){
+	//the name must not exist yet, and every directory on its path must
+	int i = new_entry(name, (superblock->features & FS_FEATURE_COMPRESSION) ? ENTRY_COMPRESSED : 0);
+	if(i == -1) return -1;
+
+	struct rootDirectory *entry = get_dir_entry(i);
+	printf("//======fs_create()======//\n");
+	printf("Create %s\n", name);
+	printf("root_dir[%d].file_size = %d\n",i, entry->file_size);
+	printf("root_dir[%d].isActive = %d\n",i, entry->isActive);
+	printf("root_dir[%d].first_data_block = %d\n",i, entry->first_data_block);
+	printf("\n");
+	return 0;
 }
 
-int fs_delete(char *name){
+static int do_fs_delete(char *name){
+	if(mount_readonly) return -1;
 	int index_file = find_file_index(name);
 	if(index_file == -1) return -1;
-	if(root_dir[index_file].isActive == true) return -1;
+	if(open_files[index_file].refs > 0) return -1;
 
+	//data never written out needs no blocks
+	delalloc_discard(index_file);
 	
 	//remove file information
 	//free blocks which contain the file data
-	struct rootDirectory* dir = &root_dir[index_file];
+	struct rootDirectory* dir = get_dir_entry(index_file);
 	int first_data_block = dir->first_data_block;
 	while(first_data_block != END_OF_FILE){
-		int tmp = fat[first_data_block].ind_entry;
-		fat[first_data_block].ind_entry = EMPTY;
+		int tmp = get_fat_entry(first_data_block);
+		set_fat_entry(first_data_block, EMPTY);
 		first_data_block = tmp;
 	}
 	
-	memset(dir->fileName, 0, FILENAME_LEN_MAX);
-	dir->file_size = 0;
-	dir -> isActive = false;	
+	remove_entry(index_file);
 	return 0;
 }
 
 
 
-int fs_read(int fildes, void *buf, size_t nbyte){
-	if(fildes < 0 || fildes > FILE_OPEN_MAX || file_descriptors[fildes].isUsed == false || nbyte <= 0) return -1;
+static int do_fs_read(int fildes, void *buf, size_t nbyte){
+	struct fileDescriptor *fd = get_fildes(fildes);
+	if(fd == NULL || nbyte <= 0) return -1;
 	
 
 	//get all the file information to prep for file write
@@ -353,31 +773,34 @@ int fs_read(int fildes, void *buf, size_t nbyte){
   //the block location of current offset 
   
 
-	char *fileName = file_descriptors[fildes].fileName;
-	off_t offset = file_descriptors[fildes].offset;
-	int file_index = find_file_index(fileName);
-  struct rootDirectory *dir = &root_dir[file_index];
+	off_t offset = fd->offset;
+	int file_index = fd->file->ind;
+  struct rootDirectory *dir = get_dir_entry(file_index);
+  if(delalloc_flush(file_index) == -1) return -1;
   int file_size = dir->file_size;
   
   //check if nbytes can cause greater-than-EOF issue.
   //read til the EOF if it is the issue
 
   int nbytes_to_read = 0;
-  if(offset + nbyte > dir->file_size){
+  if(offset >= file_size){
+  	//another descriptor may have truncated the file under this offset
+  	nbytes_to_read = 0;
+  }else if(offset + nbyte > dir->file_size){
    	//printf("s_read(): offset + nbytes is greater than file size");
-   	nbytes_to_read += abs(file_size - offset);
+   	nbytes_to_read += file_size - offset;
   }else{
   	nbytes_to_read = nbyte;
   	//printf("fs_read(): offset + nbytes is less than/equal to file size\n");
   }
 
   int cur_fat_index = dir -> first_data_block;
-  int num_blocks = (nbytes_to_read / BLOCK_SIZE) + 1;
 
    //get current data block and current location in that data block
   int cur_block    = offset / BLOCK_SIZE;
   int cur_location = offset % BLOCK_SIZE;
-  char buf_b[BLOCK_SIZE];
+  int num_blocks   = (cur_location + nbytes_to_read + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  char *buf_b = NULL;
 
    //go to cur entry
   cur_fat_index = cur_fat_entry(cur_fat_index, cur_block);
@@ -385,7 +808,42 @@ int fs_read(int fildes, void *buf, size_t nbyte){
    //read 
   int available_nbytes = 0;
   int total_read = 0;
+
+  //inline files are read from the inline area, no data block is touched
+  if(entry_is_inline(dir)){
+  	memcpy(buf, inline_data(file_index) + offset, nbytes_to_read);
+  	total_read = nbytes_to_read;
+  	num_blocks = 0;
+  }else if(dir->flags & ENTRY_COMPRESSED){
+  	total_read = compressed_read(file_index, offset, buf, nbytes_to_read);
+  	if(total_read == -1) return -1;
+  	num_blocks = 0;
+  }else if(num_blocks > 0 && (buf_b = pool_get_block()) == NULL){
+  	return -1;
+  }
   for(int i = 0; i <num_blocks;i++){
+  	//whole blocks consecutive on disk go straight to buf, read at once (in parallel
+  	//from every image file of a striped disk)
+  	if(cur_location == 0 && nbytes_to_read >= BLOCK_SIZE){
+  		char *bufs[WRITEV_BLOCKS_MAX];
+  		int first = cur_fat_index, run = 0;
+  		while(run < WRITEV_BLOCKS_MAX && nbytes_to_read >= (run + 1) * BLOCK_SIZE &&
+  		      cur_fat_index != END_OF_FILE && cur_fat_index == first + run){
+  			bufs[run] = (char*)buf + run * BLOCK_SIZE;
+  			run ++;
+  			cur_fat_index = get_fat_entry(cur_fat_index);
+  		}
+  		if(run == 0 || data_blocks_read(first, bufs, run) == -1){
+  			pool_put_block(buf_b);
+  			return -1;
+  		}
+  		total_read += run * BLOCK_SIZE;
+  		buf += run * BLOCK_SIZE;
+  		nbytes_to_read -= run * BLOCK_SIZE;
+  		i += run - 1;
+  		continue;
+  	}
+
    	if(cur_location + nbytes_to_read > BLOCK_SIZE){
    		available_nbytes = BLOCK_SIZE - cur_location;
    	}else{
@@ -397,82 +855,101 @@ int fs_read(int fildes, void *buf, size_t nbyte){
    	//update the process with number of nbytes left to read
     
   
-  	block_read(cur_fat_index + superblock->ind_start_data_block, (void*) buf_b);
+  	if(data_block_read(cur_fat_index, buf_b) == -1){
+  		pool_put_block(buf_b);
+  		return -1;
+  	}
   	memcpy(buf, buf_b + cur_location, available_nbytes);
 
       //update total of bytes read
   		total_read += available_nbytes;
   		buf += available_nbytes;
   		cur_location = 0;
-      cur_fat_index = fat[cur_fat_index].ind_entry;
+      cur_fat_index = get_fat_entry(cur_fat_index);
       nbytes_to_read -= available_nbytes;
   }
+  pool_put_block(buf_b);
 
-  file_descriptors[file_index].offset += total_read;
+  fd->offset += total_read;
   printf("//======fs_read()======//\n");
-  printf("File name = %s\n", file_descriptors[fildes].fileName);
+  printf("File name = %.*s\n", FILENAME_LEN_MAX, dir->fileName);
   printf("The number of read bytes: %d\n",total_read);
   printf("\n");
 	return total_read;
 }
 
-int fs_write(int fildes, void *buf, size_t nbyte){
-	if(nbyte <= 0 || fildes < 0 || fildes >= 32) return -1;
-	if(num_free_entries == 0) return -1;
-  if (file_descriptors[fildes].isUsed == false) return -1;
+static int do_fs_write(int fildes, void *buf, size_t nbyte){
+	struct fileDescriptor *fd = get_fildes(fildes);
+	if(mount_readonly || nbyte <= 0 || fd == NULL) return -1;
+
+  //get the file index of the file the file descriptor is associated with
+  //and the offset of the file descriptor
+  int file_index = fd->file->ind;
+  off_t offset = fd->offset;
 
+  //appends can wait in memory until their blocks are allocated at once
+  int written = delalloc_append(file_index, offset, buf, nbyte);
+  if(written == -1) written = file_write(file_index, offset, buf, nbyte);
+  if(written > 0) fd->offset += written;
+  return written;
+}
+
+/*additional function helps to write to a file at a given offset, allocating the blocks
+  it needs. Return the number of bytes written
+*/
+int file_write(int file_index, off_t offset, char *buf, size_t nbyte){
   //get all the file information to prep for file write
-  //file name and file index of the file the file descriptor is associated with
-  //the offset of the file descriptor
   //number of data blocks that have the content of the file
   //the block location of current offset 
   //the entry index which maps to the first data block of the file;
+  struct rootDirectory *dir = get_dir_entry(file_index);
+
+  //data still waiting for its blocks goes first
+  if(delalloc_flush(file_index) == -1) return -1;
+
+  //small files stay in the inline area, and move to a data block once they outgrow it
+  if(superblock->ind_inline != 0 && dir->first_data_block == END_OF_FILE){
+  	if(offset + nbyte <= INLINE_DATA_MAX){
+  		memcpy(inline_data(file_index) + offset, buf, nbyte);
+  		mark_inline_dirty(file_index);
+  		if(offset + nbyte > dir->file_size){
+  			dir->file_size = offset + nbyte;
+  			mark_meta_dirty(superblock->ind_root_dir);
+  		}
+  		return nbyte;
+  	}
+  	if(entry_is_inline(dir) && spill_inline(file_index) == -1) return 0;
+  }
 
-  char *fileName = file_descriptors[fildes].fileName;
-  int file_index = find_file_index(fileName);
-  int offset = file_descriptors[fildes].offset; 
+  if(dir->flags & ENTRY_COMPRESSED){
+  	return compressed_write(file_index, offset, buf, nbyte);
+  }
 
-  struct rootDirectory *dir = &root_dir[file_index];
-  int cur_num_blocks_file = ((nbyte + (offset % BLOCK_SIZE)) / BLOCK_SIZE) + 1; 
+  int cur_num_blocks_file = (nbyte + (offset % BLOCK_SIZE) + BLOCK_SIZE - 1) / BLOCK_SIZE; 
   int cur_block_file = offset / BLOCK_SIZE;
   int cur_fat_index = dir -> first_data_block;
 
   //Iterate through blocks
   char *write_buf = (char*)buf;
-  char buff_helper[BLOCK_SIZE];
+  char *buff_helper = pool_get_block();
+  if(buff_helper == NULL) return -1;
   int amount_to_write = nbyte;
   int available_nbytes; //available unused space of the current block
   int total_byte_written = 0;
   int location = offset % BLOCK_SIZE;
 
-  //go to the starting block
-  cur_fat_index = cur_fat_entry(cur_fat_index, cur_block_file);
-  int available_data_blocks = 0;
-  int fat_block_indices[cur_num_blocks_file];
-
-  //locate and store indices of the free blocks
-  //to avoid overwriting other file contents
-  
-  for(int i = 0; i < superblock->num_data_blocks; i ++){
-  	if(fat[i].ind_entry == EMPTY){
-  		fat_block_indices[available_data_blocks] = i;
-  		available_data_blocks ++;
-  		//printf("fs_write(): fat_block_indices[%d] = %d\n",available_data_blocks - 1, i );
-  	}else{
-  		//printf("fs_write(): ind_entry=%d\n", fat[i].ind_entry);
-  	}
-  	if(available_data_blocks == cur_num_blocks_file){
-  		break;
-  	}
-  }
-
-  //write the disk
-  int num_free = num_free_entries();
-  if(cur_num_blocks_file > num_free){
-  	cur_num_blocks_file = num_free;
+  //go to the starting block, and remember the one before it so that the chain
+  //can be extended when the write starts at the end of the file
+  int prev_fat_index = END_OF_FILE;
+  if(cur_block_file > 0){
+  	prev_fat_index = cur_fat_entry(cur_fat_index, cur_block_file - 1);
   }
+  cur_fat_index = cur_fat_entry(cur_fat_index, cur_block_file);
 
   //iterate to write 
+  //blocks past the end of the chain are taken from the allocation groups as they are
+  //needed so that other file contents are never overwritten,
+  //the write stops early when the disk is full
 
   for(int i = 0; i < cur_num_blocks_file; i ++){
   	if(location + amount_to_write > BLOCK_SIZE){
@@ -480,9 +957,45 @@ int fs_write(int fildes, void *buf, size_t nbyte){
   	}else{
   		available_nbytes = amount_to_write;
   	}
+
+  	bool taken = cur_fat_index == END_OF_FILE;
+  	if(taken){
+  		cur_fat_index = alloc_find();
+  		if(cur_fat_index == -1) break;
+  		set_fat_entry(cur_fat_index, END_OF_FILE);
+  		if(prev_fat_index == END_OF_FILE){
+  			dir->first_data_block = cur_fat_index;
+  			mark_meta_dirty(superblock->ind_root_dir);
+  		}else{
+  			set_fat_entry(prev_fat_index, cur_fat_index);
+  		}
+  		memset(buff_helper, 0, BLOCK_SIZE);
+  	}else if(available_nbytes < BLOCK_SIZE){
+  		//keep the rest of a block that is only partly overwritten, a block past the end
+  		//of the file (reserved by fs_fallocate) was never written and reads as zeros
+  		if((off_t)(cur_block_file + i) * BLOCK_SIZE >= dir->file_size){
+  			memset(buff_helper, 0, BLOCK_SIZE);
+  		}else if(data_block_read(cur_fat_index, buff_helper) == -1){
+  			break;
+  		}
+  	}
+
   	//continue to write at the current offset
   	memcpy(buff_helper + location, write_buf, available_nbytes);
-  	block_write(cur_fat_index + superblock->ind_start_data_block, (void*)buff_helper);
+  	if(data_block_write(cur_fat_index, buff_helper) == -1){
+  		//no physical block left for it (shared with a snapshot): give back the block
+  		//taken for this step and stop, the file keeps what was written so far
+  		if(taken){
+  			set_fat_entry(cur_fat_index, EMPTY);
+  			if(prev_fat_index == END_OF_FILE){
+  				dir->first_data_block = END_OF_FILE;
+  				mark_meta_dirty(superblock->ind_root_dir);
+  			}else{
+  				set_fat_entry(prev_fat_index, END_OF_FILE);
+  			}
+  		}
+  		break;
+  	}
 
   	//update the process with total number of bytes written
   	//move the pointer of write_buf to move on to the next nbytes which are not written yet
@@ -492,90 +1005,333 @@ int fs_write(int fildes, void *buf, size_t nbyte){
   	location = 0;
   	amount_to_write -= available_nbytes;
 
-  	// update FAT entry values 
-			if(i < cur_num_blocks_file - 1){
-				fat[cur_fat_index].ind_entry = fat_block_indices[i+1];
-				cur_fat_index = fat[cur_fat_index].ind_entry;
-			}
-			else{
-				fat[cur_fat_index].ind_entry = END_OF_FILE;
-				cur_fat_index = fat[cur_fat_index].ind_entry;
-			}
+  	// move on to the next block of the chain
+  	prev_fat_index = cur_fat_index;
+  	cur_fat_index = get_fat_entry(cur_fat_index);
   	}
+  pool_put_block(buff_helper);
 
   
 
 	//update the file size and the offset 
 	if(offset + total_byte_written > dir->file_size){
 			dir->file_size = offset + total_byte_written;
+			mark_meta_dirty(superblock->ind_root_dir);
 	}
-
-	file_descriptors[fildes].offset += total_byte_written;
 	return total_byte_written;
 }
 
-int fs_get_filesize(int fildes){
-	if(fildes < 0 || fildes > FILE_OPEN_MAX || file_descriptors[fildes].isUsed == false){
-		return -1;
-	}
+static int do_fs_get_filesize(int fildes){
+	struct fileDescriptor *fd = get_fildes(fildes);
+	if(fd == NULL) return -1;
 
-	struct fileDescriptor *fd = &file_descriptors[fildes];
-	int index_file = find_file_index(fd->fileName);
-	struct rootDirectory *dir = &root_dir[index_file];
+	int index_file = fd->file->ind;
+	struct rootDirectory *dir = get_dir_entry(index_file);
   
-  if(index_file == -1) return -1;
-  int length = dir -> file_size;
+  int length = dir -> file_size + delalloc_pending(index_file);
   printf("//======fs_get_filesize======//\n");
-  printf("%s has file size = %d\n",fd->fileName, length);
+  printf("%.*s has file size = %d\n", FILENAME_LEN_MAX, dir->fileName, length);
   printf("\n");
 	return length;
 }
 
-int fs_lseek(int fildes, off_t offset){
-	if(file_descriptors[fildes].isUsed == false) return -1;
-	if(offset < 0 || offset > fs_get_filesize(fildes)) return -1;
+static int do_fs_lseek(int fildes, off_t offset){
+	if(get_fildes(fildes) == NULL) return -1;
+	if(offset < 0 || offset > do_fs_get_filesize(fildes)) return -1;
 
 	file_descriptors[fildes].offset = offset;
 	return 0;
 }
 
-int fs_truncate(int fildes, off_t length){
-	if(file_descriptors[fildes].isUsed == false) return -1;
-	if(length < 0 || length > fs_get_filesize(fildes)) return -1;
+static int do_fs_truncate(int fildes, off_t length){
+	struct fileDescriptor *fd = get_fildes(fildes);
+	if(mount_readonly || fd == NULL) return -1;
 	
-	//get file name and file index associated with the file descriptor
+	//get file index associated with the file descriptor
 	//get number of blocks which associated with the content of file
-	char *fileName = file_descriptors[fildes].fileName;
-  int file_index = find_file_index(fileName);
-   
-
-  struct rootDirectory *dir = &root_dir[file_index];
-  int total_blocks = (dir->file_size) / BLOCK_SIZE;
-  int cur_fat_index = dir -> first_data_block;
-	//printf("%s has file size = %d before being truncated\n", fileName, dir->file_size);  
-
-  //copy the content of file to a buffer
-  char* buffer = malloc(length);
-  
-  //read data of length "length" to buffer
-  fs_read(fildes,buffer,length);
-
-  //free all the FAT entries which associated with the content of file
-  // and set offset of file descriptor to 0
-  free_FAT_entries(cur_fat_index, total_blocks);
-  dir->first_data_block = END_OF_FILE;
+  int file_index = fd->file->ind;
+  if(delalloc_flush(file_index) == -1) return -1;
+  struct rootDirectory *dir = get_dir_entry(file_index);
+  if(length < 0 || length > dir->file_size) return -1;
+
+  if((dir->flags & ENTRY_COMPRESSED) && !entry_is_inline(dir)){
+  	if(compressed_truncate(file_index, length) == -1) return -1;
+  }else if(dir->first_data_block != END_OF_FILE){
+  	//the blocks up to the new end stay where they are, the others are freed.
+  	//nothing is read or copied but the last block, whose tail is cleared
+  	int keep = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  	int cur_fat_index = dir->first_data_block;
+  	if(keep == 0){
+  		dir->first_data_block = END_OF_FILE;
+  	}else{
+  		int last = cur_fat_entry(cur_fat_index, keep - 1);
+  		cur_fat_index = get_fat_entry(last);
+  		if(cur_fat_index != END_OF_FILE) set_fat_entry(last, END_OF_FILE);
+
+  		if(length % BLOCK_SIZE != 0){
+  			char *buf = pool_get_block();
+  			if(buf == NULL || data_block_read(last, buf) == -1){
+  				pool_put_block(buf);
+  				return -1;
+  			}
+  			memset(buf + length % BLOCK_SIZE, 0, BLOCK_SIZE - length % BLOCK_SIZE);
+  			int rtn = data_block_write(last, buf);
+  			pool_put_block(buf);
+  			if(rtn == -1) return -1;
+  		}
+  	}
+  	while(cur_fat_index != END_OF_FILE){
+  		cur_fat_index = free_FAT_entries(cur_fat_index, 1);
+  	}
+  }
   dir->file_size = length;
-  file_descriptors[fildes].offset = 0;
+  dir->flags &= ~ENTRY_PREALLOC;
+  mark_meta_dirty(superblock->ind_root_dir);
+  fd->offset = length;
 
   printf("//======fs_truncate======//\n)");
-  printf("%s has file size = %d after being truncated\n", fileName, dir->file_size);
+  printf("%.*s has file size = %d after being truncated\n", FILENAME_LEN_MAX, dir->fileName, dir->file_size);
   printf("\n");
-  //write the file
-  fs_write(fildes,buffer,length);
   
 	return 0;
 }
 
+static int do_fs_fallocate(int fildes, off_t offset, off_t length){
+	struct fileDescriptor *fd = get_fildes(fildes);
+	if(mount_readonly || fd == NULL || offset < 0 || length < 0) return -1;
+
+	int file_index = fd->file->ind;
+	struct rootDirectory *dir = get_dir_entry(file_index);
+	if(dir->flags & ENTRY_COMPRESSED) return -1;
+	if(offset + length > (off_t)superblock->num_data_blocks * BLOCK_SIZE) return -1;
+	if(delalloc_flush(file_index) == -1) return -1;
+	//the content of an inline file has to be in the first block first
+	if(entry_is_inline(dir) && length > 0 && spill_inline(file_index) == -1) return -1;
+
+	int blocks = 0;
+	for(int block = dir->first_data_block; block != END_OF_FILE && blocks < superblock->num_data_blocks;
+	    block = get_fat_entry(block)){
+		blocks ++;
+	}
+	int needed = (offset + length + BLOCK_SIZE - 1) / BLOCK_SIZE - blocks;
+	if(needed <= 0) return 0;
+	if(alloc_extend(dir, needed, true) == -1) return -1;
+	dir->flags |= ENTRY_PREALLOC;
+	mark_meta_dirty(superblock->ind_root_dir);
+	return 0;
+}
+
+/*additional function helps to get the directory index of the file an open file
+  descriptor refers to. Return -1 if fildes is not open
+*/
+int fildes_file_index(int fildes){
+	struct fileDescriptor *fd = get_fildes(fildes);
+	return fd != NULL ? fd->file->ind : -1;
+}
+
+/*additional function helps to check an offset given with a read or write the way
+  fs_lseek does: a write past the end of the file would leave a hole, which a chain (or
+  the inline area) cannot hold
+*/
+static bool offset_in_file(int fildes, off_t offset){
+	struct fileDescriptor *fd = get_fildes(fildes);
+	if(fd == NULL) return false;
+
+	int index = fd->file->ind;
+	return offset >= 0 && offset <= get_dir_entry(index)->file_size + delalloc_pending(index);
+}
+
+/*additional function helps to read from an open file at a given offset, the offset of
+  the file descriptor is left as it was
+*/
+int fildes_pread(int fildes, off_t offset, void *buf, size_t nbyte){
+	if(!offset_in_file(fildes, offset)) return -1;
+	off_t saved = file_descriptors[fildes].offset;
+	file_descriptors[fildes].offset = offset;
+	int rtn = do_fs_read(fildes, buf, nbyte);
+	file_descriptors[fildes].offset = saved;
+	return rtn;
+}
+
+/*additional function helps to write to an open file at a given offset, the offset of
+  the file descriptor is left as it was
+*/
+int fildes_pwrite(int fildes, off_t offset, void *buf, size_t nbyte){
+	if(!offset_in_file(fildes, offset)) return -1;
+	off_t saved = file_descriptors[fildes].offset;
+	file_descriptors[fildes].offset = offset;
+	int rtn = do_fs_write(fildes, buf, nbyte);
+	file_descriptors[fildes].offset = saved;
+	return rtn;
+}
+
+/*
+Public entry points:
+
+Each fs_* call is a thin wrapper around its do_fs_* implementation so that it can be
+recorded by the tracer (see trace.h) with its sizes, offsets, result and latency.
+Internal callers use the do_fs_* versions so that a traced fs_truncate does not show
+up as an extra read and write when the trace is replayed.
+
+Calls that change metadata end with group_commit(), which makes the changes durable
+through the journal once enough of them have been batched.
+
+Every call holds fs_lock, so work done by background threads (see defrag.c) can take
+the same lock and never sees an operation half done.
+*/
+
+int make_fs(char *disk_name){
+	return make_fs_ext(disk_name, 0);
+}
+
+int make_fs_ext(char *disk_name, int features){
+	log_stop();
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_make_fs(disk_name, features);
+	trace_record(TRACE_MAKE_FS, disk_name, -1, features, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int mount_fs(char *disk_name){
+	return mount_fs_ext(disk_name, 0);
+}
+
+int mount_fs_ext(char *disk_name, int flags){
+	log_stop();
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_mount_fs(disk_name, flags, NULL);
+	trace_record(TRACE_MOUNT_FS, disk_name, -1, flags, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int mount_snapshot(char *disk_name, char *name){
+	log_stop();
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_mount_fs(disk_name, 0, name);
+	trace_record_ext(TRACE_MOUNT_SNAPSHOT, disk_name, -1, 0, name, -1, 0, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int umount_fs(char *disk_name){
+	fs_defrag_stop();
+	log_stop();
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_umount_fs(disk_name);
+	trace_record(TRACE_UMOUNT_FS, disk_name, -1, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_open(char *name){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_fs_open(name);
+	trace_record(TRACE_OPEN, name, -1, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_close(int fildes){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_fs_close(fildes);
+	trace_record(TRACE_CLOSE, NULL, fildes, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_create(char *name){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_fs_create(name);
+	group_commit();
+	trace_record(TRACE_CREATE, name, -1, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_delete(char *name){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_fs_delete(name);
+	group_commit();
+	trace_record(TRACE_DELETE, name, -1, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_read(int fildes, void *buf, size_t nbyte){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_fs_read(fildes, buf, nbyte);
+	trace_record(TRACE_READ, NULL, fildes, nbyte, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_write(int fildes, void *buf, size_t nbyte){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_fs_write(fildes, buf, nbyte);
+	group_commit();
+	trace_record(TRACE_WRITE, NULL, fildes, nbyte, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_get_filesize(int fildes){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_fs_get_filesize(fildes);
+	trace_record(TRACE_GET_FILESIZE, NULL, fildes, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_lseek(int fildes, off_t offset){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_fs_lseek(fildes, offset);
+	trace_record(TRACE_LSEEK, NULL, fildes, offset, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_sync(){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = commit_metadata();
+	trace_record(TRACE_SYNC, NULL, -1, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_fallocate(int fildes, off_t offset, off_t length){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_fs_fallocate(fildes, offset, length);
+	group_commit();
+	trace_record_ext(TRACE_FALLOCATE, NULL, fildes, length, NULL, -1, offset, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_truncate(int fildes, off_t length){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_fs_truncate(fildes, length);
+	group_commit();
+	trace_record(TRACE_TRUNCATE, NULL, fildes, length, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
 
      
 // int main(void){
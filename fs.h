@@ -1,11 +1,14 @@
+#ifndef _FS_H_
+#define _FS_H_
+
 /** Maximum length for a file name **/
 #define FILENAME_LEN_MAX 15
 
 /** Maximum number of files in the directory **/
 #define FILE_NUM_MAX 64
 
-/** Maximum of 32 file descriptors **/
-#define FILE_OPEN_MAX 32
+/** Maximum number of file descriptors open at the same time **/
+#define FILE_OPEN_MAX 65536
 /** 
  * function make_fs
  * @disk_name
@@ -21,6 +24,57 @@
  * **/
 int make_fs(char *disk_name);
 
+/** Features **/
+/** Keep a CRC32C checksum of every data and metadata block, verified when it is read **/
+#define FS_FEATURE_CHECKSUMS 0x1
+/** Store the files in compressed chunks **/
+#define FS_FEATURE_COMPRESSION 0x2
+/** Store data blocks with the same content once **/
+#define FS_FEATURE_DEDUP 0x4
+/** Allow snapshots of the whole file system, see fs_snapshot **/
+#define FS_FEATURE_SNAPSHOTS 0x8
+/** Write data blocks to a sequential log instead of in place, see fs_log_clean **/
+#define FS_FEATURE_LOG 0x10
+
+/** 
+ * function make_fs_ext
+ * @disk_name
+ * @features
+ * 
+ * Same as make_fs, with features (FS_FEATURE_*) turning on optional parts of the file
+ * system. They are recorded in the super block and stay on for the life of the image.
+ * make_fs(disk_name) is make_fs_ext(disk_name, 0).
+ * 
+ * With FS_FEATURE_CHECKSUMS, fs_read fails with -1 instead of returning the content of a
+ * data block that no longer matches its checksum, and fs_check reports such blocks. Data
+ * overwritten in place and not yet made durable by fs_sync can be reported after a crash.
+ * 
+ * With FS_FEATURE_COMPRESSION, files are compressed in chunks of 32K with a fast LZ
+ * codec. A read or write only decompresses the chunks it touches, and a chunk that does
+ * not compress is stored as is. Files of at most 128 bytes are not compressed (see
+ * fs_write).
+ * 
+ * With FS_FEATURE_DEDUP, a data block written with the same content as a block already
+ * stored (in any file) shares that block instead of taking and writing a new one. Shared
+ * blocks are reference counted and freed when the last file using them lets go of them.
+ * 
+ * With FS_FEATURE_SNAPSHOTS, fs_snapshot can freeze the file system as it is, see there.
+ * 
+ * With FS_FEATURE_LOG, a written data block is never overwritten in place but appended to
+ * a log filling the image one segment of 64 blocks at a time, so random small writes to
+ * existing files become sequential writes of the image. A background thread cleans
+ * segments left with few live blocks by appending those to the log, see fs_log_clean.
+ * 
+ * disk_name can name up to 8 image files separated by commas ("a.img,b.img"), for
+ * example on different devices. The data region is then striped over them block by
+ * block, and the blocks written back together go to all of them in parallel. The
+ * metadata stays on the first one. The file system is mounted with the same list.
+ * 
+ * This function returns 0 on success, and -1 when the disk disk_name 
+ * could not be created, opened, or properly initilized
+ * **/
+int make_fs_ext(char *disk_name, int features);
+
 
 /** 
  * function mount_fs
@@ -37,6 +91,53 @@ int make_fs(char *disk_name);
 
 int mount_fs(char *disk_name);
 
+/** Mount flags **/
+/** Read FAT and directory blocks on first use instead of at mount time **/
+#define MOUNT_LAZY 0x1
+/** Allocate the blocks of appended data when it is written out, see mount_fs_ext **/
+#define MOUNT_DELALLOC 0x2
+/** Open the disk with O_DIRECT, bypassing the host page cache, see mount_fs_ext **/
+#define MOUNT_DIRECT 0x4
+/** Punch the blocks files let go of out of the image file, see mount_fs_ext **/
+#define MOUNT_DISCARD 0x8
+
+/** 
+ * function mount_fs_ext
+ * @disk_name
+ * @flags
+ * 
+ * Same as mount_fs, with flags (MOUNT_*) selecting how the file system is mounted.
+ * mount_fs(disk_name) is mount_fs_ext(disk_name, 0).
+ * 
+ * With MOUNT_LAZY, only the super block is read at mount time (and the journal replayed
+ * if needed). FAT and directory blocks are read into the metadata cache when an operation
+ * first needs them, so mounting takes the same time whatever the size of the image.
+ * 
+ * With MOUNT_DELALLOC, data written at the end of a file is kept in memory without taking
+ * blocks, until the file is used in another way or fs_sync, a journal commit or umount_fs
+ * writes it out. The file then gets all its new blocks in one run, so files appended in
+ * turn do not end up in interleaved blocks. fs_get_filesize counts the data kept in
+ * memory. At most 4 MB are kept, and only while the disk has room for them.
+ * 
+ * With MOUNT_DIRECT, the disk is opened with O_DIRECT, so blocks are not cached by the
+ * host a second time: the metadata cache and the write-back buffer are the only copies
+ * in memory, and streaming a large file does not evict the other pages of the process.
+ * When the host file system does not support O_DIRECT (tmpfs), the disk is opened as
+ * usual.
+ * 
+ * With MOUNT_DISCARD, the blocks freed by fs_delete, fs_truncate (and any other call
+ * that frees blocks) are punched out of the image file with fallocate once the change is
+ * committed, freed blocks next to each other in one call. The image file stays sparse,
+ * so copies and backups of it do not carry the data of deleted files. Nothing changes
+ * for the file system itself; when the host file system cannot punch holes, discarding
+ * just stops.
+ * 
+ * This function returns 0 on sucess, and -1 when the disk disk_name could
+ * not be opened or when the disk does not contain a valid file system.
+ * **/
+
+int mount_fs_ext(char *disk_name, int flags);
+
 /** 
  * function umount_fs
  * @disk_name
@@ -61,11 +162,12 @@ int umount_fs(char *disk_name);
  * 
  * The function returns a non-negative integer on success. The returned number
  *  can be used to subsequently access this file. Return -1 on failure when
- * the file with name cannot be found, or when there are already 32 file descriptors
- * active
+ * the file with name cannot be found, or when there are already FILE_OPEN_MAX file
+ * descriptors active
  * 
  * When a file is opened, the file offset (seek pointer) is set to 0 (the beginning
- * of the file)
+ * of the file). A file can be opened more than once, each file descriptor has its own
+ * offset
  * **/
 
 int fs_open(char *name);
@@ -91,12 +193,15 @@ int fs_close(int fildes);
  * This function creates a new file with name name in the root directory of your file 
  * system. The file is initially empty. The maximum length for a file name is 15 characters.
  * 
+ * name can also be a path such as "logs/2024/app" (a leading '/' is optional) to create
+ * the file in a directory made with fs_mkdir. The 15 characters then apply to each
+ * component of the path. Every other function taking a file name takes a path as well.
  * 
- * At most 64 files in the directory
+ * At most 64 files in the directory, counting the directories themselves
  * 
  * Return 0 on success, and return -1 on failure when the file with name already exists.
  * or when the file name is too long, or when there are already 64 files present in the 
- * root directory
+ * root directory, or when a directory of the path does not exist
  * **/
 
 int fs_create(char *name);
@@ -108,13 +213,99 @@ int fs_create(char *name);
  * 
  *Delete the file with name name from the root directory of your file system and frees all data 
  *blocks and meta-information that correspond to that file. The file that is being deleted must 
- *not be open.
+ *not be open by any file descriptor.
  *
  *Return 0 success, and return -1 on failure when the file is not deleted   
  * **/
 
 int fs_delete(char *name);
 
+/** 
+ * function fs_mkdir
+ * 
+ * @path
+ * 
+ * Create an empty directory at path, in the root directory or in another directory. A
+ * directory takes one of the 64 entries of the file system.
+ * 
+ * Return 0 on success, and return -1 when path already exists, a directory of the path
+ * does not exist, a name is too long or the entries are all in use
+ * **/
+int fs_mkdir(char *path);
+
+/** 
+ * function fs_rmdir
+ * 
+ * @path
+ * 
+ * Remove the directory at path.
+ * 
+ * Return 0 on success, and return -1 when path is not a directory or is not empty
+ * **/
+int fs_rmdir(char *path);
+
+/** A file or directory, see fs_stat and fs_readdir **/
+struct fs_stat{
+	char name[FILENAME_LEN_MAX + 1];   /* last component of the path, "" for the root */
+	int  size;                         /* bytes, including data not written out yet */
+	int  blocks;                       /* data blocks the file uses, 0 for inline files */
+	int  is_dir;                       /* made with fs_mkdir */
+};
+
+/** 
+ * function fs_stat
+ * 
+ * @path
+ * 
+ * @st
+ * 
+ * Get the size and block count of the file (or directory) at path without opening it.
+ * 
+ * Return 0 on success, and return -1 when path does not exist or st is NULL
+ * **/
+int fs_stat(char *path, struct fs_stat *st);
+
+/** 
+ * function fs_readdir
+ * 
+ * @path
+ * 
+ * @cursor
+ * 
+ * @entries
+ * 
+ * @max
+ * 
+ * List the directory at path (NULL or "/" for the root) in batches: up to max files and
+ * directories are put in entries, starting where *cursor points, and *cursor is moved
+ * past them. Set *cursor to 0 for the first batch. Files created or removed between
+ * batches may or may not be listed, the others are listed exactly once.
+ * 
+ * Return the number of entries filled, 0 once the whole directory was listed, and -1
+ * when path is not a directory or an argument is invalid
+ * **/
+int fs_readdir(char *path, int *cursor, struct fs_stat *entries, int max);
+
+/** Lookups of path components since mount, see fs_dcache_stats **/
+struct fs_dcache_stats{
+	long hits;            /* components found in the dentry cache */
+	long negative_hits;   /* components the cache knew did not exist */
+	long misses;          /* components looked up in the directory block */
+};
+
+/** 
+ * function fs_dcache_stats
+ * 
+ * @stats
+ * 
+ * Report how the components of the paths given to the fs_* calls were resolved. Paths
+ * are resolved through a cache of the names looked up before (including names that did
+ * not exist), so only misses scan the directory.
+ * 
+ * Return 0 on success, and return -1 when stats is NULL
+ * **/
+int fs_dcache_stats(struct fs_dcache_stats *stats);
+
 /** 
  * function fs_read
  * 
@@ -149,6 +340,9 @@ int fs_read(int fildes, void *buf, size_t nbyte);
  * 
  * The maximum file size is 16M
  * 
+ * Files of at most 128 bytes take no data block: their content is kept next to their
+ * directory entry and moves to a data block the first time the file grows past that
+ * 
  * Return number of bytes that were actually written on success, and return -1 on failure
  * **/
 
@@ -201,4 +395,419 @@ int fs_lseek(int fildes, off_t offset);
  * or the requested length is larger than the file size
  * 
  * **/
-int fs_truncate(int fildes, off_t length);
\ No newline at end of file
+int fs_truncate(int fildes, off_t length);
+
+/** 
+ * function fs_fallocate
+ * 
+ * @fildes
+ * @offset
+ * @length
+ * 
+ * Reserve the blocks for bytes offset to offset + length of the file referenced by
+ * fildes without writing anything, so that writes up to there take no block and change
+ * no metadata but the file size. The blocks the file does not have yet are taken in one
+ * run, right after its last block if they are free, in one metadata update. The file
+ * size does not change: the reserved blocks are past the end of the file until it is
+ * written there, and the parts of them that were never written read as zeros.
+ * fs_truncate gives back the blocks past the new size, reserved or not.
+ * 
+ * Return 0 on success, and return -1 on failure when the file descriptor fildes is
+ * invalid, offset or length is negative, the file is compressed, or the disk does not
+ * have that many free blocks (nothing is reserved then)
+ * 
+ * **/
+int fs_fallocate(int fildes, off_t offset, off_t length);
+
+/** 
+ * function fs_sync
+ * 
+ * Make all changes to the file system metadata (FAT, directory and superblock) so far
+ * durable. The changes are written as one transaction to the journal instead of to their
+ * home locations, which is done once the journal fills up or at umount_fs.
+ * 
+ * Without fs_sync, metadata changes are committed in groups of several operations.
+ * 
+ * Return 0 on success, and return -1 when the changes could not be written
+ * **/
+int fs_sync();
+
+/** 
+ * function fs_copy_file
+ * 
+ * @src
+ * 
+ * @dst
+ * 
+ * Create the file dst with the content of the file src. The data is copied inside the
+ * file system without going through a buffer of the caller. When the image keeps a block
+ * map (FS_FEATURE_DEDUP or FS_FEATURE_SNAPSHOTS) the copy shares the blocks of src and
+ * takes no space until either file is written (copy on write), otherwise the blocks are
+ * copied one to one.
+ * 
+ * Return 0 on success, and return -1 when src does not exist, dst cannot be created or
+ * the disk is full (dst is not created then)
+ * **/
+int fs_copy_file(char *src, char *dst);
+
+/** 
+ * function fs_copy_range
+ * 
+ * @fd_in
+ * 
+ * @off_in
+ * 
+ * @fd_out
+ * 
+ * @off_out
+ * 
+ * @len
+ * 
+ * Copy len bytes of the file open as fd_in from offset off_in to the file open as fd_out
+ * at offset off_out, growing it if needed. The offsets of the file descriptors do not
+ * change. Blocks are shared as in fs_copy_file when both offsets are multiples of the
+ * block size, the rest of the range is copied.
+ * 
+ * Return the number of bytes copied (fewer than len at the end of fd_in or when the disk
+ * is full), and return -1 when a file descriptor is invalid, an offset is past the end of
+ * its file, or the ranges overlap in the same file
+ * **/
+int fs_copy_range(int fd_in, off_t off_in, int fd_out, off_t off_out, size_t len);
+
+/** Result of fs_check, each field counts the problems of one kind **/
+struct fs_check_report{
+	int files;            /* files in the directory */
+	int bad_pointers;     /* chains linking out of the data region or into a free block */
+	int cross_linked;     /* chains running into a block of another chain, or looping */
+	int size_mismatches;  /* chains whose length does not match the file size */
+	int leaked_blocks;    /* blocks marked used in the FAT that no file owns */
+	int duplicate_names;  /* files with the name of an earlier file in the same directory */
+	int orphans;          /* files and directories in a directory that does not exist */
+	int bad_checksums;    /* blocks that do not match their checksum (FS_FEATURE_CHECKSUMS) */
+	int bad_refcounts;    /* shared blocks counted wrong (FS_FEATURE_DEDUP, FS_FEATURE_SNAPSHOTS) */
+	int repaired;         /* changes made when repairing */
+};
+
+/** 
+ * function fs_check
+ * 
+ * @repair
+ * 
+ * @num_threads
+ * 
+ * @report
+ * 
+ * Check the consistency of the mounted file system: every FAT chain is walked (in
+ * parallel on num_threads threads, at most 64, or one per CPU when num_threads is 0)
+ * to find cross-linked chains, bad links, chains that do not match the file size,
+ * blocks that are used but belong to no file, duplicate file names and entries whose
+ * directory does not exist. With FS_FEATURE_CHECKSUMS,
+ * the data blocks of every file and the metadata blocks are verified as well, and with
+ * FS_FEATURE_DEDUP or FS_FEATURE_SNAPSHOTS the reference counts of shared blocks are
+ * recounted. A snapshot mounted with mount_snapshot is checked but never repaired.
+ * 
+ * When repair is non-zero, the problems found are fixed: chains are cut before a bad
+ * link or a block owned by an earlier file, files are shrunk to their chain, unowned
+ * blocks are freed, entries without a directory moved to the root and duplicate names
+ * renamed, reference counts are set to what was
+ * counted and the checksums of metadata blocks are recomputed. Data blocks with a bad checksum are left alone. The repairs are written at
+ * umount_fs.
+ * 
+ * Return the number of problems found (0 for a clean file system), and -1 on failure
+ * **/
+int fs_check(int repair, int num_threads, struct fs_check_report *report);
+
+/** Use of the data region, see fs_space_stats **/
+struct fs_space_stats{
+	int data_blocks;      /* data blocks used by files */
+	int physical_blocks;  /* blocks of the image storing them, fewer when blocks are shared */
+	int shared_blocks;    /* physical blocks used by more than one data block */
+	int free_blocks;      /* physical blocks not in use */
+};
+
+/** 
+ * function fs_space_stats
+ * 
+ * @stats
+ * 
+ * Count the blocks used by the files of the mounted file system, and how many blocks of
+ * the image they take once shared blocks (FS_FEATURE_DEDUP) are counted once. Blocks
+ * only kept for snapshots count as physical blocks, not as data blocks.
+ * 
+ * Return 0 on success, and return -1 when stats is NULL
+ * **/
+int fs_space_stats(struct fs_space_stats *stats);
+
+/** Fragmentation of the files in the file system, see fs_frag_stats **/
+struct fs_frag_stats{
+	int    files;             /* files holding at least one data block */
+	int    blocks;            /* data blocks used by those files */
+	int    extents;           /* runs of consecutive data blocks over all files */
+	int    fragmented_files;  /* files made of more than one extent */
+	double avg_extents;       /* extents per file, 1.0 when nothing is fragmented */
+};
+
+/** 
+ * function fs_frag_stats
+ * 
+ * @stats
+ * 
+ * Measure how fragmented the files of the mounted file system are. The average number of
+ * extents per file is the metric to watch: a sequential read of a file needs one seek per
+ * extent. On file systems with a block map (dedup, snapshots, log mode) the extents are
+ * the runs of the physical blocks the file's data is in.
+ * 
+ * Return 0 on success, and return -1 when stats is NULL
+ * **/
+int fs_frag_stats(struct fs_frag_stats *stats);
+
+/** 
+ * function fs_defrag
+ * 
+ * @max_blocks
+ * 
+ * Move fragmented files to runs of consecutive free blocks, one file at a time, until at
+ * least max_blocks blocks were moved (no limit when max_blocks is 0). Files for which no
+ * long enough run of free blocks exists are left where they are.
+ * 
+ * The file system stays usable while this runs, other calls wait at most for the move of
+ * one file. Open files are not affected. File systems with a block map (dedup, snapshots,
+ * log mode) are not defragmented: their data blocks are not where the FAT says.
+ * 
+ * Return the number of blocks moved, and return -1 on failure or when the file system has
+ * a block map
+ * **/
+int fs_defrag(int max_blocks);
+
+/** 
+ * function fs_defrag_start
+ * 
+ * @blocks_per_sec
+ * 
+ * Start defragmenting in a background thread, moving at most about blocks_per_sec blocks
+ * per second. The thread stops after one pass over the directory, or at fs_defrag_stop
+ * or umount_fs.
+ * 
+ * Return 0 on success, and return -1 when a background defragmentation is already running,
+ * blocks_per_sec is not positive or the file system has a block map
+ * **/
+int fs_defrag_start(int blocks_per_sec);
+
+/** 
+ * function fs_defrag_running
+ * 
+ * Return 1 while the background defragmentation started by fs_defrag_start has files
+ * left to look at, and 0 otherwise
+ * **/
+int fs_defrag_running();
+
+/** 
+ * function fs_defrag_stop
+ * 
+ * Stop the background defragmentation and wait for the thread to finish the file it is
+ * moving.
+ * 
+ * Return 0
+ * **/
+int fs_defrag_stop();
+
+/** Write-back of data blocks, see fs_writeback_stats **/
+struct fs_writeback_stats{
+	long blocks_written;  /* data blocks written to the disk */
+	long writes;          /* write calls issued for them, fewer when runs were merged */
+	long flushes;         /* times the buffer was written out */
+	int  dirty_blocks;    /* blocks waiting in the buffer now */
+};
+
+/** 
+ * function fs_writeback_tune
+ * 
+ * @dirty_ratio
+ * 
+ * @max_age_ms
+ * 
+ * fs_write leaves data blocks in a buffer of 4 MB and returns, a background thread
+ * writes them out sorted by block number, with runs of consecutive blocks merged into one
+ * write. It starts once dirty_ratio percent of the buffer is dirty (10 by default) or a
+ * block has waited max_age_ms milliseconds (100 by default). A dirty_ratio of 0 writes
+ * every block at once. fs_sync, journal commits and umount_fs write the buffer out first.
+ * 
+ * Return 0 on success, and return -1 when dirty_ratio is not between 0 and 100 or
+ * max_age_ms is not positive
+ * **/
+int fs_writeback_tune(int dirty_ratio, int max_age_ms);
+
+/** 
+ * function fs_writeback_stats
+ * 
+ * @stats
+ * 
+ * Get the counters of the write-back of data blocks since the file system was mounted.
+ * 
+ * Return 0 on success, and return -1 when stats is NULL
+ * **/
+int fs_writeback_stats(struct fs_writeback_stats *stats);
+
+/** Asynchronous requests, see fs_aio_submit **/
+#define FS_AIO_OPEN  0   /* fs_open(name) */
+#define FS_AIO_CLOSE 1   /* fs_close(fildes) */
+#define FS_AIO_READ  2   /* fs_read(fildes, buf, nbyte), at offset unless it is -1 */
+#define FS_AIO_WRITE 3   /* fs_write(fildes, buf, nbyte), at offset unless it is -1 */
+#define FS_AIO_SYNC  4   /* fs_sync() */
+
+/** Maximum number of requests submitted and not reaped yet **/
+#define FS_AIO_DEPTH 64
+
+struct fs_aio_req{
+	int    op;          /* FS_AIO_* */
+	int    fildes;
+	char  *name;
+	void  *buf;
+	size_t nbyte;
+	off_t  offset;      /* -1: at the offset of fildes, which moves as with fs_read/fs_write */
+	void  *user_data;   /* left alone, for the caller to find the request again */
+	int    rtn;         /* what the call returned, set when the request completes */
+};
+
+/** 
+ * function fs_aio_setup
+ * 
+ * Start the background thread running asynchronous requests. The file system must be
+ * mounted while requests run, and fs_aio_teardown be called before umount_fs.
+ * 
+ * Return a file descriptor (an eventfd) that is readable while completed requests wait
+ * to be reaped, for use with poll or epoll, and return -1 on failure or when already
+ * started
+ * **/
+int fs_aio_setup();
+
+/** 
+ * function fs_aio_submit
+ * 
+ * @req
+ * 
+ * Queue a request and return without waiting for it. The request, its name and its
+ * buffer must stay valid until it is reaped. Requests run one at a time in the order
+ * they were submitted, so the requests on one file descriptor see each other's effects.
+ * A READ or WRITE with an offset other than -1 does not move the offset of fildes, and
+ * fails (rtn -1) when the offset is past the end of the file, as with fs_lseek.
+ * 
+ * Return 0 when the request is queued, and return -1 when req is invalid, fs_aio_setup
+ * was not called or FS_AIO_DEPTH requests are in flight
+ * **/
+int fs_aio_submit(struct fs_aio_req *req);
+
+/** 
+ * function fs_aio_reap
+ * 
+ * @done
+ * 
+ * @max
+ * 
+ * @wait
+ * 
+ * Take up to max completed requests, in the order they completed, with their rtn set.
+ * When wait is non-zero and requests are in flight, block until at least one completes.
+ * 
+ * Return the number of requests stored in done, and return -1 when fs_aio_setup was not
+ * called or the arguments are invalid
+ * **/
+int fs_aio_reap(struct fs_aio_req **done, int max, int wait);
+
+/** 
+ * function fs_aio_teardown
+ * 
+ * Run the requests still queued, stop the background thread and close the eventfd.
+ * Completed requests not reaped are dropped.
+ * 
+ * Return 0 on success, and return -1 when fs_aio_setup was not called
+ * **/
+int fs_aio_teardown();
+
+/** Maximum length of a snapshot name, and number of snapshots of an image **/
+#define SNAPSHOT_NAME_MAX 15
+#define SNAPSHOT_NUM_MAX 16
+
+/** 
+ * function fs_snapshot
+ * 
+ * @name
+ * 
+ * Take a snapshot of the mounted file system (made with FS_FEATURE_SNAPSHOTS) under the
+ * given name. The FAT, directory and block map are copied, which takes the same time
+ * whatever the size of the files: data blocks are not copied but shared with the
+ * snapshot, and a shared block is copied the first time it is written afterwards (copy
+ * on write). The snapshot is written to the disk before this returns.
+ * 
+ * Return 0 on success, and return -1 when the file system has no snapshots, the name is
+ * too long or taken, SNAPSHOT_NUM_MAX snapshots exist already or the file system is
+ * mounted read-only
+ * **/
+int fs_snapshot(char *name);
+
+/** 
+ * function fs_snapshot_delete
+ * 
+ * @name
+ * 
+ * Delete a snapshot of the mounted file system, freeing the blocks only the snapshot was
+ * still using. The snapshot must not be mounted by mount_snapshot at the time.
+ * 
+ * Return 0 on success, and return -1 when there is no snapshot with that name or the
+ * file system is mounted read-only
+ * **/
+int fs_snapshot_delete(char *name);
+
+/** 
+ * function mount_snapshot
+ * 
+ * @disk_name
+ * 
+ * @name
+ * 
+ * Mount the snapshot name of the file system on disk_name read-only, for instance to back
+ * it up. This works while the file system itself is mounted and written by another
+ * process. Files are opened, read and closed as usual, every call that would change the
+ * file system fails with -1. Unmount with umount_fs.
+ * 
+ * This function returns 0 on sucess, and -1 when the disk disk_name could not be opened
+ * or has no snapshot with that name
+ * **/
+int mount_snapshot(char *disk_name, char *name);
+
+/** Log of a file system made with FS_FEATURE_LOG, see fs_log_stats **/
+struct fs_log_stats{
+	int  segments;          /* segments of 64 blocks the data region is cut into */
+	int  clean_segments;    /* segments without a block in use, ready for the log */
+	long segments_cleaned;  /* segments the cleaner emptied since mount */
+	long blocks_moved;      /* live blocks it appended to the log to do so */
+};
+
+/** 
+ * function fs_log_clean
+ * 
+ * @max_segments
+ * 
+ * Clean at most max_segments segments of the log (all that can be when max_segments is
+ * 0 or less), fewest live blocks first: their live blocks are appended to the log and the
+ * segments are free for it again. The background cleaner does the same whenever only a
+ * few segments are clean. Segments holding blocks a snapshot still uses are not cleaned.
+ * 
+ * Return the number of segments cleaned, and return -1 when the file system was not made
+ * with FS_FEATURE_LOG, is mounted read-only, or a block could not be moved
+ * **/
+int fs_log_clean(int max_segments);
+
+/** 
+ * function fs_log_stats
+ * 
+ * @stats
+ * 
+ * Report the state of the log of the mounted file system.
+ * 
+ * Return 0 on success, and return -1 when stats is NULL or the file system was not made
+ * with FS_FEATURE_LOG
+ * **/
+int fs_log_stats(struct fs_log_stats *stats);
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef _FS_INTERNAL_H_
+#define _FS_INTERNAL_H_
+
+/*
+On-disk structures and helpers shared by the parts of the file system that live outside
+fs.c (consistency checker, defragmenter, ...). Applications only need fs.h.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "disk.h"
+#include "fs.h"
+
+#define EMPTY 0
+#define END_OF_FILE -1
+
+/* blocks in front of the journal that can hold metadata (images made before the
+   dedup regions existed have their journal at block 16) */
+#define META_BLOCKS_MAX 64
+
+/* largest file kept in the inline area instead of data blocks */
+#define INLINE_DATA_MAX 128
+#define INLINE_BLOCKS   (FILE_NUM_MAX * INLINE_DATA_MAX / BLOCK_SIZE)
+
+/* blocks of the checksum region, one CRC32C per data block */
+#define CHECKSUM_BLOCKS 4
+#define CHECKSUMS_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t))
+
+/* regions of FS_FEATURE_DEDUP: block map and reference counts (one int per data
+   block) and content hashes (one 64-bit hash per physical block). FS_FEATURE_SNAPSHOTS
+   uses the block map and reference counts too */
+#define BLOCK_MAP_BLOCKS  4
+#define REFCOUNT_BLOCKS   4
+#define BLOCK_HASH_BLOCKS 8
+
+/* bytes compressed together in a file with FS_FEATURE_COMPRESSION */
+#define CHUNK_BLOCKS 8
+#define CHUNK_SIZE   (CHUNK_BLOCKS * BLOCK_SIZE)
+
+/* blocks of one snapshot: copies of the FAT, directory, inline area and block map */
+#define SNAPSHOT_BLOCKS (4 + 1 + INLINE_BLOCKS + BLOCK_MAP_BLOCKS)
+
+/*
+super_block:
+This is the first block of the disk and it contains informataion about the location of the other
+data structures (FAT, root directory, and the start of the data blocks).
+
+ind_root_dir         - index of root directory
+ind_start_data_block - index of the first data block
+ind_FAT              - index of FAT
+num_FAT_blocks       - total number of FAT blocks
+num_data_blocks      - total number of data blocks 
+ind_journal          - index of the first block of the metadata journal (0 if none)
+num_journal_blocks   - total number of journal blocks
+ind_inline           - index of the inline area (0 if none), one INLINE_DATA_MAX slot per
+                       directory entry
+features             - optional features chosen at make_fs_ext (FS_FEATURE_*)
+ind_checksum         - index of the checksum region, with FS_FEATURE_CHECKSUMS
+meta_checksum        - CRC32C of each metadata block as last committed, with
+                       FS_FEATURE_CHECKSUMS (the super block itself has none)
+ind_block_map        - index of the block map, with FS_FEATURE_DEDUP or FS_FEATURE_SNAPSHOTS
+ind_refcount         - index of the reference counts, with FS_FEATURE_DEDUP or FS_FEATURE_SNAPSHOTS
+ind_block_hash       - index of the content hashes, with FS_FEATURE_DEDUP
+ind_snapshots        - index of the snapshot table, with FS_FEATURE_SNAPSHOTS
+ind_snapshot_area    - index of the blocks holding the snapshots, SNAPSHOT_BLOCKS each
+num_disks            - number of image files the disk is striped over (0 for older images,
+                       which have one)
+*/
+struct super_block{
+	int ind_root_dir;
+	int ind_start_data_block;
+	int ind_FAT;
+	int num_FAT_blocks;
+	int num_data_blocks;
+	int ind_journal;
+	int num_journal_blocks;
+	int ind_inline;
+	int features;
+	int ind_checksum;
+	uint32_t meta_checksum[META_BLOCKS_MAX];
+	int ind_block_map;
+	int ind_refcount;
+	int ind_block_hash;
+	int ind_snapshots;
+	int ind_snapshot_area;
+	int num_disks;
+};
+
+
+/*
+File allocation table (FAT):
+
+This is the block after superblock. FAT can take more than one block on the disk depends on the number
+of data blocks. It is used to keep track of empty blocks and the mapping between files and their data blocks.
+
+It presents an array of structs containing entry
+ind_entry            
+
+*/
+
+struct FAT{
+	int ind_entry;
+};
+
+#define FAT_ENTRIES_PER_BLOCK (BLOCK_SIZE / sizeof(struct FAT))
+
+/*
+rootDirectory:
+
+The block next to FAT block/blocks locates root directory.
+It represents an array of structs which define, for each file, the file size and the head of the list of corresponding
+data blocks.
+
+fileName           - the name of the file
+file_size          - the size of the file
+first_data_block   - the location of the first data block for this file
+isActive           - the entry holds a file, whether it is open or not
+flags              - ENTRY_* bits (kept in what used to be padding, so 0 on older images)
+parent             - the directory the entry is in, its index + 1 or 0 for the root (also
+                     padding before, so older images only have the root), see dir.c
+
+A file of at most INLINE_DATA_MAX bytes has no data blocks (first_data_block is END_OF_FILE)
+and its content is kept in the slot of its entry in the inline area, see entry_is_inline.
+A larger file with ENTRY_COMPRESSED is stored in compressed chunks, see compress.c.
+
+*/
+struct rootDirectory{
+	char fileName[FILENAME_LEN_MAX];
+	int file_size;
+	int first_data_block;
+	bool isActive;	
+	unsigned char flags;
+	unsigned short parent;
+};
+
+#define ENTRY_COMPRESSED 0x1   /* created with FS_FEATURE_COMPRESSION */
+#define ENTRY_DIRECTORY  0x2   /* a directory, created with fs_mkdir */
+#define ENTRY_PREALLOC   0x4   /* the chain may go past the size, see fs_fallocate */
+
+extern struct super_block *superblock;
+extern pthread_mutex_t     fs_lock;
+extern bool                mount_readonly;   /* mounted by mount_snapshot */
+
+/*metadata access, see fs.c*/
+char *meta_block_buf(int block);
+void mark_meta_dirty(int block);
+struct rootDirectory *get_dir_entry(int index);
+bool entry_in_use(struct rootDirectory *entry);
+bool entry_is_inline(struct rootDirectory *entry);
+char *inline_data(int index);
+int  get_fat_entry(int fat_index);
+void set_fat_entry(int fat_index, int value);
+int  commit_metadata();
+int  checkpoint_metadata();
+int  group_commit();
+
+/*files, see fs.c. These take no lock and are not traced*/
+int  find_file_index(char *name);
+int  cur_fat_entry(int fat_index, int iteration);
+int  do_fs_create(char *name);
+int  file_write(int file_index, off_t offset, char *buf, size_t nbyte);
+int  num_free_entries();
+int  fildes_file_index(int fildes);
+int  fildes_pread(int fildes, off_t offset, void *buf, size_t nbyte);
+int  fildes_pwrite(int fildes, off_t offset, void *buf, size_t nbyte);
+
+/*data block access, block is the index of a data block (its FAT entry). With a block
+  map it is stored in the physical block the map gives, otherwise in the physical block
+  of the same index*/
+int  data_block_read(int block, char *buf);
+int  data_blocks_read(int block, char **bufs, int count);
+int  data_block_write(int block, char *buf);
+int  physical_block_read(int phys, char *buf);
+int  physical_blocks_read(int phys, char **bufs, int count);
+int  physical_block_write(int phys, char *buf);
+int  load_metadata();
+extern int meta_bad_checksums;
+
+/*block sharing, see dedup.c*/
+int  dedup_map(int block);
+int  dedup_write(int block, char *buf);
+void dedup_release(int block);
+void dedup_reset();
+int  dedup_check(int repair);
+void block_get(int phys);
+void block_put(int phys);
+void dedup_share(int block, int from);
+int  block_refcount(int phys);
+int  block_move(int phys);
+
+/*log-structured writes, see log.c. log_stop has to be called without fs_lock*/
+int  log_alloc();
+void log_reset();
+int  log_start();
+void log_stop();
+
+/*write-back of data blocks, block is a block of the disk, see writeback.c*/
+int  wb_start();
+int  wb_stop();
+int  wb_flush();
+int  wb_write(int block, char *buf);
+int  wb_read(int block, char *buf);
+int  wb_readv(int block, char **bufs, int count);
+
+/*allocation groups, block is a data block, see alloc.c. alloc_find does not take the
+  block it returns, set_fat_entry does*/
+int  alloc_find();
+int  alloc_free_blocks();
+int  alloc_extend(struct rootDirectory *dir, int count, bool scatter);
+void alloc_update(int block, bool freed);
+void alloc_reset();
+
+/*memory pool, see pool.c. pool_get_block returns NULL when every buffer is in use*/
+char *pool_meta_block(int block);
+char *pool_get_block();
+void  pool_put_block(char *buf);
+
+/*directories, see dir.c. lookup_path gives the directory (index + 1, 0 for the root) and
+  the last component of path, name is NULL when no entry can be created at path*/
+int  lookup_path(char *path, int *parent, char **name, int *len);
+int  new_entry(char *path, unsigned char flags);
+void remove_entry(int index);
+int  entry_path(int index, char *path, size_t size);
+void dcache_reset(bool mount);
+
+/*delayed allocation, index is a directory entry, see delalloc.c*/
+int  delalloc_append(int index, off_t offset, char *buf, size_t nbyte);
+int  delalloc_pending(int index);
+int  delalloc_flush(int index);
+int  delalloc_flush_all();
+void delalloc_discard(int index);
+void delalloc_reset(bool enabled);
+
+/*punching freed blocks out of the image, phys is a physical data block, see discard.c*/
+void discard_mark(int phys);
+void discard_flush();
+void discard_reset(bool enabled);
+
+/*snapshots, see snapshot.c*/
+int  snapshot_open(char *name);
+void snapshot_close();
+int  snapshot_source(int block, uint32_t *checksum);
+int  snapshot_count_refs(int *counts);
+
+/*compressed files, see compress.c*/
+int  compressed_read(int index, off_t offset, char *buf, int nbyte);
+int  compressed_write(int index, off_t offset, char *buf, int nbyte);
+int  compressed_truncate(int index, off_t length);
+int  compressed_chain_length(struct rootDirectory *entry);
+int  expected_chain_length(struct rootDirectory *entry);
+int  chain_data_blocks(struct rootDirectory *entry);
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ *
+ * fsck.c: checks (and with -r repairs) the file system on a disk image.
+ *
+ * usage: fsck [-r] [-j threads] <disk>
+ *
+ * The exit status is 0 when the file system is clean (or was repaired), 1 when
+ * problems were found and left alone, and 2 when the image could not be checked.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#include "fs.h"
+#include "trace.h"
+
+static void usage(char *prog){
+  fprintf(stderr, "usage: %s [-r] [-j threads] <disk>\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv){
+  int repair = 0, threads = 0, opt;
+  struct fs_check_report report;
+
+  while((opt = getopt(argc, argv, "rj:")) != -1){
+    switch(opt){
+    case 'r': repair = 1;              break;
+    case 'j': threads = atoi(optarg);  break;
+    default:  usage(argv[0]);
+    }
+  }
+  if(argc - optind != 1) usage(argv[0]);
+  char *disk = argv[optind];
+
+  //keep the messages printed by mount and umount out of the report
+  int saved_stdout = dup(STDOUT_FILENO);
+  int devnull = open("/dev/null", O_WRONLY);
+  dup2(devnull, STDOUT_FILENO);
+  close(devnull);
+
+  if(mount_fs(disk) == -1){
+    dup2(saved_stdout, STDOUT_FILENO);
+    fprintf(stderr, "fsck: cannot mount %s\n", disk);
+    return 2;
+  }
+
+  uint64_t start = trace_now();
+  int problems = fs_check(repair, threads, &report);
+  uint64_t elapsed = trace_now() - start;
+
+  umount_fs(disk);
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+
+  if(problems == -1){
+    fprintf(stderr, "fsck: cannot check %s\n", disk);
+    return 2;
+  }
+
+  printf("%s: %d files, checked in %.3f ms\n", disk, report.files, elapsed / 1000000.0);
+  printf("  bad pointers     %d\n", report.bad_pointers);
+  printf("  cross-linked     %d\n", report.cross_linked);
+  printf("  size mismatches  %d\n", report.size_mismatches);
+  printf("  leaked blocks    %d\n", report.leaked_blocks);
+  printf("  duplicate names  %d\n", report.duplicate_names);
+  printf("  orphans          %d\n", report.orphans);
+  printf("  bad checksums    %d\n", report.bad_checksums);
+  printf("  bad refcounts    %d\n", report.bad_refcounts);
+  if(repair) printf("  repairs made     %d\n", report.repaired);
+
+  return (problems == 0 || repair) ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+/**
+ *
+ * fsdefrag.c: defragments the file system on a disk image and reports how
+ * fragmented it was before and after, and the sequential read throughput of
+ * all its files.
+ *
+ * usage: fsdefrag [-n] [-r blocks_per_sec] <disk>
+ *
+ *   -n  only report, do not move anything
+ *   -r  run in the background thread at this rate instead of all at once
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#include "fs.h"
+#include "fs_internal.h"
+#include "trace.h"
+
+static int saved_stdout;
+
+static void usage(char *prog){
+  fprintf(stderr, "usage: %s [-n] [-r blocks_per_sec] <disk>\n", prog);
+  exit(1);
+}
+
+/* the file system prints on most calls, only let the report through */
+static void quiet(int on){
+  fflush(stdout);
+  if(on){
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+  }else{
+    dup2(saved_stdout, STDOUT_FILENO);
+  }
+}
+
+/* read every file from start to end, return MB/s */
+static double read_throughput(){
+  static char buf[16 * 1024 * 1024];
+  long bytes = 0;
+
+  uint64_t start = trace_now();
+  for(int i = 0; i < FILE_NUM_MAX; i ++){
+    struct rootDirectory *entry = get_dir_entry(i);
+    if(!entry_in_use(entry) || (entry->flags & ENTRY_DIRECTORY)) continue;
+
+    char name[256];
+    if(entry_path(i, name, sizeof(name)) == -1) continue;
+    int fd = fs_open(name);
+    if(fd < 0) continue;
+    int n = fs_read(fd, buf, sizeof(buf));
+    if(n > 0) bytes += n;
+    fs_close(fd);
+  }
+  uint64_t elapsed = trace_now() - start;
+
+  return elapsed ? bytes / (elapsed / 1e9) / (1024 * 1024) : 0;
+}
+
+static void report(char *when, struct fs_frag_stats *stats, double throughput){
+  printf("%-7s %d files, %d blocks, %d extents, %d fragmented, %.2f extents/file, %.1f MB/s\n",
+         when, stats->files, stats->blocks, stats->extents, stats->fragmented_files,
+         stats->avg_extents, throughput);
+}
+
+int main(int argc, char **argv){
+  int dry_run = 0, rate = 0, opt;
+  struct fs_frag_stats stats;
+
+  while((opt = getopt(argc, argv, "nr:")) != -1){
+    switch(opt){
+    case 'n': dry_run = 1;          break;
+    case 'r': rate = atoi(optarg);  break;
+    default:  usage(argv[0]);
+    }
+  }
+  if(argc - optind != 1) usage(argv[0]);
+  char *disk = argv[optind];
+
+  saved_stdout = dup(STDOUT_FILENO);
+  quiet(1);
+  if(mount_fs(disk) == -1){
+    quiet(0);
+    fprintf(stderr, "fsdefrag: cannot mount %s\n", disk);
+    return 1;
+  }
+
+  fs_frag_stats(&stats);
+  double throughput = read_throughput();
+  quiet(0);
+  report("before", &stats, throughput);
+  if(dry_run){
+    quiet(1);
+    umount_fs(disk);
+    return 0;
+  }
+
+  quiet(1);
+  uint64_t start = trace_now();
+  int moved = 0;
+  if(rate > 0){
+    if(fs_defrag_start(rate) == 0){
+      while(fs_defrag_running()) usleep(10000);
+      fs_defrag_stop();
+    }else{
+      moved = -1;
+    }
+  }else{
+    moved = fs_defrag(0);
+  }
+  if(moved == -1){
+    umount_fs(disk);
+    quiet(0);
+    fprintf(stderr, "fsdefrag: cannot defragment %s (read-only or it has a block map)\n", disk);
+    return 1;
+  }
+  uint64_t elapsed = trace_now() - start;
+
+  fs_frag_stats(&stats);
+  throughput = read_throughput();
+  quiet(0);
+  report("after", &stats, throughput);
+  if(rate == 0) printf("moved %d blocks in %.3f ms\n", moved, elapsed / 1e6);
+  else printf("background pass took %.3f ms\n", elapsed / 1e6);
+
+  quiet(1);
+  umount_fs(disk);
+  return 0;
+}
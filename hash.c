@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "hash.h"
+
+/*
+Block hash:
+
+Used to find data blocks with the same content, so it has to be fast on 4 KB blocks and
+spread its values well, but does not need to resist attacks (equal hashes are always
+confirmed by comparing the blocks).
+
+The buffer is read in 16-byte stripes into two 64-bit accumulators, as in XXH3: each
+stripe is mixed with a secret, its 32-bit halves are multiplied together into 64 bits and
+added to the accumulator with the other lane. With SSE2 one stripe is one xor, one
+shuffle and one 32x32->64 multiply per pair of lanes. The portable code computes the
+same values one lane at a time. The tail that does not fill a stripe and the length are
+mixed in at the end.
+*/
+
+#define PRIME64_1 0x9e3779b185ebca87ULL
+#define PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3 0x165667b19e3779f9ULL
+
+/* secret mixed into the stripes, one 16-byte key per stripe of a 64-byte round */
+static const uint64_t secret[8] = {
+	0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+	0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL
+};
+
+static uint64_t mix(uint64_t h){
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+/*additional function helps to fold the accumulators, the tail and the length together*/
+static uint64_t finish(uint64_t acc0, uint64_t acc1, const unsigned char *tail, size_t tail_len, size_t len){
+	uint64_t h = len * PRIME64_1 ^ mix(acc0) ^ (mix(acc1) * PRIME64_2);
+	for(size_t i = 0; i < tail_len; i ++){
+		h = (h ^ tail[i]) * PRIME64_1;
+		h ^= h >> 31;
+	}
+	return mix(h);
+}
+
+uint64_t block_hash_sw(const void *buf, size_t len){
+	const unsigned char *p = buf;
+	uint64_t acc[2] = { PRIME64_1, PRIME64_2 };
+	size_t stripes = len / 16;
+
+	for(size_t s = 0; s < stripes; s ++){
+		uint64_t data[2];
+		memcpy(data, p + s * 16, 16);
+		const uint64_t *key = &secret[(s % 4) * 2];
+		for(int lane = 0; lane < 2; lane ++){
+			uint64_t keyed = data[lane] ^ key[lane];
+			acc[lane ^ 1] += data[lane];
+			acc[lane] += (keyed & 0xffffffff) * (keyed >> 32);
+		}
+	}
+	return finish(acc[0], acc[1], p + stripes * 16, len % 16, len);
+}
+
+#if defined(__SSE2__)
+uint64_t block_hash(const void *buf, size_t len){
+	const unsigned char *p = buf;
+	__m128i acc = _mm_set_epi64x(PRIME64_2, PRIME64_1);
+	size_t stripes = len / 16;
+
+	for(size_t s = 0; s < stripes; s ++){
+		__m128i data  = _mm_loadu_si128((const __m128i*)(p + s * 16));
+		__m128i key   = _mm_loadu_si128((const __m128i*)&secret[(s % 4) * 2]);
+		__m128i keyed = _mm_xor_si128(data, key);
+		//high 32 bits of each lane next to its low 32 bits
+		__m128i high  = _mm_shuffle_epi32(keyed, _MM_SHUFFLE(3, 3, 1, 1));
+		__m128i swap  = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+		acc = _mm_add_epi64(acc, _mm_mul_epu32(keyed, high));
+		acc = _mm_add_epi64(acc, swap);
+	}
+
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	return finish(lanes[0], lanes[1], p + stripes * 16, len % 16, len);
+}
+#else
+uint64_t block_hash(const void *buf, size_t len){
+	return block_hash_sw(buf, len);
+}
+#endif
@@ -0,0 +1,15 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/******************************************************************************/
+uint64_t block_hash(const void *buf, size_t len);
+                               /* 64-bit hash of buf (not cryptographic),     */
+                               /* SSE2 when the CPU has it                    */
+uint64_t block_hash_sw(const void *buf, size_t len);
+                               /* same value, always with the portable code   */
+/******************************************************************************/
+
+#endif
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "disk.h"
+#include "journal.h"
+
+#define JOURNAL_MAGIC 0x4a524e4c  /* "JRNL" header of the log region */
+#define DESC_MAGIC    0x44455343  /* "DESC" first block of a transaction */
+#define COMMIT_MAGIC  0x434d4954  /* "CMIT" last block of a transaction */
+
+/*
+Journal layout:
+
+The log is a region of num blocks starting at block start. Its first block is the
+journal_header, the rest holds transactions written one after the other:
+
+  descriptor block | copies of the metadata blocks | commit block
+
+The descriptor lists the home location of each logged block. The commit block holds a
+checksum over the descriptor and the logged blocks, so a transaction torn by a crash
+is recognized and ignored. All the blocks of a transaction are written and synced
+together, which is what makes the metadata update durable (group commit).
+
+A checkpoint only bumps the sequence number in the header: transactions left in the log
+carry an older sequence number and are not replayed again.
+*/
+struct journal_header{
+	uint32_t magic;
+	uint32_t sequence;
+};
+
+struct journal_descriptor{
+	uint32_t magic;
+	uint32_t sequence;
+	int      count;
+	int      home[];
+};
+
+struct journal_commit{
+	uint32_t magic;
+	uint32_t sequence;
+	uint32_t checksum;
+};
+
+#define DESC_MAX ((BLOCK_SIZE - sizeof(struct journal_descriptor)) / sizeof(int))
+
+static int      journal_start = 0;   /* block of the journal header, 0 when no log */
+static int      journal_end;         /* first block after the log region           */
+static int      journal_tail;        /* where the next transaction goes            */
+static uint32_t journal_sequence;    /* sequence number of the next transaction    */
+
+/*additional function helps to checksum logged blocks (FNV-1a)*/
+static uint32_t checksum_update(uint32_t hash, char *buf, int len){
+	for(int i = 0; i < len; i ++){
+		hash ^= (unsigned char)buf[i];
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+static int write_header(){
+	char buf[BLOCK_SIZE];
+	struct journal_header *header = (struct journal_header*)buf;
+
+	memset(buf, 0, BLOCK_SIZE);
+	header->magic    = JOURNAL_MAGIC;
+	header->sequence = journal_sequence;
+	return block_write(journal_start, buf);
+}
+
+int journal_format(int start, int nblocks){
+	if(start <= 0 || nblocks < 3) return -1;
+
+	journal_start    = start;
+	journal_end      = start + nblocks;
+	journal_tail     = start + 1;
+	journal_sequence = 1;
+	return write_header();
+}
+
+int journal_open(int start, int nblocks){
+	char buf[BLOCK_SIZE];
+	struct journal_header *header = (struct journal_header*)buf;
+
+	//images made before the journal existed have no log region
+	if(start <= 0 || nblocks < 3){
+		journal_start = 0;
+		return 0;
+	}
+
+	if(block_read(start, buf) == -1) return -1;
+	if(header->magic != JOURNAL_MAGIC) return journal_format(start, nblocks);
+
+	journal_start    = start;
+	journal_end      = start + nblocks;
+	journal_tail     = start + 1;
+	journal_sequence = header->sequence;
+	return 0;
+}
+
+/*additional function helps to check that the transaction at pos is complete. Return
+  the number of logged blocks, or -1 if the log ends there
+*/
+static int validate_transaction(int pos, uint32_t sequence){
+	char buf[BLOCK_SIZE];
+	struct journal_descriptor *desc = (struct journal_descriptor*)buf;
+	struct journal_commit *commit = (struct journal_commit*)buf;
+
+	if(block_read(pos, buf) == -1) return -1;
+	if(desc->magic != DESC_MAGIC || desc->sequence != sequence) return -1;
+	int count = desc->count;
+	if(count < 0 || count > DESC_MAX || pos + count + 2 > journal_end) return -1;
+
+	uint32_t checksum = checksum_update(2166136261u, buf, BLOCK_SIZE);
+	for(int i = 0; i < count; i ++){
+		if(block_read(pos + 1 + i, buf) == -1) return -1;
+		checksum = checksum_update(checksum, buf, BLOCK_SIZE);
+	}
+
+	if(block_read(pos + count + 1, buf) == -1) return -1;
+	if(commit->magic != COMMIT_MAGIC || commit->sequence != sequence) return -1;
+	if(commit->checksum != checksum) return -1;
+	return count;
+}
+
+int journal_recover(){
+	char buf[BLOCK_SIZE];
+	char desc_buf[BLOCK_SIZE];
+	struct journal_descriptor *desc = (struct journal_descriptor*)desc_buf;
+	int replayed = 0;
+
+	if(journal_start == 0) return 0;
+
+	int pos = journal_start + 1;
+	int count;
+	while((count = validate_transaction(pos, journal_sequence + replayed)) != -1){
+		//copy the logged blocks back to their home locations
+		block_read(pos, desc_buf);
+		for(int i = 0; i < count; i ++){
+			block_read(pos + 1 + i, buf);
+			if(block_write(desc->home[i], buf) == -1) return -1;
+		}
+		pos += count + 2;
+		replayed ++;
+	}
+
+	if(replayed > 0){
+		journal_tail = pos;
+		journal_sequence += replayed;
+		if(sync_disk() == -1) return -1;
+		if(journal_checkpoint() == -1) return -1;
+	}
+	return replayed;
+}
+
+int journal_space(){
+	if(journal_start == 0) return 0;
+	return journal_end - journal_tail;
+}
+
+int journal_commit(int *blocks, char **bufs, int count){
+	char buf[BLOCK_SIZE];
+	struct journal_descriptor *desc = (struct journal_descriptor*)buf;
+	struct journal_commit *commit = (struct journal_commit*)buf;
+
+	if(journal_start == 0 || count <= 0 || count > DESC_MAX) return -1;
+	if(count + 2 > journal_space()) return -1;
+
+	memset(buf, 0, BLOCK_SIZE);
+	desc->magic    = DESC_MAGIC;
+	desc->sequence = journal_sequence;
+	desc->count    = count;
+	memcpy(desc->home, blocks, count * sizeof(int));
+	uint32_t checksum = checksum_update(2166136261u, buf, BLOCK_SIZE);
+	if(block_write(journal_tail, buf) == -1) return -1;
+
+	for(int i = 0; i < count; i ++){
+		checksum = checksum_update(checksum, bufs[i], BLOCK_SIZE);
+		if(block_write(journal_tail + 1 + i, bufs[i]) == -1) return -1;
+	}
+
+	memset(buf, 0, BLOCK_SIZE);
+	commit->magic    = COMMIT_MAGIC;
+	commit->sequence = journal_sequence;
+	commit->checksum = checksum;
+	if(block_write(journal_tail + count + 1, buf) == -1) return -1;
+	if(sync_disk() == -1) return -1;
+
+	journal_tail += count + 2;
+	journal_sequence ++;
+	return 0;
+}
+
+int journal_checkpoint(){
+	//nothing was logged since the last checkpoint
+	if(journal_start == 0 || journal_tail == journal_start + 1) return 0;
+
+	journal_tail = journal_start + 1;
+	if(write_header() == -1) return -1;
+	return sync_disk();
+}
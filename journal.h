@@ -0,0 +1,22 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+/******************************************************************************/
+#define JOURNAL_BLOCKS  64     /* size of the log region made by make_fs      */
+
+/******************************************************************************/
+int journal_format(int start, int nblocks);
+                               /* write an empty log to a region of the disk  */
+int journal_open(int start, int nblocks);
+                               /* attach to the log region of a mounted disk  */
+int journal_recover();         /* write committed transactions to their home
+                                  blocks, returns the number replayed         */
+int journal_space();           /* number of blocks left in the log            */
+int journal_commit(int *blocks, char **bufs, int count);
+                               /* append one transaction with the given
+                                  metadata blocks and make it durable         */
+int journal_checkpoint();      /* forget the logged transactions once their
+                                  blocks have been written home               */
+/******************************************************************************/
+
+#endif
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fs_internal.h"
+
+/*
+Log-structured writes:
+
+With FS_FEATURE_LOG the data region is used as a log. The image has a block map (see
+dedup.c) and a data block is never written in place: every write goes to the next free
+physical block of the log and the block map is pointed there, freeing the block it had
+before. The physical blocks are cut into segments of LOG_SEGMENT_BLOCKS, and the log
+fills one segment at a time from the first to the last block, then goes on with the next
+clean segment (one without any block in use). Random small writes to existing files so
+become sequential writes of the image, which the write-back buffer hands to the disk in
+long runs.
+
+Overwrites leave segments with a few live blocks between freed ones. The cleaner takes
+the segment with the fewest live blocks, appends them to the log (the block map entries
+follow them) and so makes the segment clean again, committing each cleaned segment. A
+background thread does this whenever fewer than LOG_CLEAN_LOW segments are clean, until
+LOG_CLEAN_HIGH are, one segment at a time under fs_lock; fs_log_clean does it on demand.
+A segment holding a block a snapshot still uses is left alone, since the snapshot keeps
+its own copy of the block map. When no segment is clean the log fills the free blocks of
+the others until the cleaner catches up, so a write never fails for lack of a clean
+segment.
+*/
+
+#define LOG_SEGMENT_BLOCKS 64
+#define LOG_CLEAN_LOW      4
+#define LOG_CLEAN_HIGH     8
+
+static int head;                  /* next physical block of the log, 0 before the first write */
+static int cleaning = -1;         /* segment being cleaned, the log does not write to it */
+static int map_refs[DISK_BLOCKS]; /* physical block -> block map entries pointing to it */
+static struct fs_log_stats stats;
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  log_cond  = PTHREAD_COND_INITIALIZER;
+static pthread_t       log_thread;
+static bool            log_started  = false;  /* thread created and not joined yet */
+static bool            log_stopping = false;  /* log_stop asked it to finish */
+static bool            log_wanted   = false;  /* the log is short of clean segments */
+
+static bool log_on(){
+	return superblock->features & FS_FEATURE_LOG;
+}
+
+static int num_segments(){
+	return (superblock->num_data_blocks + LOG_SEGMENT_BLOCKS - 1) / LOG_SEGMENT_BLOCKS;
+}
+
+/*additional function helps to get the first physical block of a segment, physical block
+  0 is never used
+*/
+static int segment_start(int segment){
+	return segment == 0 ? 1 : segment * LOG_SEGMENT_BLOCKS;
+}
+
+static int segment_end(int segment){
+	int end = (segment + 1) * LOG_SEGMENT_BLOCKS;
+	return end < superblock->num_data_blocks ? end : superblock->num_data_blocks;
+}
+
+static int live_blocks(int segment){
+	int live = 0;
+	for(int phys = segment_start(segment); phys < segment_end(segment); phys ++){
+		if(block_refcount(phys) > 0) live ++;
+	}
+	return live;
+}
+
+static int clean_segments(){
+	int clean = 0;
+	for(int segment = 0; segment < num_segments(); segment ++){
+		if(live_blocks(segment) == 0) clean ++;
+	}
+	return clean;
+}
+
+static void wake_cleaner(){
+	pthread_mutex_lock(&log_mutex);
+	log_wanted = true;
+	pthread_cond_signal(&log_cond);
+	pthread_mutex_unlock(&log_mutex);
+}
+
+int log_alloc(){
+	//the rest of the segment the log is in
+	while(head != 0 && head < segment_end((head - 1) / LOG_SEGMENT_BLOCKS)){
+		int phys = head ++;
+		if(block_refcount(phys) == 0) return phys;
+	}
+
+	//then the next clean segment
+	int from = head == 0 ? 0 : (head - 1) / LOG_SEGMENT_BLOCKS + 1;
+	for(int i = 0; i < num_segments(); i ++){
+		int segment = (from + i) % num_segments();
+		if(segment != cleaning && live_blocks(segment) == 0){
+			head = segment_start(segment);
+			if(clean_segments() <= LOG_CLEAN_LOW) wake_cleaner();
+			return head ++;
+		}
+	}
+
+	//no clean segment left: the holes of the others until the cleaner catches up
+	wake_cleaner();
+	for(int phys = 1; phys < superblock->num_data_blocks; phys ++){
+		if(block_refcount(phys) == 0 && phys / LOG_SEGMENT_BLOCKS != cleaning) return phys;
+	}
+	return 0;
+}
+
+/*additional function helps to count the block map entries of the data blocks in use
+  pointing to each physical block. A physical block with more references than that is
+  kept by a snapshot and cannot move
+*/
+static void count_map_refs(){
+	memset(map_refs, 0, sizeof(map_refs));
+	for(int block = 1; block < superblock->num_data_blocks; block ++){
+		int phys = dedup_map(block);
+		if(phys > 0 && phys < superblock->num_data_blocks && get_fat_entry(block) != EMPTY) map_refs[phys] ++;
+	}
+}
+
+/*additional function helps to clean the segment with the fewest live blocks. Return 1 if
+  a segment was cleaned, 0 if none can be, -1 on failure
+*/
+static int clean_one(){
+	int current = head == 0 ? -1 : (head - 1) / LOG_SEGMENT_BLOCKS;
+	int best = -1, best_live = 0, free_blocks = 0;
+
+	count_map_refs();
+	for(int segment = 0; segment < num_segments(); segment ++){
+		int live = 0;
+		bool movable = true;
+		for(int phys = segment_start(segment); phys < segment_end(segment); phys ++){
+			int count = block_refcount(phys);
+			if(count == 0) continue;
+			live ++;
+			if(count != map_refs[phys]) movable = false;
+		}
+		free_blocks += segment_end(segment) - segment_start(segment) - live;
+		if(segment == current || !movable || live == 0 ||
+		   live == segment_end(segment) - segment_start(segment)) continue;
+		if(best == -1 || live < best_live){
+			best = segment;
+			best_live = live;
+		}
+	}
+	//the live blocks have to fit in the free blocks of the other segments
+	if(best == -1) return 0;
+	if(free_blocks - (segment_end(best) - segment_start(best) - best_live) < best_live) return 0;
+
+	cleaning = best;
+	for(int phys = segment_start(best); phys < segment_end(best); phys ++){
+		if(block_refcount(phys) == 0) continue;
+		if(block_move(phys) == 0){
+			cleaning = -1;
+			return -1;
+		}
+		stats.blocks_moved ++;
+	}
+	cleaning = -1;
+	stats.segments_cleaned ++;
+	return commit_metadata() == -1 ? -1 : 1;
+}
+
+static void *log_main(void *arg){
+	for(;;){
+		pthread_mutex_lock(&log_mutex);
+		while(!log_stopping && !log_wanted) pthread_cond_wait(&log_cond, &log_mutex);
+		bool stop = log_stopping;
+		log_wanted = false;
+		pthread_mutex_unlock(&log_mutex);
+		if(stop) break;
+
+		//one segment at a time, so that writers get fs_lock in between
+		for(;;){
+			pthread_mutex_lock(&fs_lock);
+			int rtn = clean_segments() < LOG_CLEAN_HIGH ? clean_one() : 0;
+			pthread_mutex_unlock(&fs_lock);
+
+			pthread_mutex_lock(&log_mutex);
+			stop = log_stopping;
+			pthread_mutex_unlock(&log_mutex);
+			if(rtn != 1 || stop) break;
+		}
+	}
+	return NULL;
+}
+
+void log_reset(){
+	head = 0;
+	cleaning = -1;
+	memset(&stats, 0, sizeof(stats));
+}
+
+int log_start(){
+	if(!log_on() || mount_readonly) return 0;
+
+	pthread_mutex_lock(&log_mutex);
+	log_stopping = false;
+	log_wanted = false;
+	if(pthread_create(&log_thread, NULL, log_main, NULL) != 0){
+		pthread_mutex_unlock(&log_mutex);
+		return -1;
+	}
+	log_started = true;
+	pthread_mutex_unlock(&log_mutex);
+	return 0;
+}
+
+void log_stop(){
+	pthread_mutex_lock(&log_mutex);
+	if(!log_started){
+		pthread_mutex_unlock(&log_mutex);
+		return;
+	}
+	log_stopping = true;
+	pthread_cond_signal(&log_cond);
+	pthread_mutex_unlock(&log_mutex);
+
+	pthread_join(log_thread, NULL);
+	pthread_mutex_lock(&log_mutex);
+	log_started = false;
+	pthread_mutex_unlock(&log_mutex);
+}
+
+int fs_log_clean(int max_segments){
+	int cleaned = 0;
+
+	pthread_mutex_lock(&fs_lock);
+	if(!log_on() || mount_readonly){
+		pthread_mutex_unlock(&fs_lock);
+		return -1;
+	}
+	//every clean moves the live blocks to full segments, so this ends
+	for(int i = 0; i < num_segments() && (max_segments <= 0 || cleaned < max_segments); i ++){
+		int rtn = clean_one();
+		if(rtn == -1) cleaned = -1;
+		if(rtn != 1) break;
+		cleaned ++;
+	}
+	pthread_mutex_unlock(&fs_lock);
+	return cleaned;
+}
+
+int fs_log_stats(struct fs_log_stats *out){
+	if(out == NULL) return -1;
+
+	pthread_mutex_lock(&fs_lock);
+	if(!log_on()){
+		pthread_mutex_unlock(&fs_lock);
+		return -1;
+	}
+	*out = stats;
+	out->segments = num_segments();
+	out->clean_segments = clean_segments();
+	pthread_mutex_unlock(&fs_lock);
+	return 0;
+}
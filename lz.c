@@ -0,0 +1,133 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+/*
+LZ codec:
+
+A small implementation of the LZ4 block format. The compressed data is a list of
+sequences, each a token byte (high nibble: number of literals, low nibble: match
+length - 4, 15 meaning more length bytes follow), the literals, and a two byte offset
+back to where the match starts. The last sequence only has literals.
+
+The compressor is greedy: it looks up the next 4 bytes in a hash table of the last
+position they were seen at, and takes the match if the bytes there are the same. That
+makes it fast rather than strong, which is what a file system in the write path needs.
+*/
+
+#define MIN_MATCH     4
+#define LAST_LITERALS 5    /* the last bytes are always literals */
+#define MATCH_LIMIT   12   /* no match starts this close to the end */
+#define MAX_OFFSET    65535
+#define HASH_LOG      12
+
+static uint32_t read32(const char *p){
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static int hash(uint32_t v){
+	return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+/*additional function helps to write a length in the 255-byte continuation format*/
+static int put_length(char *dst, int len){
+	int n = 0;
+	for(; len >= 255; len -= 255) dst[n++] = (char)255;
+	dst[n++] = (char)len;
+	return n;
+}
+
+/*additional function helps to emit one sequence. Return the new output position, or -1
+  when it does not fit
+*/
+static int put_sequence(char *dst, int op, int dstcap, const char *literals, int lit_len,
+                        int offset, int match_len){
+	//worst case: token, length bytes of both, literals and offset
+	if(op + 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1 > dstcap) return -1;
+
+	char *token = &dst[op++];
+	*token = (char)((lit_len < 15 ? lit_len : 15) << 4);
+	if(lit_len >= 15) op += put_length(dst + op, lit_len - 15);
+	memcpy(dst + op, literals, lit_len);
+	op += lit_len;
+	if(match_len < 0) return op;   //last literals
+
+	dst[op++] = (char)(offset & 0xff);
+	dst[op++] = (char)(offset >> 8);
+	match_len -= MIN_MATCH;
+	*token |= (char)(match_len < 15 ? match_len : 15);
+	if(match_len >= 15) op += put_length(dst + op, match_len - 15);
+	return op;
+}
+
+int lz_compress(const char *src, int srclen, char *dst, int dstcap){
+	int table[1 << HASH_LOG];
+	int ip = 0, anchor = 0, op = 0;
+
+	memset(table, -1, sizeof(table));
+	while(ip <= srclen - MATCH_LIMIT){
+		uint32_t seq = read32(src + ip);
+		int h = hash(seq);
+		int ref = table[h];
+		table[h] = ip;
+		if(ref < 0 || ip - ref > MAX_OFFSET || read32(src + ref) != seq){
+			ip ++;
+			continue;
+		}
+
+		int len = MIN_MATCH;
+		while(ip + len < srclen - LAST_LITERALS && src[ref + len] == src[ip + len]) len ++;
+
+		op = put_sequence(dst, op, dstcap, src + anchor, ip - anchor, ip - ref, len);
+		if(op == -1) return 0;
+		ip += len;
+		anchor = ip;
+	}
+
+	op = put_sequence(dst, op, dstcap, src + anchor, srclen - anchor, 0, -1);
+	return op == -1 ? 0 : op;
+}
+
+/*additional function helps to read a length in the 255-byte continuation format*/
+static int get_length(const char *src, int *ip, int srclen, int len){
+	unsigned char b;
+	do{
+		if(*ip >= srclen) return -1;
+		b = (unsigned char)src[(*ip)++];
+		len += b;
+	}while(b == 255);
+	return len;
+}
+
+int lz_decompress(const char *src, int srclen, char *dst, int dstcap){
+	int ip = 0, op = 0;
+
+	while(ip < srclen){
+		unsigned char token = (unsigned char)src[ip++];
+
+		int lit_len = token >> 4;
+		if(lit_len == 15 && (lit_len = get_length(src, &ip, srclen, lit_len)) == -1) return -1;
+		if(ip + lit_len > srclen || op + lit_len > dstcap) return -1;
+		memcpy(dst + op, src + ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+		if(ip == srclen) break;   //last sequence has no match
+
+		if(ip + 2 > srclen) return -1;
+		int offset = (unsigned char)src[ip] | (unsigned char)src[ip + 1] << 8;
+		ip += 2;
+		if(offset == 0 || offset > op) return -1;
+
+		int match_len = token & 15;
+		if(match_len == 15 && (match_len = get_length(src, &ip, srclen, match_len)) == -1) return -1;
+		match_len += MIN_MATCH;
+		if(op + match_len > dstcap) return -1;
+
+		//byte by byte, the match may overlap what it copies
+		for(int i = 0; i < match_len; i ++, op ++) dst[op] = dst[op - offset];
+	}
+	return op;
+}
@@ -0,0 +1,14 @@
+#ifndef _LZ_H_
+#define _LZ_H_
+
+/******************************************************************************/
+/* LZ4 block format: sequences of literals and back references of up to 64 KB */
+int lz_compress(const char *src, int srclen, char *dst, int dstcap);
+                               /* compress src into dst, return the number of */
+                               /* bytes written, 0 if it does not fit dstcap  */
+int lz_decompress(const char *src, int srclen, char *dst, int dstcap);
+                               /* decompress src into dst, return the number  */
+                               /* of bytes written, -1 if src is corrupt      */
+/******************************************************************************/
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_internal.h"
+
+/*
+Memory pool:
+
+The memory the file system works in is taken once per process, the first time a file
+system is made or mounted, as one page aligned arena:
+
+  superblock and metadata cache | block buffers
+
+The metadata cache has a slot for every metadata block (the superblock is block 0), so a
+block is always cached at the same place and mounting again only forgets which slots are
+filled. The POOL_BLOCKS block buffers are for the read and write paths, which take them
+with pool_get_block instead of using the heap or the stack. They are aligned to the block
+size, so they can be handed to the disk as they are.
+*/
+
+#define POOL_BLOCKS 16
+
+static pthread_once_t  pool_once  = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *arena;                       /* META_BLOCKS_MAX + POOL_BLOCKS blocks */
+static char *free_buffers[POOL_BLOCKS];
+static int   num_free_buffers;
+
+static void pool_init(){
+	size_t size = (size_t)(META_BLOCKS_MAX + POOL_BLOCKS) * BLOCK_SIZE;
+	void *mem;
+
+	if(posix_memalign(&mem, BLOCK_SIZE, size) != 0) return;
+	memset(mem, 0, size);
+	arena = mem;
+	for(int i = 0; i < POOL_BLOCKS; i ++){
+		free_buffers[num_free_buffers ++] = arena + (size_t)(META_BLOCKS_MAX + i) * BLOCK_SIZE;
+	}
+}
+
+char *pool_meta_block(int block){
+	pthread_once(&pool_once, pool_init);
+	if(arena == NULL || block < 0 || block >= META_BLOCKS_MAX) return NULL;
+	return arena + (size_t)block * BLOCK_SIZE;
+}
+
+char *pool_get_block(){
+	char *buf = NULL;
+
+	pthread_once(&pool_once, pool_init);
+	pthread_mutex_lock(&pool_mutex);
+	if(num_free_buffers > 0) buf = free_buffers[-- num_free_buffers];
+	pthread_mutex_unlock(&pool_mutex);
+	return buf;
+}
+
+void pool_put_block(char *buf){
+	if(buf == NULL) return;
+	pthread_mutex_lock(&pool_mutex);
+	free_buffers[num_free_buffers ++] = buf;
+	pthread_mutex_unlock(&pool_mutex);
+}
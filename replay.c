@@ -0,0 +1,252 @@
+/**
+ *
+ * replay.c: re-executes a trace recorded with trace_start() against a disk
+ * image and reports the latency of every operation.
+ *
+ * usage: replay [-f] [-t] [-v] <trace> <disk>
+ *
+ *   -f  start from a fresh file system (make_fs) instead of the image as is,
+ *       use a copy of a production image to replay against a snapshot
+ *   -t  keep the recorded timing between calls instead of replaying them
+ *       back to back
+ *   -v  keep the debug messages printed by the file system
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "fs.h"
+#include "trace.h"
+
+/* latency statistics of one operation type */
+struct op_stats {
+  long     count;
+  long     failed;   /* calls whose result differs from the recorded one */
+  uint64_t total;
+  uint64_t max;
+  uint64_t recorded; /* total latency observed when the trace was taken  */
+};
+
+static struct op_stats stats[TRACE_NUM_OPS];
+
+/* recorded file descriptor -> file descriptor returned while replaying */
+static int *fd_map = NULL;
+static int  fd_map_len = 0;
+
+/* scratch buffer used as source and destination of reads and writes */
+static char  *data_buf = NULL;
+static size_t data_len = 0;
+
+static void usage(char *prog){
+  fprintf(stderr, "usage: %s [-f] [-t] [-v] <trace> <disk>\n", prog);
+  exit(1);
+}
+
+static void map_fildes(int recorded, int replayed){
+  if(recorded < 0) return;
+  if(recorded >= fd_map_len){
+    int len = fd_map_len ? fd_map_len : 32;
+    while(len <= recorded) len *= 2;
+    fd_map = realloc(fd_map, len * sizeof(int));
+    for(int i = fd_map_len; i < len; i++) fd_map[i] = -1;
+    fd_map_len = len;
+  }
+  fd_map[recorded] = replayed;
+}
+
+static int lookup_fildes(int recorded){
+  if(recorded < 0 || recorded >= fd_map_len) return -1;
+  return fd_map[recorded];
+}
+
+static char *scratch(long nbyte){
+  if(nbyte > (long)data_len){
+    data_buf = realloc(data_buf, nbyte);
+    memset(data_buf + data_len, 'r', nbyte - data_len);
+    data_len = nbyte;
+  }
+  return data_buf;
+}
+
+/* sleep until the replay is as far into the run as the recording was */
+static void wait_until(uint64_t replay_start, uint64_t offset){
+  uint64_t now = trace_now();
+  if(now - replay_start >= offset) return;
+
+  uint64_t delay = offset - (now - replay_start);
+  struct timespec ts = { delay / 1000000000ULL, delay % 1000000000ULL };
+  nanosleep(&ts, NULL);
+}
+
+/* a batch of readdir, from the cursor it started at when recorded */
+static int replay_readdir(char *path, long max, long cursor){
+  int c = cursor;
+  struct fs_stat *entries = malloc(max * sizeof(struct fs_stat));
+  if(entries == NULL) return -1;
+  int rtn = fs_readdir(path, &c, entries, max);
+  free(entries);
+  return rtn;
+}
+
+/* reads and writes at an offset are only there as asynchronous requests: submit one and
+   wait for it */
+static int replay_positional(int op, int fd, long nbyte, long offset){
+  static int aio_ready = 0;
+  struct fs_aio_req req, *done;
+
+  if(!aio_ready){
+    if(fs_aio_setup() < 0) return -1;
+    aio_ready = 1;
+  }
+  memset(&req, 0, sizeof(req));
+  req.op = op;
+  req.fildes = fd;
+  req.buf = scratch(nbyte);
+  req.nbyte = nbyte;
+  req.offset = offset;
+  if(fs_aio_submit(&req) != 0 || fs_aio_reap(&done, 1, 1) != 1) return -1;
+  return req.rtn;
+}
+
+static int replay(struct trace_entry *e, char *disk){
+  int fd = lookup_fildes(e->fildes);
+  struct fs_stat st;
+
+  switch(e->op){
+  case TRACE_MAKE_FS:      return make_fs_ext(disk, e->arg);
+  case TRACE_MOUNT_FS:     return mount_fs_ext(disk, e->arg);
+  case TRACE_MOUNT_SNAPSHOT: return mount_snapshot(disk, e->name2);
+  case TRACE_UMOUNT_FS:    return umount_fs(disk);
+  case TRACE_OPEN:
+    fd = fs_open(e->name);
+    map_fildes(e->rtn, fd);
+    return fd;
+  case TRACE_CLOSE:        return fs_close(fd);
+  case TRACE_CREATE:       return fs_create(e->name);
+  case TRACE_DELETE:       return fs_delete(e->name);
+  case TRACE_READ:         return fs_read(fd, scratch(e->arg), e->arg);
+  case TRACE_WRITE:        return fs_write(fd, scratch(e->arg), e->arg);
+  case TRACE_GET_FILESIZE: return fs_get_filesize(fd);
+  case TRACE_LSEEK:        return fs_lseek(fd, e->arg);
+  case TRACE_TRUNCATE:     return fs_truncate(fd, e->arg);
+  case TRACE_FALLOCATE:    return fs_fallocate(fd, e->offset, e->arg);
+  case TRACE_SYNC:         return fs_sync();
+  case TRACE_MKDIR:        return fs_mkdir(e->name);
+  case TRACE_RMDIR:        return fs_rmdir(e->name);
+  case TRACE_COPY_FILE:    return fs_copy_file(e->name, e->name2);
+  case TRACE_COPY_RANGE:
+    return fs_copy_range(fd, e->offset, lookup_fildes(e->fildes2), e->offset2, e->arg);
+  case TRACE_PREAD:        return replay_positional(FS_AIO_READ, fd, e->arg, e->offset);
+  case TRACE_PWRITE:       return replay_positional(FS_AIO_WRITE, fd, e->arg, e->offset);
+  case TRACE_SNAPSHOT:     return fs_snapshot(e->name);
+  case TRACE_SNAPSHOT_DELETE: return fs_snapshot_delete(e->name);
+  case TRACE_STAT:         return fs_stat(e->name, &st);
+  case TRACE_READDIR:      return replay_readdir(e->name, e->arg, e->offset);
+  }
+  return -1;
+}
+
+int main(int argc, char **argv){
+  int fresh = 0, timed = 0, verbose = 0, opt;
+
+  while((opt = getopt(argc, argv, "ftv")) != -1){
+    switch(opt){
+    case 'f': fresh = 1;   break;
+    case 't': timed = 1;   break;
+    case 'v': verbose = 1; break;
+    default:  usage(argv[0]);
+    }
+  }
+  if(argc - optind != 2) usage(argv[0]);
+
+  char *trace_name = argv[optind];
+  char *disk = argv[optind + 1];
+
+  FILE *trace = fopen(trace_name, "r");
+  if(trace == NULL){
+    perror("replay: cannot open trace");
+    return 1;
+  }
+
+  //the file system prints on every call, keep that out of the report
+  int saved_stdout = dup(STDOUT_FILENO);
+  if(!verbose){
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+  }
+
+  if(fresh && make_fs(disk) == -1){
+    fprintf(stderr, "replay: cannot create file system on %s\n", disk);
+    return 1;
+  }
+
+  //lines are as long as the paths in them
+  char *line = NULL;
+  size_t line_len = 0;
+  struct trace_entry e;
+  int mounted = 0, lineno = 0;
+  uint64_t replay_start = trace_now();
+
+  while(getline(&line, &line_len, trace) != -1){
+    lineno++;
+    if(trace_parse(line, &e) == -1){
+      fprintf(stderr, "replay: %s:%d: malformed entry skipped\n", trace_name, lineno);
+      continue;
+    }
+
+    //traces taken on a mounted file system start with a file operation
+    if(!mounted && e.op != TRACE_MAKE_FS && e.op != TRACE_MOUNT_FS && e.op != TRACE_MOUNT_SNAPSHOT){
+      if(mount_fs(disk) == -1){
+        fprintf(stderr, "replay: cannot mount %s\n", disk);
+        return 1;
+      }
+      mounted = 1;
+    }
+
+    if(timed) wait_until(replay_start, e.start);
+
+    uint64_t start = trace_now();
+    int rtn = replay(&e, disk);
+    uint64_t latency = trace_now() - start;
+
+    if((e.op == TRACE_MOUNT_FS || e.op == TRACE_MOUNT_SNAPSHOT) && rtn == 0) mounted = 1;
+    if(e.op == TRACE_UMOUNT_FS && rtn == 0) mounted = 0;
+
+    struct op_stats *s = &stats[e.op];
+    s->count ++;
+    s->total += latency;
+    s->recorded += e.latency;
+    if(latency > s->max) s->max = latency;
+    if(rtn != e.rtn && e.op != TRACE_OPEN) s->failed ++;
+    if(e.op == TRACE_OPEN && (rtn < 0) != (e.rtn < 0)) s->failed ++;
+  }
+  uint64_t elapsed = trace_now() - replay_start;
+
+  fs_aio_teardown();
+  if(mounted) umount_fs(disk);
+  fclose(trace);
+
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+
+  printf("%-14s %8s %8s %12s %12s %12s\n", "op", "count", "differ", "avg(us)", "max(us)", "recorded(us)");
+  for(int i = 0; i < TRACE_NUM_OPS; i++){
+    struct op_stats *s = &stats[i];
+    if(s->count == 0) continue;
+    printf("%-14s %8ld %8ld %12.2f %12.2f %12.2f\n", trace_op_name(i), s->count, s->failed,
+           s->total / 1000.0 / s->count, s->max / 1000.0, s->recorded / 1000.0 / s->count);
+  }
+  printf("replayed %d entries in %.3f ms\n", lineno, elapsed / 1000000.0);
+
+  free(line);
+  free(fd_map);
+  free(data_buf);
+  return 0;
+}
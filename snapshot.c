@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32c.h"
+#include "fs_internal.h"
+#include "trace.h"
+
+/*
+Snapshots:
+
+A snapshot is a copy of the FAT, directory, inline area and block map, written to its
+own SNAPSHOT_BLOCKS blocks of the snapshot area (between the journal and the data region)
+and named in the snapshot table, a metadata block journaled like the FAT. Data blocks are
+not copied: the snapshot takes one more reference to every physical block the block map
+points to (see dedup.c). A physical block used by more than one data block is never
+written in place, so once the snapshot is taken, the next write of each of those blocks
+goes to a new physical block (copy on write) and the snapshot keeps the old content.
+
+mount_snapshot mounts the image read-only with the metadata blocks that were copied read
+from the snapshot instead (see snapshot_source). The other metadata it reads (checksum
+region) only changes for physical blocks the snapshot does not use, and the journal is
+left alone, so a snapshot can be mounted while another process writes the file system.
+*/
+
+/* entry of the snapshot table, the checksums are the CRC32C of the copied blocks */
+struct snapshot_entry{
+	char     name[SNAPSHOT_NAME_MAX + 1];
+	int      in_use;
+	uint32_t checksum[SNAPSHOT_BLOCKS];
+};
+
+static int                   mounted_slot = -1;   /* snapshot mounted by mount_snapshot */
+static struct snapshot_entry mounted_entry;
+
+/*additional function helps to get the metadata block the k-th block of a snapshot is a
+  copy of
+*/
+static int copied_block(int k){
+	if(k < superblock->num_FAT_blocks) return superblock->ind_FAT + k;
+	k -= superblock->num_FAT_blocks;
+	if(k == 0) return superblock->ind_root_dir;
+	k -= 1;
+	if(k < INLINE_BLOCKS) return superblock->ind_inline + k;
+	return superblock->ind_block_map + k - INLINE_BLOCKS;
+}
+
+static int snapshot_block(int slot, int k){
+	return superblock->ind_snapshot_area + slot * SNAPSHOT_BLOCKS + k;
+}
+
+static struct snapshot_entry *snapshot_table(){
+	return (struct snapshot_entry*)meta_block_buf(superblock->ind_snapshots);
+}
+
+/*additional function helps to find the slot of a snapshot by name. Return -1 if there is none*/
+static int find_snapshot(char *name){
+	struct snapshot_entry *table = snapshot_table();
+	if(table == NULL) return -1;
+
+	for(int i = 0; i < SNAPSHOT_NUM_MAX; i ++){
+		if(table[i].in_use && strncmp(table[i].name, name, SNAPSHOT_NAME_MAX) == 0) return i;
+	}
+	return -1;
+}
+
+/*additional function helps to read the block map of a snapshot into map, one int per data block*/
+static int read_snapshot_map(int slot, int *map){
+	int per_block = BLOCK_SIZE / sizeof(int);
+	int first = superblock->num_FAT_blocks + 1 + INLINE_BLOCKS;
+
+	for(int i = 0; i < BLOCK_MAP_BLOCKS; i ++){
+		if(block_read(snapshot_block(slot, first + i), (char*)(map + i * per_block)) == -1) return -1;
+	}
+	return 0;
+}
+
+static int do_snapshot(char *name){
+	if(superblock->ind_snapshots == 0 || mount_readonly || name == NULL) return -1;
+	if(strlen(name) > SNAPSHOT_NAME_MAX || find_snapshot(name) != -1) return -1;
+
+	struct snapshot_entry *table = snapshot_table();
+	int slot = -1;
+	for(int i = 0; i < SNAPSHOT_NUM_MAX; i ++){
+		if(!table[i].in_use){
+			slot = i;
+			break;
+		}
+	}
+	if(slot == -1 || delalloc_flush_all() == -1 || load_metadata() == -1) return -1;
+
+	for(int k = 0; k < SNAPSHOT_BLOCKS; k ++){
+		char *buf = meta_block_buf(copied_block(k));
+		if(block_write(snapshot_block(slot, k), buf) == -1) return -1;
+		table[slot].checksum[k] = crc32c(0, buf, BLOCK_SIZE);
+	}
+	if(sync_disk() == -1) return -1;
+
+	//the snapshot shares every physical block in use. The references are taken once the
+	//copies are on disk (the refcounts are not copied), so a failed copy leaves none
+	//behind for the next commit to keep. The copies only count once the table entry and
+	//the references are committed together, the checkpoint makes them visible to
+	//mount_snapshot in other processes
+	for(int block = 1; block < superblock->num_data_blocks; block ++){
+		block_get(dedup_map(block));
+	}
+	strcpy(table[slot].name, name);
+	table[slot].in_use = 1;
+	mark_meta_dirty(superblock->ind_snapshots);
+	if(commit_metadata() == -1) return -1;
+	return checkpoint_metadata();
+}
+
+static int do_snapshot_delete(char *name){
+	if(superblock->ind_snapshots == 0 || mount_readonly || name == NULL) return -1;
+	int slot = find_snapshot(name);
+	if(slot == -1) return -1;
+
+	int *map = malloc(BLOCK_MAP_BLOCKS * BLOCK_SIZE);
+	if(map == NULL) return -1;
+	if(read_snapshot_map(slot, map) == -1){
+		free(map);
+		return -1;
+	}
+	for(int block = 1; block < superblock->num_data_blocks; block ++){
+		if(map[block] > 0 && map[block] < superblock->num_data_blocks) block_put(map[block]);
+	}
+	free(map);
+
+	memset(&snapshot_table()[slot], 0, sizeof(struct snapshot_entry));
+	mark_meta_dirty(superblock->ind_snapshots);
+	return commit_metadata();
+}
+
+int fs_snapshot(char *name){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_snapshot(name);
+	trace_record(TRACE_SNAPSHOT, name, -1, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int fs_snapshot_delete(char *name){
+	pthread_mutex_lock(&fs_lock);
+	uint64_t start = trace_now();
+	int rtn = do_snapshot_delete(name);
+	trace_record(TRACE_SNAPSHOT_DELETE, name, -1, 0, rtn, start);
+	pthread_mutex_unlock(&fs_lock);
+	return rtn;
+}
+
+int snapshot_open(char *name){
+	snapshot_close();
+	if(superblock->ind_snapshots == 0 || name == NULL) return -1;
+
+	int slot = find_snapshot(name);
+	if(slot == -1) return -1;
+	mounted_entry = snapshot_table()[slot];
+	mounted_slot = slot;
+	return 0;
+}
+
+void snapshot_close(){
+	mounted_slot = -1;
+}
+
+int snapshot_source(int block, uint32_t *checksum){
+	if(mounted_slot == -1) return block;
+
+	for(int k = 0; k < SNAPSHOT_BLOCKS; k ++){
+		if(copied_block(k) == block){
+			*checksum = mounted_entry.checksum[k];
+			return snapshot_block(mounted_slot, k);
+		}
+	}
+	return block;
+}
+
+int snapshot_count_refs(int *counts){
+	if(superblock->ind_snapshots == 0) return 0;
+
+	struct snapshot_entry *table = snapshot_table();
+	int *map = malloc(BLOCK_MAP_BLOCKS * BLOCK_SIZE);
+	if(table == NULL || map == NULL){
+		free(map);
+		return -1;
+	}
+	for(int slot = 0; slot < SNAPSHOT_NUM_MAX; slot ++){
+		if(!table[slot].in_use) continue;
+		if(read_snapshot_map(slot, map) == -1){
+			free(map);
+			return -1;
+		}
+		for(int block = 1; block < superblock->num_data_blocks; block ++){
+			if(map[block] > 0 && map[block] < superblock->num_data_blocks) counts[map[block]] ++;
+		}
+	}
+	free(map);
+	return 0;
+}
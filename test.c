@@ -4,20 +4,29 @@
  * 
  */
 
+#define _GNU_SOURCE
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <poll.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 
-#define NUM_TESTS 13
+#include "fs.h"
+#include "disk.h"
+#include "trace.h"
+#include "crc32c.h"
+
+#define NUM_TESTS 40
 #define PASS 1
 #define FAIL 0
 
@@ -27,7 +36,9 @@
 #define BLOCK_SIZE 4096
 
 int make_fs(char *name);
+int make_fs_ext(char *name, int features);
 int mount_fs(char *name);
+int mount_fs_ext(char *name, int flags);
 int umount_fs(char *name);
 
 int fs_open (char *name);
@@ -42,9 +53,37 @@ int fs_write(int fd, void *buf, size_t nbyte);
 int fs_get_filesize(int fd);
 int fs_lseek(int fd, off_t offset);
 int fs_truncate(int fd, off_t length);
+int fs_sync();
+
+int close_disk();
 
 char str[1000];
 
+/* every allocation of the process goes through here, test31 counts them */
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+static volatile int  counting_allocs;
+static volatile long num_allocs;
+
+void *malloc(size_t size) {
+    if (counting_allocs)
+        num_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    if (counting_allocs)
+        num_allocs++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (counting_allocs)
+        num_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
 //if your code compiles you pass test 0 for free
 //==============================================================================
 static int test0(void) {
@@ -540,6 +579,1868 @@ static int test12(void) {
 }
 
 
+//trace capture test
+//==============================================================================
+static int test13(void) {
+    int fd, lines = 0;
+    char buf[100];
+    char line[256];
+    FILE *trace;
+
+    memset(buf, 'a', sizeof(buf));
+
+    make_fs ("disk.13");
+    if (trace_start("trace.13"))
+        return FAIL;
+
+    mount_fs("disk.13");
+    fs_create("file.13");
+    fd = fs_open("file.13");
+    fs_write(fd, buf, 100);
+    fs_lseek(fd, 10);
+    fs_truncate(fd, 50);
+    fs_close(fd);
+    umount_fs("disk.13");
+
+    if (trace_stop())
+        return FAIL;
+
+    trace = fopen("trace.13", "r");
+    if (trace == NULL)
+        return FAIL;
+
+    /* truncate is recorded once, not as the read and write it uses */
+    while (fgets(line, sizeof(line), trace) != NULL)
+        lines++;
+    fclose(trace);
+    remove("trace.13");
+
+    if (lines != 8)
+        return FAIL;
+
+    return PASS;
+}
+
+
+//journal recovery test
+//==============================================================================
+static int test14(void) {
+    int rtn, fd;
+    char wt[] = "hello journal";
+    char rd[20];
+
+    memset(rd, 0, sizeof(rd));
+
+    make_fs ("disk.14");
+    mount_fs("disk.14");
+
+    fs_create("file.14");
+    fd = fs_open("file.14");
+    fs_write(fd, wt, strlen(wt));
+    fs_close(fd);
+
+    rtn = fs_sync();
+    if (rtn)
+        return FAIL;
+
+    /* crash: the metadata only made it to the journal */
+    close_disk();
+
+    rtn = mount_fs("disk.14");
+    if (rtn)
+        return FAIL;
+
+    fd = fs_open("file.14");
+    if (fd < 0)
+        return FAIL;
+
+    rtn = fs_read(fd, rd, sizeof(rd));
+    if (rtn != strlen(wt) || strcmp(rd, wt))
+        return FAIL;
+
+    fs_close(fd);
+    umount_fs("disk.14");
+
+    return PASS;
+}
+
+
+//umount only writes changed metadata test
+//==============================================================================
+static int test15(void) {
+    int fd, disk;
+    char wt[] = "hello world";
+    char marker[4] = {'F', 'A', 'T', '4'};
+    char rd[4];
+
+    make_fs ("disk.15");
+    mount_fs("disk.15");
+
+    /* the last FAT block covers data blocks that this test never uses */
+    disk = open("disk.15", O_RDWR);
+    pwrite(disk, marker, sizeof(marker), 5 * BLOCK_SIZE - sizeof(marker));
+
+    fs_create("file.15");
+    fd = fs_open("file.15");
+    fs_write(fd, wt, strlen(wt));
+    fs_close(fd);
+    umount_fs("disk.15");
+
+    pread(disk, rd, sizeof(rd), 5 * BLOCK_SIZE - sizeof(marker));
+    close(disk);
+    if (memcmp(rd, marker, sizeof(marker)))
+        return FAIL;
+
+    return PASS;
+}
+
+
+//lazy mount test
+//==============================================================================
+static int test16(void) {
+    int rtn, fd;
+    char wt[] = "hello lazy";
+    char rd[20];
+
+    memset(rd, 0, sizeof(rd));
+
+    make_fs ("disk.16");
+    mount_fs("disk.16");
+    fs_create("file.16");
+    fd = fs_open("file.16");
+    fs_write(fd, wt, strlen(wt));
+    fs_close(fd);
+    umount_fs("disk.16");
+
+    rtn = mount_fs_ext("disk.16", MOUNT_LAZY);
+    if (rtn)
+        return FAIL;
+
+    fd = fs_open("file.16");
+    if (fd < 0)
+        return FAIL;
+
+    rtn = fs_read(fd, rd, sizeof(rd));
+    if (rtn != strlen(wt) || strcmp(rd, wt))
+        return FAIL;
+
+    fs_lseek(fd, fs_get_filesize(fd));
+    fs_write(fd, wt, strlen(wt));
+    fs_close(fd);
+    umount_fs("disk.16");
+
+    mount_fs("disk.16");
+    fd = fs_open("file.16");
+    if (fs_get_filesize(fd) != 2 * strlen(wt))
+        return FAIL;
+
+    fs_close(fd);
+    umount_fs("disk.16");
+
+    return PASS;
+}
+
+
+//consistency check and repair test
+//==============================================================================
+static int test17(void) {
+    int rtn, fd, disk;
+    int link = 2, used = -1;
+    char buf[3 * BLOCK_SIZE];
+    struct fs_check_report report;
+
+    memset(buf, 'a', sizeof(buf));
+
+    make_fs ("disk.17");
+    mount_fs("disk.17");
+
+    fs_create("a.17");
+    fs_create("b.17");
+    fd = fs_open("a.17");
+    fs_write(fd, buf, sizeof(buf));
+    fs_close(fd);
+    fd = fs_open("b.17");
+    fs_write(fd, buf, sizeof(buf));
+    fs_close(fd);
+
+    rtn = fs_check(0, 4, &report);
+    if (rtn != 0 || report.files != 2)
+        return FAIL;
+    umount_fs("disk.17");
+
+    /* a.17 has data blocks 1-3 and b.17 4-6: link b.17 into a.17 after
+     * its second block, and mark an unused block as used */
+    disk = open("disk.17", O_RDWR);
+    pwrite(disk, &link, sizeof(int), BLOCK_SIZE + 5 * sizeof(int));
+    pwrite(disk, &used, sizeof(int), BLOCK_SIZE + 100 * sizeof(int));
+    close(disk);
+
+    mount_fs("disk.17");
+    rtn = fs_check(0, 4, &report);
+    if (rtn <= 0 || report.cross_linked != 1 || report.leaked_blocks != 2)
+        return FAIL;
+    /* far more threads than the check runs on finds the same */
+    rtn = fs_check(0, 1 << 24, &report);
+    if (rtn <= 0 || report.cross_linked != 1 || report.leaked_blocks != 2)
+        return FAIL;
+
+    rtn = fs_check(1, 4, &report);
+    if (rtn <= 0 || report.repaired == 0)
+        return FAIL;
+    umount_fs("disk.17");
+
+    mount_fs("disk.17");
+    rtn = fs_check(0, 4, &report);
+    if (rtn != 0)
+        return FAIL;
+    umount_fs("disk.17");
+
+    return PASS;
+}
+
+
+//defragmentation test
+//==============================================================================
+static int test18(void) {
+    int rtn, fd_a, fd_b;
+    char buf[BLOCK_SIZE], out[4 * BLOCK_SIZE];
+    struct fs_frag_stats stats;
+
+    make_fs ("disk.18");
+    mount_fs("disk.18");
+
+    /* interleaved appends leave both files in every other block */
+    fs_create("a.18");
+    fs_create("b.18");
+    fd_a = fs_open("a.18");
+    fd_b = fs_open("b.18");
+    for (int i = 0; i < 4; i++) {
+        memset(buf, 'a' + i, sizeof(buf));
+        fs_write(fd_a, buf, sizeof(buf));
+        memset(buf, 'A' + i, sizeof(buf));
+        fs_write(fd_b, buf, sizeof(buf));
+    }
+    fs_close(fd_b);
+    fs_close(fd_a);
+
+    fs_frag_stats(&stats);
+    if (stats.files != 2 || stats.fragmented_files != 2 || stats.avg_extents != 4.0)
+        return FAIL;
+
+    rtn = fs_defrag(0);
+    if (rtn != 8)
+        return FAIL;
+    fs_frag_stats(&stats);
+    if (stats.fragmented_files != 0 || stats.avg_extents != 1.0)
+        return FAIL;
+    umount_fs("disk.18");
+
+    /* the moved file reads back the same after a remount */
+    mount_fs("disk.18");
+    fd_a = fs_open("a.18");
+    rtn = fs_read(fd_a, out, sizeof(out));
+    if (rtn != sizeof(out))
+        return FAIL;
+    for (int i = 0; i < 4; i++) {
+        if (out[i * BLOCK_SIZE] != 'a' + i || out[(i + 1) * BLOCK_SIZE - 1] != 'a' + i)
+            return FAIL;
+    }
+    fs_close(fd_a);
+
+    /* nothing left to do for the background thread */
+    if (fs_defrag_start(1000) != 0)
+        return FAIL;
+    while (fs_defrag_running())
+        usleep(1000);
+    fs_defrag_stop();
+    umount_fs("disk.18");
+
+    return PASS;
+}
+
+
+//inline data test
+//==============================================================================
+static int test19(void) {
+    int rtn, fd;
+    char buf[BLOCK_SIZE], out[BLOCK_SIZE];
+    struct fs_frag_stats stats;
+    struct fs_check_report report;
+
+    for (int i = 0; i < BLOCK_SIZE; i++)
+        buf[i] = 'a' + i % 26;
+
+    make_fs ("disk.19");
+    mount_fs("disk.19");
+
+    /* a tiny file takes no data block */
+    fs_create("file.19");
+    fd = fs_open("file.19");
+    fs_write(fd, buf, 60);
+    fs_write(fd, buf + 60, 40);
+    fs_frag_stats(&stats);
+    if (fs_get_filesize(fd) != 100 || stats.blocks != 0)
+        return FAIL;
+    fs_close(fd);
+    umount_fs("disk.19");
+
+    mount_fs("disk.19");
+    fd = fs_open("file.19");
+    rtn = fs_read(fd, out, sizeof(out));
+    if (rtn != 100 || memcmp(out, buf, 100) != 0)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+
+    /* growing past the inline area moves it to a data block */
+    fs_lseek(fd, 100);
+    fs_write(fd, buf + 100, 200);
+    fs_frag_stats(&stats);
+    if (fs_get_filesize(fd) != 300 || stats.blocks != 1)
+        return FAIL;
+    fs_lseek(fd, 0);
+    rtn = fs_read(fd, out, sizeof(out));
+    if (rtn != 300 || memcmp(out, buf, 300) != 0)
+        return FAIL;
+    fs_close(fd);
+    umount_fs("disk.19");
+
+    return PASS;
+}
+
+
+//checksum test
+//==============================================================================
+static int test20(void) {
+    int rtn, fd, disk;
+    char buf[3 * BLOCK_SIZE], out[3 * BLOCK_SIZE];
+    char bad = 'x';
+    int used = -1;
+    struct fs_check_report report;
+
+    if (crc32c(0, "123456789", 9) != 0xe3069283)
+        return FAIL;
+    /* the fast implementation agrees with the table at any length and alignment */
+    for (int i = 0; i < sizeof(buf); i++)
+        buf[i] = (char)(i * 7919 % 251);
+    for (int off = 0; off < 8; off++)
+        for (int len = 0; len < 2 * BLOCK_SIZE; len += len < 300 ? 1 : 61)
+            if (crc32c(off, buf + off, len) != crc32c_sw(off, buf + off, len))
+                return FAIL;
+
+    memset(buf, 'c', sizeof(buf));
+    make_fs_ext("disk.20", FS_FEATURE_CHECKSUMS);
+    mount_fs("disk.20");
+    fs_create("file.20");
+    fd = fs_open("file.20");
+    fs_write(fd, buf, sizeof(buf));
+    fs_close(fd);
+    umount_fs("disk.20");
+
+    mount_fs("disk.20");
+    fd = fs_open("file.20");
+    rtn = fs_read(fd, out, sizeof(out));
+    if (rtn != sizeof(out) || memcmp(out, buf, sizeof(out)) != 0)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    fs_close(fd);
+    umount_fs("disk.20");
+
+    /* flip a byte of the second data block and an unused FAT entry */
+    disk = open("disk.20", O_RDWR);
+    pwrite(disk, &bad, 1, (4096 + 2) * BLOCK_SIZE + 100);
+    pwrite(disk, &used, sizeof(int), 4 * BLOCK_SIZE);
+    close(disk);
+
+    mount_fs("disk.20");
+    fd = fs_open("file.20");
+    rtn = fs_read(fd, out, sizeof(out));
+    if (rtn != -1)
+        return FAIL;
+    fs_close(fd);
+    rtn = fs_check(0, 2, &report);
+    if (rtn <= 0 || report.bad_checksums != 2)
+        return FAIL;
+    fs_check(1, 2, &report);
+    umount_fs("disk.20");
+
+    /* the metadata checksum is fixed, the data block stays bad */
+    mount_fs("disk.20");
+    fs_check(0, 2, &report);
+    if (report.bad_checksums != 1)
+        return FAIL;
+    umount_fs("disk.20");
+
+    return PASS;
+}
+
+
+//compression test
+//==============================================================================
+static int test21(void) {
+    int rtn, fd;
+    static char model[64 * 1024], out[64 * 1024];
+    char line[64];
+    struct fs_frag_stats stats;
+    struct fs_check_report report;
+
+    /* log lines compress well, a block of noise does not */
+    for (int n = 0, i = 0; n < (int)sizeof(model); i++) {
+        int len = snprintf(line, sizeof(line), "%08d INFO request served in %d ms\n", i, i % 97);
+        for (int j = 0; j < len && n < (int)sizeof(model); j++)
+            model[n++] = line[j];
+    }
+
+    make_fs_ext("disk.21", FS_FEATURE_COMPRESSION | FS_FEATURE_CHECKSUMS);
+    mount_fs("disk.21");
+    fs_create("log.21");
+    fd = fs_open("log.21");
+    fs_write(fd, model, 100);
+    fs_write(fd, model + 100, sizeof(model) - 100);
+    fs_frag_stats(&stats);
+    if (fs_get_filesize(fd) != sizeof(model) || stats.blocks == 0 || stats.blocks > 8)
+        return FAIL;
+
+    /* random read in the second chunk */
+    fs_lseek(fd, 40000);
+    rtn = fs_read(fd, out, 1000);
+    if (rtn != 1000 || memcmp(out, model + 40000, 1000) != 0)
+        return FAIL;
+
+    /* overwrite across the chunk boundary with noise */
+    for (int i = 30000; i < 36000; i++)
+        model[i] = (char)(i * 7919 % 251);
+    fs_lseek(fd, 30000);
+    fs_write(fd, model + 30000, 6000);
+    fs_close(fd);
+    umount_fs("disk.21");
+
+    mount_fs("disk.21");
+    fd = fs_open("log.21");
+    rtn = fs_read(fd, out, sizeof(out));
+    if (rtn != sizeof(model) || memcmp(out, model, sizeof(model)) != 0)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+
+    /* truncating gives the blocks back */
+    fs_lseek(fd, 0);
+    fs_truncate(fd, 5000);
+    fs_frag_stats(&stats);
+    if (fs_get_filesize(fd) != 5000 || stats.blocks != 2)
+        return FAIL;
+    fs_lseek(fd, 0);
+    rtn = fs_read(fd, out, sizeof(out));
+    if (rtn != 5000 || memcmp(out, model, 5000) != 0)
+        return FAIL;
+    fs_close(fd);
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    umount_fs("disk.21");
+
+    return PASS;
+}
+
+
+//deduplication test
+//==============================================================================
+static int test22(void) {
+    int rtn, fd_a, fd_b, fd_c;
+    static char blocks[4 * BLOCK_SIZE], other[BLOCK_SIZE], out[4 * BLOCK_SIZE];
+    struct fs_space_stats stats;
+    struct fs_frag_stats frag;
+    struct fs_check_report report;
+
+    for (int i = 0; i < 4; i++)
+        memset(blocks + i * BLOCK_SIZE, 'a' + i, BLOCK_SIZE);
+    memset(other, 'z', BLOCK_SIZE);
+
+    make_fs_ext("disk.22", FS_FEATURE_DEDUP | FS_FEATURE_CHECKSUMS);
+    mount_fs("disk.22");
+    fs_create("a.22");
+    fs_create("b.22");
+    fs_create("c.22");
+    fd_a = fs_open("a.22");
+    fd_b = fs_open("b.22");
+    fd_c = fs_open("c.22");
+
+    /* b is a copy of a, c repeats one block of its own */
+    fs_write(fd_a, blocks, sizeof(blocks));
+    fs_write(fd_b, blocks, sizeof(blocks));
+    fs_write(fd_c, other, BLOCK_SIZE);
+    fs_write(fd_c, other, BLOCK_SIZE);
+    fs_space_stats(&stats);
+    if (stats.data_blocks != 10 || stats.physical_blocks != 5 || stats.shared_blocks != 5)
+        return FAIL;
+
+    /* rewriting a shared block leaves the other file alone */
+    fs_lseek(fd_b, 0);
+    fs_write(fd_b, other + 1, 1);
+    fs_space_stats(&stats);
+    if (stats.physical_blocks != 6 || stats.shared_blocks != 4)
+        return FAIL;
+
+    fs_close(fd_a);
+    fs_delete("a.22");
+    fs_lseek(fd_b, 0);
+    fs_truncate(fd_b, BLOCK_SIZE);
+    fs_space_stats(&stats);
+    if (stats.data_blocks != 3 || stats.physical_blocks != 2)
+        return FAIL;
+
+    /* both blocks of c are one physical block, which is not a run on disk */
+    fs_frag_stats(&frag);
+    if (frag.files != 2 || frag.extents != 3 || frag.fragmented_files != 1)
+        return FAIL;
+    /* and moving the FAT chain would not move them, so defrag leaves the disk alone */
+    if (fs_defrag(0) != -1 || fs_defrag_start(1000) != -1)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    fs_close(fd_b);
+    fs_close(fd_c);
+    umount_fs("disk.22");
+
+    mount_fs("disk.22");
+    fd_b = fs_open("b.22");
+    rtn = fs_read(fd_b, out, sizeof(out));
+    if (rtn != BLOCK_SIZE || out[0] != 'z' || out[1] != 'a' || out[BLOCK_SIZE - 1] != 'a')
+        return FAIL;
+    fs_close(fd_b);
+    fd_c = fs_open("c.22");
+    rtn = fs_read(fd_c, out, sizeof(out));
+    if (rtn != 2 * BLOCK_SIZE || out[0] != 'z' || out[2 * BLOCK_SIZE - 1] != 'z')
+        return FAIL;
+    fs_close(fd_c);
+    umount_fs("disk.22");
+
+    return PASS;
+}
+
+
+//snapshot test
+//==============================================================================
+/* the child of test23: mount the snapshot and check it holds the files as they were */
+static int check_snapshot23(void) {
+    static char out[3 * BLOCK_SIZE];
+    struct fs_check_report report;
+    int fd;
+
+    close_disk();
+    if (mount_snapshot("disk.23", "s1") != 0)
+        return FAIL;
+
+    fd = fs_open("keep.23");
+    if (fs_read(fd, out, sizeof(out)) != 3 * BLOCK_SIZE ||
+        out[0] != 'k' || out[3 * BLOCK_SIZE - 1] != 'k')
+        return FAIL;
+    /* nothing can be changed */
+    fs_lseek(fd, 0);
+    if (fs_write(fd, "x", 1) != -1 || fs_truncate(fd, 0) != -1)
+        return FAIL;
+    fs_close(fd);
+
+    fd = fs_open("gone.23");
+    if (fs_read(fd, out, sizeof(out)) != 2 * BLOCK_SIZE || out[BLOCK_SIZE] != 'g')
+        return FAIL;
+    fs_close(fd);
+    fd = fs_open("tiny.23");
+    if (fs_read(fd, out, sizeof(out)) != 50 || out[49] != 't')
+        return FAIL;
+    fs_close(fd);
+
+    if (fs_open("new.23") != -1 || fs_create("more.23") != -1 || fs_delete("keep.23") != -1)
+        return FAIL;
+    if (fs_check(1, 2, &report) != 0 || report.repaired != 0)
+        return FAIL;
+    umount_fs("disk.23");
+    return PASS;
+}
+
+static int test23(void) {
+    int fd_keep, fd_gone, fd_tiny, fd_new, status;
+    static char blocks[3 * BLOCK_SIZE], out[3 * BLOCK_SIZE];
+    struct fs_space_stats stats;
+    struct fs_check_report report;
+    pid_t pid;
+
+    make_fs_ext("disk.23", FS_FEATURE_SNAPSHOTS | FS_FEATURE_CHECKSUMS);
+    mount_fs("disk.23");
+    fs_create("keep.23");
+    fs_create("gone.23");
+    fs_create("tiny.23");
+    fd_keep = fs_open("keep.23");
+    fd_gone = fs_open("gone.23");
+    fd_tiny = fs_open("tiny.23");
+
+    memset(blocks, 'k', sizeof(blocks));
+    fs_write(fd_keep, blocks, 3 * BLOCK_SIZE);
+    memset(blocks, 'g', sizeof(blocks));
+    fs_write(fd_gone, blocks, 2 * BLOCK_SIZE);
+    memset(blocks, 't', sizeof(blocks));
+    fs_write(fd_tiny, blocks, 50);
+    fs_close(fd_gone);
+
+    if (fs_snapshot("s1") != 0 || fs_snapshot("s1") != -1)
+        return FAIL;
+    fs_space_stats(&stats);
+    if (stats.data_blocks != 5 || stats.physical_blocks != 5 || stats.shared_blocks != 5)
+        return FAIL;
+
+    /* change everything after the snapshot: the first block of keep is copied */
+    memset(blocks, 'x', sizeof(blocks));
+    fs_lseek(fd_keep, 0);
+    fs_write(fd_keep, blocks, BLOCK_SIZE);
+    fs_delete("gone.23");
+    fs_write(fd_tiny, blocks, 50);
+    fs_create("new.23");
+    fd_new = fs_open("new.23");
+    fs_write(fd_new, blocks, BLOCK_SIZE);
+    fs_space_stats(&stats);
+    if (stats.data_blocks != 4 || stats.physical_blocks != 7 || stats.shared_blocks != 2)
+        return FAIL;
+
+    /* the snapshot can be read by another process while the file system is mounted */
+    pid = fork();
+    if (pid == 0)
+        _exit(check_snapshot23() == PASS ? 0 : 1);
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return FAIL;
+
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    if (fs_snapshot_delete("s1") != 0 || fs_snapshot_delete("s1") != -1)
+        return FAIL;
+    fs_space_stats(&stats);
+    if (stats.physical_blocks != 4 || stats.shared_blocks != 0)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    fs_close(fd_keep);
+    fs_close(fd_tiny);
+    fs_close(fd_new);
+    umount_fs("disk.23");
+
+    mount_fs("disk.23");
+    fd_keep = fs_open("keep.23");
+    if (fs_read(fd_keep, out, sizeof(out)) != 3 * BLOCK_SIZE ||
+        out[0] != 'x' || out[BLOCK_SIZE] != 'k')
+        return FAIL;
+    fs_close(fd_keep);
+    umount_fs("disk.23");
+    if (mount_snapshot("disk.23", "s1") != -1)
+        return FAIL;
+
+    return PASS;
+}
+
+
+//file copy test
+//==============================================================================
+static int test24(void) {
+    int rtn, fd_a, fd_b, fd_c;
+    static char model[3 * BLOCK_SIZE + 100], out[6 * BLOCK_SIZE];
+    struct fs_space_stats stats;
+    struct fs_check_report report;
+
+    for (int i = 0; i < sizeof(model); i++)
+        model[i] = (char)(i * 31 % 253);
+
+    /* without a block map the blocks are copied */
+    make_fs("disk.24");
+    mount_fs("disk.24");
+    fs_create("a.24");
+    fs_create("b.24");
+    fs_create("c.24");
+    fd_a = fs_open("a.24");
+    fd_b = fs_open("b.24");
+    fd_c = fs_open("c.24");
+    fs_write(fd_a, model, sizeof(model));
+
+    if (fs_copy_file("a.24", "copy.24") != 0 || fs_copy_file("a.24", "copy.24") != -1 ||
+        fs_copy_file("none.24", "other.24") != -1)
+        return FAIL;
+    fd_b = fs_open("copy.24");
+    rtn = fs_read(fd_b, out, sizeof(out));
+    if (rtn != sizeof(model) || memcmp(out, model, sizeof(model)) != 0)
+        return FAIL;
+    fs_close(fd_b);
+
+    /* aligned whole blocks, then an unaligned range with a partial block */
+    fd_b = fs_open("b.24");
+    if (fs_copy_range(fd_a, BLOCK_SIZE, fd_c, 0, 2 * BLOCK_SIZE) != 2 * BLOCK_SIZE)
+        return FAIL;
+    if (fs_copy_range(fd_a, 10, fd_b, 0, 5000) != 5000 ||
+        fs_copy_range(fd_a, 3 * BLOCK_SIZE, fd_b, 5000, 1000) != 100)
+        return FAIL;
+    if (fs_copy_range(fd_a, 0, fd_a, 100, 200) != -1 || fs_copy_range(fd_a, 0, fd_c, 9 * BLOCK_SIZE, 1) != -1)
+        return FAIL;
+    rtn = fs_read(fd_c, out, sizeof(out));
+    if (rtn != 2 * BLOCK_SIZE || memcmp(out, model + BLOCK_SIZE, 2 * BLOCK_SIZE) != 0)
+        return FAIL;
+    rtn = fs_read(fd_b, out, sizeof(out));
+    if (rtn != 5100 || memcmp(out, model + 10, 5000) != 0 || memcmp(out + 5000, model + 3 * BLOCK_SIZE, 100) != 0)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    umount_fs("disk.24");
+
+    /* with a block map the copy shares the blocks until one of them is written */
+    make_fs_ext("disk.24", FS_FEATURE_SNAPSHOTS | FS_FEATURE_CHECKSUMS);
+    mount_fs("disk.24");
+    fs_create("a.24");
+    fd_a = fs_open("a.24");
+    fs_write(fd_a, model, sizeof(model));
+    if (fs_copy_file("a.24", "copy.24") != 0)
+        return FAIL;
+    fs_space_stats(&stats);
+    if (stats.data_blocks != 8 || stats.physical_blocks != 4 || stats.shared_blocks != 4)
+        return FAIL;
+
+    fd_b = fs_open("copy.24");
+    fs_write(fd_b, "x", 1);
+    fs_space_stats(&stats);
+    if (stats.physical_blocks != 5 || stats.shared_blocks != 3)
+        return FAIL;
+    if (fs_copy_range(fd_a, 0, fd_b, 3 * BLOCK_SIZE, 2 * BLOCK_SIZE) != 2 * BLOCK_SIZE)
+        return FAIL;
+    fs_space_stats(&stats);
+    if (stats.data_blocks != 9 || stats.physical_blocks != 5)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    fs_close(fd_b);
+    umount_fs("disk.24");
+
+    mount_fs("disk.24");
+    fd_b = fs_open("copy.24");
+    rtn = fs_read(fd_b, out, sizeof(out));
+    if (rtn != 5 * BLOCK_SIZE || out[0] != 'x' || memcmp(out + 1, model + 1, 3 * BLOCK_SIZE - 1) != 0 ||
+        memcmp(out + 3 * BLOCK_SIZE, model, 2 * BLOCK_SIZE) != 0)
+        return FAIL;
+    fs_close(fd_b);
+    fd_a = fs_open("a.24");
+    rtn = fs_read(fd_a, out, sizeof(out));
+    if (rtn != sizeof(model) || memcmp(out, model, sizeof(model)) != 0)
+        return FAIL;
+    fs_close(fd_a);
+    umount_fs("disk.24");
+
+    return PASS;
+}
+
+
+//asynchronous I/O test
+//==============================================================================
+static int test25(void) {
+    static struct fs_aio_req reqs[FS_AIO_DEPTH];
+    static char blocks[8][BLOCK_SIZE], out[8][BLOCK_SIZE];
+    struct fs_aio_req *done[FS_AIO_DEPTH];
+    struct pollfd pfd;
+    struct fs_check_report report;
+    int efd, n, fd, fd_small;
+
+    make_fs("disk.25");
+    mount_fs("disk.25");
+    fs_create("async.25");
+    efd = fs_aio_setup();
+    if (efd < 0 || fs_aio_setup() != -1)
+        return FAIL;
+
+    reqs[0].op = FS_AIO_OPEN;
+    reqs[0].name = "async.25";
+    if (fs_aio_submit(&reqs[0]) != 0 || fs_aio_reap(done, 1, 1) != 1 || done[0]->rtn < 0)
+        return FAIL;
+    fd = done[0]->rtn;
+
+    /* eight appends in flight at once, completed in order */
+    for (int i = 0; i < 8; i++) {
+        memset(blocks[i], 'a' + i, BLOCK_SIZE);
+        reqs[i].op = FS_AIO_WRITE;
+        reqs[i].fildes = fd;
+        reqs[i].buf = blocks[i];
+        reqs[i].nbyte = BLOCK_SIZE;
+        reqs[i].offset = -1;
+        reqs[i].user_data = &blocks[i];
+        if (fs_aio_submit(&reqs[i]) != 0)
+            return FAIL;
+    }
+    for (n = 0; n < 8; ) {
+        pfd.fd = efd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 1000) != 1)
+            return FAIL;
+        int got = fs_aio_reap(done, FS_AIO_DEPTH, 0);
+        for (int i = 0; i < got; i++)
+            if (done[i] != &reqs[n + i] || done[i]->rtn != BLOCK_SIZE || done[i]->user_data != &blocks[n + i])
+                return FAIL;
+        n += got;
+    }
+    /* nothing left: the eventfd is not readable */
+    pfd.fd = efd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) != 0 || fs_aio_reap(done, 1, 1) != 0)
+        return FAIL;
+
+    /* positional reads, backwards, do not move the offset */
+    for (int i = 0; i < 8; i++) {
+        reqs[i].op = FS_AIO_READ;
+        reqs[i].buf = out[i];
+        reqs[i].offset = (7 - i) * BLOCK_SIZE;
+        fs_aio_submit(&reqs[i]);
+    }
+    for (n = 0; n < 8; )
+        n += fs_aio_reap(done + n, 8 - n, 1);
+    for (int i = 0; i < 8; i++)
+        if (reqs[i].rtn != BLOCK_SIZE || memcmp(out[i], blocks[7 - i], BLOCK_SIZE) != 0)
+            return FAIL;
+    if (fs_read(fd, out[0], 1) != 0)
+        return FAIL;
+
+    /* a write past the end would leave a hole, it fails like fs_lseek */
+    reqs[0].op = FS_AIO_WRITE;
+    reqs[0].buf = blocks[1];
+    reqs[0].nbyte = 100;
+    reqs[0].offset = 9 * BLOCK_SIZE;
+    if (fs_aio_submit(&reqs[0]) != 0 || fs_aio_reap(done, 1, 1) != 1 || reqs[0].rtn != -1)
+        return FAIL;
+    reqs[0].op = FS_AIO_READ;
+    reqs[0].buf = out[0];
+    reqs[0].offset = 0;
+    if (fs_aio_submit(&reqs[0]) != 0 || fs_aio_reap(done, 1, 1) != 1 || reqs[0].rtn != 100 ||
+        out[0][0] != 'a' || fs_get_filesize(fd) != 8 * BLOCK_SIZE)
+        return FAIL;
+
+    /* the same after a truncate, the old content of an inline file does not come back */
+    fs_create("small.25");
+    fd_small = fs_open("small.25");
+    fs_write(fd_small, "SECRETSECRET", 12);
+    fs_truncate(fd_small, 0);
+    reqs[0].op = FS_AIO_WRITE;
+    reqs[0].fildes = fd_small;
+    reqs[0].buf = "BBBB";
+    reqs[0].nbyte = 4;
+    reqs[0].offset = 10;
+    reqs[1] = reqs[0];
+    reqs[1].offset = 0;
+    fs_aio_submit(&reqs[0]);
+    fs_aio_submit(&reqs[1]);
+    for (n = 0; n < 2; )
+        n += fs_aio_reap(done + n, 2 - n, 1);
+    if (reqs[0].rtn != -1 || reqs[1].rtn != 4 || fs_get_filesize(fd_small) != 4)
+        return FAIL;
+    fs_lseek(fd_small, 0);
+    if (fs_read(fd_small, out[0], BLOCK_SIZE) != 4 || memcmp(out[0], "BBBB", 4) != 0)
+        return FAIL;
+    fs_close(fd_small);
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+
+    reqs[0].op = FS_AIO_CLOSE;
+    reqs[0].fildes = fd;
+    reqs[1].op = FS_AIO_READ;
+    reqs[1].fildes = fd;
+    reqs[1].buf = out[1];
+    reqs[1].offset = 0;
+    fs_aio_submit(&reqs[0]);
+    fs_aio_submit(&reqs[1]);
+    if (fs_aio_teardown() != 0 || fs_aio_submit(&reqs[0]) != -1)
+        return FAIL;
+    if (reqs[0].rtn != 0 || reqs[1].rtn != -1)
+        return FAIL;
+    umount_fs("disk.25");
+
+    return PASS;
+}
+
+
+//write-back test
+//==============================================================================
+static int test26(void) {
+    int fd_a, fd_b, raw;
+    static char block[BLOCK_SIZE], out[16 * BLOCK_SIZE], disk_block[BLOCK_SIZE];
+    struct fs_writeback_stats stats;
+    struct fs_check_report report;
+
+    make_fs("disk.26");
+    mount_fs("disk.26");
+    if (fs_writeback_tune(101, 10) != -1 || fs_writeback_tune(50, 0) != -1)
+        return FAIL;
+    /* nothing is written in the background for a while */
+    fs_writeback_tune(50, 60000);
+    fs_create("a.26");
+    fs_create("b.26");
+    fd_a = fs_open("a.26");
+    fd_b = fs_open("b.26");
+
+    /* two files appended in turn get alternating blocks, written out in one sweep
+       (fewer than the 16 operations after which the journal commits, which flushes) */
+    for (int i = 0; i < 6; i++) {
+        memset(block, 'a' + i, BLOCK_SIZE);
+        fs_write(fd_a, block, BLOCK_SIZE);
+        memset(block, 'A' + i, BLOCK_SIZE);
+        fs_write(fd_b, block, BLOCK_SIZE);
+    }
+    fs_writeback_stats(&stats);
+    if (stats.dirty_blocks != 12 || stats.blocks_written != 0)
+        return FAIL;
+
+    /* the buffered blocks are read back before they reach the disk */
+    raw = open("disk.26", O_RDONLY);
+    pread(raw, disk_block, BLOCK_SIZE, (off_t)(4096 + 1) * BLOCK_SIZE);
+    fs_lseek(fd_a, 0);
+    if (fs_read(fd_a, out, sizeof(out)) != 6 * BLOCK_SIZE || out[5 * BLOCK_SIZE] != 'f' ||
+        disk_block[0] == 'a')
+        return FAIL;
+
+    fs_sync();
+    fs_writeback_stats(&stats);
+    if (stats.dirty_blocks != 0 || stats.blocks_written != 12 || stats.writes != 1 || stats.flushes != 1)
+        return FAIL;
+    pread(raw, disk_block, BLOCK_SIZE, (off_t)(4096 + 1) * BLOCK_SIZE);
+    if (disk_block[0] != 'a')
+        return FAIL;
+
+    /* a dirty block is written once it is old enough */
+    fs_writeback_tune(50, 20);
+    fs_lseek(fd_b, BLOCK_SIZE);
+    fs_write(fd_b, "z", 1);
+    for (int i = 0; i < 100 && (stats.flushes != 2 || stats.dirty_blocks != 0); i++) {
+        usleep(10000);
+        fs_writeback_stats(&stats);
+    }
+    if (stats.dirty_blocks != 0 || stats.flushes != 2)
+        return FAIL;
+    close(raw);
+
+    /* write-through */
+    fs_writeback_tune(0, 20);
+    fs_write(fd_b, "y", 1);
+    fs_writeback_stats(&stats);
+    if (stats.dirty_blocks != 0)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    fs_close(fd_a);
+    fs_close(fd_b);
+    umount_fs("disk.26");
+
+    mount_fs("disk.26");
+    fd_b = fs_open("b.26");
+    if (fs_read(fd_b, out, sizeof(out)) != 6 * BLOCK_SIZE || out[0] != 'A' ||
+        out[BLOCK_SIZE] != 'z' || out[BLOCK_SIZE + 1] != 'y' || out[BLOCK_SIZE + 2] != 'B')
+        return FAIL;
+    fs_close(fd_b);
+    umount_fs("disk.26");
+
+    return PASS;
+}
+
+
+//delayed allocation test
+//==============================================================================
+static int test27(void) {
+    int fd_a, fd_b, fd_c;
+    static char buf[1000], out[24 * 1000];
+    struct fs_space_stats space;
+    struct fs_frag_stats frag;
+    struct fs_check_report report;
+
+    make_fs("disk.27");
+    mount_fs_ext("disk.27", MOUNT_DELALLOC);
+    fs_create("a.27");
+    fs_create("b.27");
+    fs_create("c.27");
+    fd_a = fs_open("a.27");
+    fd_b = fs_open("b.27");
+    fd_c = fs_open("c.27");
+    /* the journal commits (which writes everything out) once metadata stays dirty long enough */
+    fs_sync();
+
+    /* appends in turn take no blocks until they are written out */
+    fs_space_stats(&space);
+    int free_before = space.free_blocks;
+    for (int i = 0; i < 12; i++) {
+        memset(buf, 'a' + i, sizeof(buf));
+        fs_write(fd_a, buf, sizeof(buf));
+        memset(buf, 'A' + i, sizeof(buf));
+        fs_write(fd_b, buf, sizeof(buf));
+        fs_write(fd_c, buf, sizeof(buf));
+    }
+    fs_space_stats(&space);
+    if (space.free_blocks != free_before || fs_get_filesize(fd_a) != 12 * 1000)
+        return FAIL;
+
+    /* a file deleted before it is written out never takes blocks */
+    fs_close(fd_c);
+    if (fs_delete("c.27") != 0)
+        return FAIL;
+
+    /* then each file gets one extent */
+    fs_sync();
+    fs_space_stats(&space);
+    fs_frag_stats(&frag);
+    if (space.free_blocks != free_before - 6 || frag.files != 2 || frag.fragmented_files != 0)
+        return FAIL;
+
+    fs_lseek(fd_b, 0);
+    if (fs_read(fd_b, out, sizeof(out)) != 12 * 1000 || out[0] != 'A' || out[11 * 1000] != 'L')
+        return FAIL;
+    /* reading a file writes it out first */
+    fs_write(fd_a, "z", 1);
+    fs_lseek(fd_a, 0);
+    if (fs_read(fd_a, out, sizeof(out)) != 12 * 1000 + 1 || out[1000] != 'b' || out[12 * 1000] != 'z')
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    fs_close(fd_a);
+    fs_close(fd_b);
+    umount_fs("disk.27");
+
+    mount_fs("disk.27");
+    fd_a = fs_open("a.27");
+    if (fs_get_filesize(fd_a) != 12 * 1000 + 1 || fs_read(fd_a, out, 1) != 1 || out[0] != 'a')
+        return FAIL;
+    fs_close(fd_a);
+    umount_fs("disk.27");
+
+    return PASS;
+}
+
+
+//descriptor table test
+//==============================================================================
+static int test28(void) {
+    static int fd[2000];
+    int fd_b;
+    char c;
+
+    make_fs("disk.28");
+    mount_fs("disk.28");
+    fs_create("a.28");
+    fd[0] = fs_open("a.28");
+    fs_write(fd[0], "0123456789", 10);
+    fs_close(fd[0]);
+
+    /* far more than 32 descriptors, all on one file, each with its own offset */
+    for (int i = 0; i < 2000; i++) {
+        fd[i] = fs_open("a.28");
+        if (fd[i] < 0)
+            return FAIL;
+        fs_lseek(fd[i], i % 10);
+    }
+    if (fs_delete("a.28") != -1)
+        return FAIL;
+    for (int i = 0; i < 2000; i++) {
+        if (fs_read(fd[i], &c, 1) != 1 || c != '0' + i % 10)
+            return FAIL;
+    }
+
+    /* a file created while others are open does not take their entry */
+    fs_create("b.28");
+    fd_b = fs_open("b.28");
+    fs_write(fd_b, "b", 1);
+    fs_lseek(fd[5], 0);
+    if (fs_read(fd[5], &c, 1) != 1 || c != '0')
+        return FAIL;
+
+    /* closed descriptors are handed out again */
+    fs_close(fd[1000]);
+    if (fs_open("a.28") != fd[1000] || fs_close(fd[1000]) != 0 || fs_close(fd[1000]) != -1)
+        return FAIL;
+    for (int i = 0; i < 2000; i++) {
+        if (i != 1000 && fs_close(fd[i]) != 0)
+            return FAIL;
+    }
+    fs_close(fd_b);
+    if (fs_delete("a.28") != 0 || fs_open("a.28") != -1)
+        return FAIL;
+    umount_fs("disk.28");
+
+    /* closed files are kept by a new mount */
+    mount_fs("disk.28");
+    if (fs_create("c.28") != 0)
+        return FAIL;
+    fd_b = fs_open("b.28");
+    if (fd_b < 0 || fs_read(fd_b, &c, 1) != 1 || c != 'b')
+        return FAIL;
+    fs_close(fd_b);
+    umount_fs("disk.28");
+
+    return PASS;
+}
+
+
+//directory and dentry cache test
+//==============================================================================
+static int test29(void) {
+    int fd;
+    char buf[16];
+    struct fs_dcache_stats stats;
+    struct fs_check_report report;
+
+    make_fs("disk.29");
+    mount_fs("disk.29");
+
+    /* each component of a path can use the full name length */
+    if (fs_mkdir("projects-2024-q") != 0 || fs_mkdir("/projects-2024-q/service-alpha") != 0 ||
+        fs_mkdir("projects-2024-q/service-alpha/logs") != 0)
+        return FAIL;
+    if (fs_mkdir("missing/logs") != -1 || fs_mkdir("projects-2024-q") != -1 ||
+        fs_create("projects-2024-q/service-alpha/logs/a/b") != -1)
+        return FAIL;
+    if (fs_create("projects-2024-q/service-alpha/logs/current.log") != 0 ||
+        fs_create("current.log") != 0)
+        return FAIL;
+
+    fd = fs_open("/projects-2024-q/service-alpha/logs/current.log");
+    fs_write(fd, "nested", 6);
+    fs_close(fd);
+    fd = fs_open("current.log");
+    fs_write(fd, "root", 4);
+    fs_close(fd);
+
+    /* opening the same deep path again is served by the cache, only the first lookup of
+       the missing name scans the directory */
+    fs_dcache_stats(&stats);
+    long misses = stats.misses;
+    for (int i = 0; i < 10; i++) {
+        fd = fs_open("projects-2024-q/service-alpha/logs/current.log");
+        fs_close(fd);
+        if (fs_open("projects-2024-q/service-alpha/logs/old.log") != -1)
+            return FAIL;
+    }
+    fs_dcache_stats(&stats);
+    if (stats.misses != misses + 1 || stats.hits < 40 || stats.negative_hits < 9)
+        return FAIL;
+
+    /* a name created after it was looked up is found */
+    if (fs_create("projects-2024-q/service-alpha/logs/old.log") != 0 ||
+        fs_open("projects-2024-q/service-alpha/logs/old.log") < 0)
+        return FAIL;
+
+    if (fs_open("projects-2024-q") != -1 || fs_delete("projects-2024-q/service-alpha") != -1 ||
+        fs_rmdir("projects-2024-q/service-alpha/logs") != -1)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    umount_fs("disk.29");
+
+    mount_fs("disk.29");
+    fd = fs_open("projects-2024-q/service-alpha/logs/current.log");
+    if (fd < 0 || fs_read(fd, buf, sizeof(buf)) != 6 || memcmp(buf, "nested", 6) != 0)
+        return FAIL;
+    fs_close(fd);
+    if (fs_delete("projects-2024-q/service-alpha/logs/current.log") != 0 ||
+        fs_delete("projects-2024-q/service-alpha/logs/old.log") != 0 ||
+        fs_rmdir("projects-2024-q/service-alpha/logs") != 0 ||
+        fs_open("projects-2024-q/service-alpha/logs/current.log") != -1)
+        return FAIL;
+    fd = fs_open("current.log");
+    if (fd < 0 || fs_read(fd, buf, sizeof(buf)) != 4 || memcmp(buf, "root", 4) != 0)
+        return FAIL;
+    fs_close(fd);
+    umount_fs("disk.29");
+
+    return PASS;
+}
+
+
+//stat test
+//==============================================================================
+static int test30(void) {
+    int fd, cursor, n, total, sizes;
+    char name[17];
+    static char buf[3 * BLOCK_SIZE];
+    struct fs_stat st, batch[3];
+
+    make_fs("disk.30");
+    mount_fs("disk.30");
+    fs_mkdir("data");
+    for (int i = 0; i < 7; i++) {
+        snprintf(name, sizeof(name), "f%d", i);
+        fs_create(name);
+    }
+    fs_create("data/big");
+    fd = fs_open("data/big");
+    fs_write(fd, buf, sizeof(buf));
+    fs_close(fd);
+    fd = fs_open("f3");
+    fs_write(fd, "abc", 3);
+    fs_close(fd);
+
+    /* stat needs no open file */
+    if (fs_stat("data/big", &st) != 0 || strcmp(st.name, "big") != 0 || st.size != 3 * BLOCK_SIZE ||
+        st.blocks != 3 || st.is_dir)
+        return FAIL;
+    if (fs_stat("f3", &st) != 0 || st.size != 3 || st.blocks != 0 || fs_stat("data/none", &st) != -1)
+        return FAIL;
+    if (fs_stat("/data", &st) != 0 || !st.is_dir)
+        return FAIL;
+
+    /* the root in batches of 3: 7 files and one directory */
+    cursor = 0;
+    total = 0;
+    sizes = 0;
+    while ((n = fs_readdir("/", &cursor, batch, 3)) > 0) {
+        if (n > 3)
+            return FAIL;
+        for (int i = 0; i < n; i++) {
+            sizes += batch[i].size;
+            if (batch[i].is_dir && strcmp(batch[i].name, "data") != 0)
+                return FAIL;
+        }
+        total += n;
+    }
+    if (n != 0 || total != 8 || sizes != 3)
+        return FAIL;
+
+    cursor = 0;
+    if (fs_readdir("data", &cursor, batch, 3) != 1 || batch[0].blocks != 3 ||
+        fs_readdir("data", &cursor, batch, 3) != 0)
+        return FAIL;
+    cursor = 0;
+    if (fs_readdir("f3", &cursor, batch, 3) != -1 || fs_readdir("none", &cursor, batch, 3) != -1)
+        return FAIL;
+    umount_fs("disk.30");
+
+    return PASS;
+}
+
+
+//no allocation on the I/O path test
+//==============================================================================
+static int test31(void) {
+    int fd;
+    static char buf[512 * BLOCK_SIZE], out[512 * BLOCK_SIZE];
+
+    for (int i = 0; i < sizeof(buf); i++)
+        buf[i] = i % 251;
+    make_fs("disk.31");
+    mount_fs("disk.31");
+    fs_create("big.31");
+    fs_create("small.31");
+    umount_fs("disk.31");
+    /* metadata blocks are read while the files are written */
+    mount_fs_ext("disk.31", MOUNT_LAZY);
+    fd = fs_open("small.31");
+    fs_write(fd, "warm up", 7);
+    fs_close(fd);
+    fd = fs_open("big.31");
+
+    /* a large write, reads, a partial overwrite and truncates allocate nothing */
+    counting_allocs = 1;
+    if (fs_write(fd, buf, sizeof(buf)) != sizeof(buf))
+        return FAIL;
+    fs_lseek(fd, 10);
+    fs_write(fd, "xyz", 3);
+    fs_lseek(fd, 0);
+    if (fs_read(fd, out, sizeof(out)) != sizeof(out))
+        return FAIL;
+    if (fs_truncate(fd, 100 * BLOCK_SIZE + 5) != 0 || fs_write(fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        return FAIL;
+    fs_sync();
+    counting_allocs = 0;
+    if (num_allocs != 0)
+        return FAIL;
+
+    /* the truncated file keeps its head and the tail written after it */
+    if (fs_get_filesize(fd) != 101 * BLOCK_SIZE + 5)
+        return FAIL;
+    fs_lseek(fd, 0);
+    memset(out, 0, sizeof(out));
+    if (fs_read(fd, out, sizeof(out)) != 101 * BLOCK_SIZE + 5 || memcmp(out + 10, "xyz", 3) != 0 ||
+        memcmp(out + 13, buf + 13, 100 * BLOCK_SIZE + 5 - 13) != 0 ||
+        memcmp(out + 100 * BLOCK_SIZE + 5, buf, BLOCK_SIZE) != 0)
+        return FAIL;
+    if (fs_truncate(fd, 0) != 0 || fs_get_filesize(fd) != 0)
+        return FAIL;
+    fs_close(fd);
+    umount_fs("disk.31");
+
+    return PASS;
+}
+
+
+//direct I/O test
+//==============================================================================
+static int test32(void) {
+    int fd, fd2, supported;
+    static char buf[3 * BLOCK_SIZE + 1], out[3 * BLOCK_SIZE + 1];
+
+    for (int i = 0; i < sizeof(buf); i++)
+        buf[i] = i % 253;
+    make_fs("disk.32");
+    /* O_DIRECT is used when the host file system has it */
+    fd = open("disk.32", O_RDWR | O_DIRECT);
+    supported = fd >= 0;
+    if (fd >= 0)
+        close(fd);
+
+    if (mount_fs_ext("disk.32", MOUNT_DIRECT) != 0 || disk_direct() != supported)
+        return FAIL;
+    fs_create("a.32");
+    fs_create("b.32");
+    fd = fs_open("a.32");
+    fd2 = fs_open("b.32");
+    /* unaligned buffers of the caller and of the library go through a bounce buffer */
+    if (fs_write(fd, buf + 1, sizeof(buf) - 1) != sizeof(buf) - 1)
+        return FAIL;
+    if (fs_copy_range(fd, 0, fd2, 0, sizeof(buf) - 1) != sizeof(buf) - 1)
+        return FAIL;
+    fs_sync();
+    fs_lseek(fd, 0);
+    if (fs_read(fd, out + 1, sizeof(out) - 1) != sizeof(out) - 1 || memcmp(out + 1, buf + 1, sizeof(buf) - 1) != 0)
+        return FAIL;
+    fs_close(fd);
+    fs_close(fd2);
+    umount_fs("disk.32");
+    if (disk_direct() != 0)
+        return FAIL;
+
+    /* what was written directly is read back through the page cache */
+    mount_fs("disk.32");
+    if (disk_direct() != 0)
+        return FAIL;
+    fd = fs_open("b.32");
+    memset(out, 0, sizeof(out));
+    if (fs_read(fd, out, sizeof(out)) != sizeof(out) - 1 || memcmp(out, buf + 1, sizeof(buf) - 1) != 0)
+        return FAIL;
+    fs_close(fd);
+    umount_fs("disk.32");
+
+    return PASS;
+}
+
+
+//striped disk test
+//==============================================================================
+static int test33(void) {
+    int fd, f, found = 0;
+    static char buf[40 * BLOCK_SIZE], out[40 * BLOCK_SIZE], raw[BLOCK_SIZE];
+    char *bufs[40], *outs[40];
+    char *disks = "disk.33,disk.33.1,disk.33.2";
+
+    for (int i = 0; i < sizeof(buf); i++)
+        buf[i] = i % 247 + 1;
+    if (make_fs(disks) != 0 || mount_fs(disks) != 0 || disk_members() != 3)
+        return FAIL;
+    fs_create("big.33");
+    fd = fs_open("big.33");
+    if (fs_write(fd, buf, sizeof(buf)) != sizeof(buf))
+        return FAIL;
+    fs_close(fd);
+    umount_fs(disks);
+
+    /* the data region is shared by the image files, the other ones hold data */
+    f = open("disk.33.2", O_RDONLY);
+    if (f < 0 || lseek(f, 0, SEEK_END) != (off_t)1365 * BLOCK_SIZE)
+        return FAIL;
+    for (off_t pos = 0; pos < 1365 && !found; pos++) {
+        pread(f, raw, BLOCK_SIZE, pos * BLOCK_SIZE);
+        for (int i = 0; i < 40 && !found; i++)
+            found = memcmp(raw, buf + i * BLOCK_SIZE, BLOCK_SIZE) == 0;
+    }
+    close(f);
+    if (!found)
+        return FAIL;
+
+    /* only the whole list mounts */
+    if (mount_fs("disk.33") != -1 || mount_fs("disk.33,disk.33.2,disk.33.1,disk.33.1") != -1)
+        return FAIL;
+    if (mount_fs(disks) != 0)
+        return FAIL;
+    fd = fs_open("big.33");
+    if (fs_read(fd, out, sizeof(out)) != sizeof(out) || memcmp(out, buf, sizeof(buf)) != 0)
+        return FAIL;
+    fs_close(fd);
+    umount_fs(disks);
+    remove("disk.33.1");
+    remove("disk.33.2");
+
+    /* the disk itself: striped from the block it is given, read back at once */
+    if (make_disk_ext("disk.33,disk.33.1", 8) != 0 || open_disk_ext("disk.33,disk.33.1", 0, 8) != 0)
+        return FAIL;
+    for (int i = 0; i < 40; i++) {
+        bufs[i] = buf + i * BLOCK_SIZE;
+        outs[i] = out + i * BLOCK_SIZE;
+    }
+    memset(out, 0, sizeof(out));
+    if (block_writev(0, bufs, 40) != 0 || block_readv(0, outs, 40) != 0 || memcmp(out, buf, sizeof(buf)) != 0)
+        return FAIL;
+    close_disk();
+    f = open("disk.33.1", O_RDONLY);
+    pread(f, raw, BLOCK_SIZE, 0);
+    close(f);
+    if (memcmp(raw, buf + 9 * BLOCK_SIZE, BLOCK_SIZE) != 0)
+        return FAIL;
+    remove("disk.33.1");
+
+    return PASS;
+}
+
+
+//allocation group test
+//==============================================================================
+/* two writers appending in turn, see test34 */
+static pthread_mutex_t turn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  turn_cond  = PTHREAD_COND_INITIALIZER;
+static int turn;
+
+static void *turn_writer(void *arg) {
+    int me = *(int *)arg;
+    char buf[BLOCK_SIZE];
+    int fd = fs_open(me == 0 ? "a.34" : "b.34");
+
+    for (int i = 0; i < 32; i++) {
+        pthread_mutex_lock(&turn_mutex);
+        while (turn % 2 != me)
+            pthread_cond_wait(&turn_cond, &turn_mutex);
+        memset(buf, 'a' + me, sizeof(buf));
+        buf[0] = i;
+        fs_write(fd, buf, sizeof(buf));
+        turn++;
+        pthread_cond_broadcast(&turn_cond);
+        pthread_mutex_unlock(&turn_mutex);
+    }
+    fs_close(fd);
+    return NULL;
+}
+
+static int test34(void) {
+    pthread_t threads[2];
+    int ids[2] = {0, 1};
+    char out[32 * BLOCK_SIZE];
+    struct fs_frag_stats stats;
+
+    make_fs("disk.34");
+    mount_fs("disk.34");
+    fs_create("a.34");
+    fs_create("b.34");
+
+    /* each thread allocates from its own group, so the files do not interleave */
+    for (int i = 0; i < 2; i++)
+        pthread_create(&threads[i], NULL, turn_writer, &ids[i]);
+    for (int i = 0; i < 2; i++)
+        pthread_join(threads[i], NULL);
+    fs_frag_stats(&stats);
+    if (stats.files != 2 || stats.fragmented_files != 0)
+        return FAIL;
+    umount_fs("disk.34");
+
+    mount_fs("disk.34");
+    for (int f = 0; f < 2; f++) {
+        int fd = fs_open(f == 0 ? "a.34" : "b.34");
+        if (fs_read(fd, out, sizeof(out)) != sizeof(out))
+            return FAIL;
+        for (int i = 0; i < 32; i++) {
+            if (out[i * BLOCK_SIZE] != i || out[i * BLOCK_SIZE + 1] != 'a' + f)
+                return FAIL;
+        }
+        fs_close(fd);
+    }
+    umount_fs("disk.34");
+
+    return PASS;
+}
+
+
+//fallocate test
+//==============================================================================
+static int test35(void) {
+    int fd, fd_b;
+    static char buf[BLOCK_SIZE], out[64 * BLOCK_SIZE];
+    struct fs_stat st;
+    struct fs_frag_stats stats;
+    struct fs_check_report report;
+
+    make_fs_ext("disk.35", FS_FEATURE_CHECKSUMS);
+    mount_fs("disk.35");
+
+    /* the reserved blocks held another file before */
+    memset(buf, 'x', sizeof(buf));
+    fs_create("junk.35");
+    fd = fs_open("junk.35");
+    for (int i = 0; i < 8; i++)
+        fs_write(fd, buf, sizeof(buf));
+    fs_close(fd);
+    fs_delete("junk.35");
+
+    fs_create("a.35");
+    fs_create("b.35");
+    fd = fs_open("a.35");
+    fd_b = fs_open("b.35");
+    if (fs_fallocate(fd, 0, 64 * BLOCK_SIZE) != 0 || fs_fallocate(fd, BLOCK_SIZE, BLOCK_SIZE) != 0)
+        return FAIL;
+    if (fs_stat("a.35", &st) != 0 || st.size != 0 || st.blocks != 64)
+        return FAIL;
+    if (fs_fallocate(fd_b, 0, 8192 * BLOCK_SIZE) != -1 || fs_stat("b.35", &st) != 0 || st.blocks != 0)
+        return FAIL;
+
+    /* appends in turn with another file no longer interleave the two */
+    for (int i = 0; i < 60; i++) {
+        memset(buf, i, sizeof(buf));
+        fs_write(fd, buf, i == 59 ? 100 : sizeof(buf));
+        fs_write(fd_b, buf, sizeof(buf));
+    }
+    fs_frag_stats(&stats);
+    if (stats.files != 2 || stats.fragmented_files != 0)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    fs_close(fd_b);
+    umount_fs("disk.35");
+
+    mount_fs("disk.35");
+    fd = fs_open("a.35");
+    if (fs_read(fd, out, sizeof(out)) != 59 * BLOCK_SIZE + 100)
+        return FAIL;
+    for (int i = 0; i < 60; i++) {
+        if (out[i * BLOCK_SIZE] != i || out[i * BLOCK_SIZE + 99] != i)
+            return FAIL;
+    }
+
+    /* truncate gives back what is past the end */
+    if (fs_truncate(fd, 59 * BLOCK_SIZE + 100) != 0 || fs_stat("a.35", &st) != 0 || st.blocks != 60)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    fs_close(fd);
+    umount_fs("disk.35");
+
+    return PASS;
+}
+
+
+//log-structured mode test
+//==============================================================================
+static int test36(void) {
+    int fd, f, found[3] = {-1, -1, -1};
+    unsigned seed = 36;
+    static char model[256 * BLOCK_SIZE], out[256 * BLOCK_SIZE], raw[BLOCK_SIZE];
+    char small[100];
+    struct fs_log_stats stats;
+    struct fs_space_stats space;
+    struct fs_check_report report;
+
+    for (int i = 0; i < sizeof(model); i++)
+        model[i] = i % 241;
+    make_fs_ext("disk.36", FS_FEATURE_LOG);
+    mount_fs("disk.36");
+
+    /* data that never changes fills most of the image */
+    fs_create("cold.36");
+    fd = fs_open("cold.36");
+    for (int i = 0; i < 50; i++) {
+        if (fs_write(fd, model, 64 * BLOCK_SIZE) != 64 * BLOCK_SIZE)
+            return FAIL;
+    }
+    fs_close(fd);
+    fs_create("log.36");
+    fd = fs_open("log.36");
+    if (fs_write(fd, model, sizeof(model)) != sizeof(model))
+        return FAIL;
+
+    /* small random overwrites go to the log, the blocks they replace are freed */
+    for (int i = 0; i < 12000; i++) {
+        int offset = rand_r(&seed) % (sizeof(model) - sizeof(small));
+        memset(small, i, sizeof(small));
+        memcpy(model + offset, small, sizeof(small));
+        fs_lseek(fd, offset);
+        if (fs_write(fd, small, sizeof(small)) != sizeof(small))
+            return FAIL;
+    }
+    if (fs_space_stats(&space) != 0 || space.physical_blocks != 3200 + 256)
+        return FAIL;
+
+    /* the background cleaner kept segments clean for the log */
+    for (int i = 0; i < 100; i++) {
+        if (fs_log_stats(&stats) != 0 || stats.segments_cleaned > 0)
+            break;
+        usleep(10000);
+    }
+    if (stats.segments != 64 || stats.segments_cleaned == 0 || stats.blocks_moved == 0)
+        return FAIL;
+    if (fs_log_clean(0) < 0 || fs_log_stats(&stats) != 0 || stats.clean_segments < 64 - 56)
+        return FAIL;
+    fs_close(fd);
+    umount_fs("disk.36");
+
+    /* blocks written one after the other are next to each other in the image */
+    mount_fs("disk.36");
+    fd = fs_open("log.36");
+    for (int i = 0; i < 3; i++) {
+        int block = (int[]){10, 200, 50}[i];
+        memset(model + block * BLOCK_SIZE, 'P' + i, BLOCK_SIZE);
+        fs_lseek(fd, block * BLOCK_SIZE);
+        fs_write(fd, model + block * BLOCK_SIZE, BLOCK_SIZE);
+    }
+    fs_close(fd);
+    umount_fs("disk.36");
+    f = open("disk.36", O_RDONLY);
+    for (int phys = 0; phys < 4096; phys++) {
+        pread(f, raw, BLOCK_SIZE, (off_t)(4096 + phys) * BLOCK_SIZE);
+        for (int i = 0; i < 3; i++) {
+            if (raw[0] == 'P' + i && raw[BLOCK_SIZE - 1] == 'P' + i)
+                found[i] = phys;
+        }
+    }
+    close(f);
+    if (found[0] == -1 || found[1] != found[0] + 1 || found[2] != found[0] + 2)
+        return FAIL;
+
+    mount_fs("disk.36");
+    fd = fs_open("log.36");
+    if (fs_read(fd, out, sizeof(out)) != sizeof(out) || memcmp(out, model, sizeof(model)) != 0)
+        return FAIL;
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    fs_close(fd);
+    umount_fs("disk.36");
+
+    return PASS;
+}
+
+/* bytes of the image file actually stored, see test37 */
+static long long stored_bytes(char *name) {
+    struct stat st;
+    if (stat(name, &st) != 0)
+        return -1;
+    return (long long)st.st_blocks * 512;
+}
+
+
+//discard test
+//==============================================================================
+static int test37(void) {
+    int fd;
+    long long full, truncated, deleted;
+    static char buf[200 * BLOCK_SIZE], out[200 * BLOCK_SIZE];
+    struct fs_check_report report;
+
+    for (int i = 0; i < sizeof(buf); i++)
+        buf[i] = i % 239;
+    make_fs("disk.37");
+    mount_fs_ext("disk.37", MOUNT_DISCARD);
+    fs_create("keep.37");
+    fs_create("gone.37");
+    fd = fs_open("keep.37");
+    fs_write(fd, buf, 20 * BLOCK_SIZE);
+    fs_close(fd);
+    fd = fs_open("gone.37");
+    fs_write(fd, buf, sizeof(buf));
+    fs_sync();
+    full = stored_bytes("disk.37");
+
+    /* freed blocks leave the image once the change is committed */
+    fs_truncate(fd, 50 * BLOCK_SIZE);
+    fs_sync();
+    truncated = stored_bytes("disk.37");
+    fs_close(fd);
+    fs_delete("gone.37");
+    fs_sync();
+    deleted = stored_bytes("disk.37");
+    if (full - truncated < 150LL * BLOCK_SIZE || truncated - deleted < 50LL * BLOCK_SIZE)
+        return FAIL;
+
+    /* blocks taken again are written as usual */
+    fs_create("new.37");
+    fd = fs_open("new.37");
+    fs_write(fd, buf, 100 * BLOCK_SIZE);
+    fs_close(fd);
+    umount_fs("disk.37");
+    if (stored_bytes("disk.37") - deleted < 100LL * BLOCK_SIZE)
+        return FAIL;
+
+    mount_fs("disk.37");
+    fd = fs_open("keep.37");
+    if (fs_read(fd, out, sizeof(out)) != 20 * BLOCK_SIZE || memcmp(out, buf, 20 * BLOCK_SIZE) != 0)
+        return FAIL;
+    fs_close(fd);
+    fd = fs_open("new.37");
+    if (fs_read(fd, out, sizeof(out)) != 100 * BLOCK_SIZE || memcmp(out, buf, 100 * BLOCK_SIZE) != 0)
+        return FAIL;
+    fs_close(fd);
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    umount_fs("disk.37");
+
+    return PASS;
+}
+
+
+//snapshot fills the disk test
+//==============================================================================
+static int test38(void) {
+    int fd, written;
+    static char buf[3000 * BLOCK_SIZE], out[3000 * BLOCK_SIZE];
+    struct fs_check_report report;
+
+    make_fs_ext("disk.38", FS_FEATURE_SNAPSHOTS);
+    mount_fs("disk.38");
+    fs_create("big.38");
+    fd = fs_open("big.38");
+    memset(buf, 'a', sizeof(buf));
+    if (fs_write(fd, buf, sizeof(buf)) != sizeof(buf))
+        return FAIL;
+    if (fs_snapshot("s") != 0)
+        return FAIL;
+
+    /* the snapshot keeps the old blocks, the overwrite runs out of new ones and stops */
+    memset(buf, 'b', sizeof(buf));
+    fs_lseek(fd, 0);
+    written = fs_write(fd, buf, sizeof(buf));
+    if (written <= 0 || written >= sizeof(buf) || written % BLOCK_SIZE != 0)
+        return FAIL;
+    fs_lseek(fd, 0);
+    if (fs_read(fd, out, sizeof(out)) != sizeof(out) || memcmp(out, buf, written) != 0)
+        return FAIL;
+    for (int i = written; i < sizeof(out); i++)
+        if (out[i] != 'a')
+            return FAIL;
+    fs_close(fd);
+
+    /* nothing is left half taken */
+    if (fs_check(0, 2, &report) != 0)
+        return FAIL;
+    fs_snapshot_delete("s");
+    fd = fs_open("big.38");
+    fs_lseek(fd, written);
+    if (fs_write(fd, buf, sizeof(buf) - written) != sizeof(buf) - written)
+        return FAIL;
+    fs_close(fd);
+    umount_fs("disk.38");
+
+    return PASS;
+}
+
+
+//trace of every call test
+//==============================================================================
+/* read back a trace, return the number of entries or -1 if one is malformed */
+static int read_trace(char *name, struct trace_entry *entries, int max) {
+    char *line = NULL;
+    size_t len = 0;
+    int n = 0;
+    FILE *trace = fopen(name, "r");
+
+    if (trace == NULL)
+        return -1;
+    while (n < max && getline(&line, &len, trace) != -1)
+        if (trace_parse(line, &entries[n++]) != 0)
+            n = -1;
+    free(line);
+    fclose(trace);
+    return n;
+}
+
+static int test39(void) {
+    static struct trace_entry e[32];
+    struct fs_aio_req req, *done;
+    char path[200], dir[200];
+    struct fs_stat st, list[2];
+    int fd, fd2, n, cursor = 0;
+
+    /* a path longer than the old 64 byte name field */
+    strcpy(path, "");
+    for (int i = 0; i < 8; i++) {
+        sprintf(path + strlen(path), "%sdirectory%06d", i ? "/" : "", i);
+    }
+    make_fs_ext("disk.39", FS_FEATURE_SNAPSHOTS);
+    mount_fs("disk.39");
+    if (trace_start("trace.39"))
+        return FAIL;
+    for (int i = 0; i < 8; i++) {
+        memcpy(dir, path, 16 * (i + 1) - 1);
+        dir[16 * (i + 1) - 1] = '\0';
+        if (fs_mkdir(dir) != 0)
+            return FAIL;
+    }
+    strcat(path, "/f");
+    fs_create(path);
+    fd = fs_open(path);
+    fs_write(fd, path, 100);
+    fs_close(fd);
+    fs_delete(path);
+    path[strlen(path) - 2] = '\0';
+    if (fs_rmdir(path) != 0)
+        return FAIL;
+
+    /* copies take two names, two descriptors and two offsets */
+    fs_create("a.39");
+    fd = fs_open("a.39");
+    fs_write(fd, path, 100);
+    if (fs_copy_file("a.39", "b.39") != 0)
+        return FAIL;
+    fd2 = fs_open("b.39");
+    if (fs_copy_range(fd, 10, fd2, 100, 50) != 50)
+        return FAIL;
+
+    /* reads and writes at an offset of the event loop interface */
+    req.op = FS_AIO_WRITE;
+    req.fildes = fd2;
+    req.buf = dir;
+    req.nbyte = 30;
+    req.offset = 120;
+    if (fs_aio_setup() < 0 || fs_aio_submit(&req) != 0 || fs_aio_reap(&done, 1, 1) != 1)
+        return FAIL;
+    req.op = FS_AIO_READ;
+    req.offset = 120;
+    if (fs_aio_submit(&req) != 0 || fs_aio_reap(&done, 1, 1) != 1 || fs_aio_teardown() != 0)
+        return FAIL;
+    if (fs_fallocate(fd2, 4096, 3 * 4096) != 0)
+        return FAIL;
+    if (fs_stat("a.39", &st) != 0 || fs_readdir("/", &cursor, list, 2) != 2)
+        return FAIL;
+
+    /* snapshots, and mounting one */
+    if (fs_snapshot("s") != 0)
+        return FAIL;
+    umount_fs("disk.39");
+    if (mount_snapshot("disk.39", "s") != 0)
+        return FAIL;
+    umount_fs("disk.39");
+    trace_stop();
+
+    n = read_trace("trace.39", e, 32);
+    remove("trace.39");
+    if (n != 29)
+        return FAIL;
+    if (e[0].op != TRACE_MKDIR || strcmp(e[0].name, "directory000000") != 0 || e[0].rtn != 0)
+        return FAIL;
+    if (e[7].op != TRACE_MKDIR || e[8].op != TRACE_CREATE || strncmp(e[8].name, path, strlen(path)) != 0)
+        return FAIL;
+    if (e[13].op != TRACE_RMDIR || strcmp(e[13].name, path) != 0 || e[13].rtn != 0)
+        return FAIL;
+    if (e[17].op != TRACE_COPY_FILE || strcmp(e[17].name, "a.39") != 0 || strcmp(e[17].name2, "b.39") != 0)
+        return FAIL;
+    if (e[19].op != TRACE_COPY_RANGE || e[19].fildes != fd || e[19].fildes2 != fd2 ||
+        e[19].offset != 10 || e[19].offset2 != 100 || e[19].arg != 50 || e[19].rtn != 50)
+        return FAIL;
+    if (e[20].op != TRACE_PWRITE || e[20].fildes != fd2 || e[20].offset != 120 || e[20].rtn != 30)
+        return FAIL;
+    if (e[21].op != TRACE_PREAD || e[21].fildes != fd2 || e[21].offset != 120 || e[21].rtn != 30)
+        return FAIL;
+    if (e[22].op != TRACE_FALLOCATE || e[22].fildes != fd2 || e[22].offset != 4096 ||
+        e[22].arg != 3 * 4096 || e[22].rtn != 0)
+        return FAIL;
+    if (e[23].op != TRACE_STAT || strcmp(e[23].name, "a.39") != 0 || e[23].rtn != 0)
+        return FAIL;
+    if (e[24].op != TRACE_READDIR || strcmp(e[24].name, "/") != 0 || e[24].arg != 2 ||
+        e[24].offset != 0 || e[24].offset2 != cursor || e[24].rtn != 2)
+        return FAIL;
+    if (e[25].op != TRACE_SNAPSHOT || strcmp(e[25].name, "s") != 0 || e[25].rtn != 0)
+        return FAIL;
+    if (e[27].op != TRACE_MOUNT_SNAPSHOT || strcmp(e[27].name, "disk.39") != 0 ||
+        strcmp(e[27].name2, "s") != 0 || e[27].rtn != 0)
+        return FAIL;
+
+    return PASS;
+}
+
+
 //end of tests
 //==============================================================================
 
@@ -557,7 +2458,16 @@ static int (*test_arr[NUM_TESTS])(void) = {&test0, &test1,  &test2,
                                            &test3, &test4,  &test5,
                                            &test6, &test7,  &test8,
                                            &test9, &test10, &test11,
-                                           &test12};
+                                           &test12, &test13,
+                                           &test14, &test15, &test16,
+                                           &test17, &test18, &test19,
+                                           &test20, &test21, &test22,
+                                           &test23, &test24, &test25,
+                                           &test26, &test27, &test28,
+                                           &test29, &test30, &test31,
+                                           &test32, &test33, &test34,
+                                           &test35, &test36, &test37,
+                                           &test38, &test39};
 // static int (*test_arr[NUM_TESTS])(void) = {&test9};
 
 int main(void){
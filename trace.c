@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "trace.h"
+
+/*
+Trace format:
+
+Each recorded call is one text line
+
+  <start> <op> <fildes> <name> <arg> <rtn> <latency>
+
+followed by <name2> <fildes2> <offset> <offset2> for the calls that take a
+second name, descriptor or offset (see struct trace_entry).
+start and latency are in nanoseconds. Names are escaped so that a line can
+always be split on white space: "-" stands for an empty name and any blank,
+'%' or non-printable character is written as %XX. Names are written in full,
+a line is as long as its name needs.
+*/
+
+static FILE    *trace_file = NULL; /* trace being recorded, NULL when off     */
+static uint64_t trace_base;        /* trace_now() when recording started      */
+
+static const char *op_names[TRACE_NUM_OPS] = {
+  "make_fs", "mount_fs", "umount_fs", "open", "close", "create", "delete",
+  "read", "write", "get_filesize", "lseek", "truncate", "sync", "mkdir", "rmdir",
+  "copy_file", "copy_range", "snapshot", "snapshot_delete", "mount_snapshot",
+  "pread", "pwrite", "fallocate", "stat", "readdir"
+};
+
+uint64_t trace_now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+const char *trace_op_name(int op){
+  if(op < 0 || op >= TRACE_NUM_OPS) return "unknown";
+  return op_names[op];
+}
+
+int trace_start(char *trace_name){
+  if(trace_name == NULL || trace_file != NULL) return -1;
+
+  trace_file = fopen(trace_name, "w");
+  if(trace_file == NULL){
+    perror("trace_start: cannot open trace file");
+    return -1;
+  }
+  trace_base = trace_now();
+  return 0;
+}
+
+int trace_stop(){
+  if(trace_file == NULL) return -1;
+  fclose(trace_file);
+  trace_file = NULL;
+  return 0;
+}
+
+int trace_active(){
+  return trace_file != NULL;
+}
+
+/*additional function helps to write a name so that it survives white space splitting*/
+static void write_name(char *name){
+  if(name == NULL || name[0] == '\0' || strcmp(name, "-") == 0){
+    fputs(name != NULL && name[0] == '-' ? "%2D" : "-", trace_file);
+    return;
+  }
+  for(unsigned char *c = (unsigned char*)name; *c != '\0'; c++){
+    if(isgraph(*c) && *c != '%'){
+      fputc(*c, trace_file);
+    }else{
+      fprintf(trace_file, "%%%02X", *c);
+    }
+  }
+}
+
+/*additional function helps to write the fields every line has, without the newline*/
+static void write_fields(int op, char *name, int fildes, long arg, int rtn, uint64_t start){
+  uint64_t end = trace_now();
+  fprintf(trace_file, "%llu %s %d ", (unsigned long long)(start - trace_base),
+          trace_op_name(op), fildes);
+  write_name(name);
+  fprintf(trace_file, " %ld %d %llu", arg, rtn, (unsigned long long)(end - start));
+}
+
+void trace_record(int op, char *name, int fildes, long arg, int rtn, uint64_t start){
+  if(trace_file == NULL) return;
+
+  write_fields(op, name, fildes, arg, rtn, start);
+  fputc('\n', trace_file);
+}
+
+void trace_record_ext(int op, char *name, int fildes, long arg, char *name2, int fildes2,
+                      long offset, long offset2, int rtn, uint64_t start){
+  if(trace_file == NULL) return;
+
+  write_fields(op, name, fildes, arg, rtn, start);
+  fputc(' ', trace_file);
+  write_name(name2);
+  fprintf(trace_file, " %d %ld %ld\n", fildes2, offset, offset2);
+}
+
+/*additional function helps to undo the escaping done by write_name. Return -1 if the
+  name does not fit in len bytes
+*/
+static int read_name(char *field, char *name, size_t len){
+  size_t n = 0;
+  if(strcmp(field, "-") == 0){
+    name[0] = '\0';
+    return 0;
+  }
+  for(char *c = field; *c != '\0'; c++){
+    unsigned int hex;
+    if(n + 1 >= len) return -1;
+    if(*c == '%' && sscanf(c + 1, "%2X", &hex) == 1){
+      name[n++] = (char)hex;
+      c += 2;
+    }else{
+      name[n++] = *c;
+    }
+  }
+  name[n] = '\0';
+  return 0;
+}
+
+int trace_parse(char *line, struct trace_entry *entry){
+  char *field[11], *save = NULL;
+  unsigned long long start, latency;
+  int count = 0;
+
+  //the name fields have no length limit in the file, so split the line in place
+  //instead of scanning it into fixed buffers
+  while(count < 11 && (field[count] = strtok_r(count == 0 ? line : NULL, " \t\r\n", &save)) != NULL){
+    count++;
+  }
+  if(count != 7 && count != 11) return -1;
+  if(sscanf(field[0], "%llu", &start) != 1 || sscanf(field[2], "%d", &entry->fildes) != 1 ||
+     sscanf(field[4], "%ld", &entry->arg) != 1 || sscanf(field[5], "%d", &entry->rtn) != 1 ||
+     sscanf(field[6], "%llu", &latency) != 1){
+    return -1;
+  }
+
+  entry->op = -1;
+  for(int i = 0; i < TRACE_NUM_OPS; i++){
+    if(strcmp(field[1], op_names[i]) == 0){
+      entry->op = i;
+      break;
+    }
+  }
+  if(entry->op == -1) return -1;
+
+  entry->start   = start;
+  entry->latency = latency;
+  entry->name2[0] = '\0';
+  entry->fildes2 = -1;
+  entry->offset  = 0;
+  entry->offset2 = 0;
+  if(count == 11 && (sscanf(field[8], "%d", &entry->fildes2) != 1 ||
+                     sscanf(field[9], "%ld", &entry->offset) != 1 ||
+                     sscanf(field[10], "%ld", &entry->offset2) != 1 ||
+                     read_name(field[7], entry->name2, sizeof(entry->name2)) == -1)){
+    return -1;
+  }
+  //a name that does not fit would replay as a different, shorter path
+  return read_name(field[3], entry->name, sizeof(entry->name));
+}
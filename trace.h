@@ -0,0 +1,99 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+/******************************************************************************/
+/* operations that can appear in a trace (one per public fs_* entry point,   */
+/* and pread/pwrite for the reads and writes at an offset of fs_aio_submit)   */
+enum trace_op {
+  TRACE_MAKE_FS,
+  TRACE_MOUNT_FS,
+  TRACE_UMOUNT_FS,
+  TRACE_OPEN,
+  TRACE_CLOSE,
+  TRACE_CREATE,
+  TRACE_DELETE,
+  TRACE_READ,
+  TRACE_WRITE,
+  TRACE_GET_FILESIZE,
+  TRACE_LSEEK,
+  TRACE_TRUNCATE,
+  TRACE_SYNC,
+  TRACE_MKDIR,
+  TRACE_RMDIR,
+  TRACE_COPY_FILE,
+  TRACE_COPY_RANGE,
+  TRACE_SNAPSHOT,
+  TRACE_SNAPSHOT_DELETE,
+  TRACE_MOUNT_SNAPSHOT,
+  TRACE_PREAD,
+  TRACE_PWRITE,
+  TRACE_FALLOCATE,
+  TRACE_STAT,
+  TRACE_READDIR,
+  TRACE_NUM_OPS
+};
+
+/* room for the longest path: 64 components of 15 characters, each with its '/' */
+#define TRACE_NAME_MAX 1040
+
+/*
+ * One recorded call. Only sizes and offsets are kept, never file data.
+ *
+ * start   - nanoseconds since the trace was started
+ * op      - enum trace_op
+ * fildes  - file descriptor argument (-1 when the call takes none)
+ * name    - file, directory, snapshot or disk name argument ("" when the call
+ *           takes none)
+ * arg     - nbyte for read/write/pread/pwrite, offset for lseek, length
+ *           for truncate and fallocate, flags for mount, features for
+ *           make_fs, len for copy_range, max for readdir
+ * rtn     - value returned by the call
+ * latency - time spent inside the call in nanoseconds
+ *
+ * Calls with a second name, descriptor or offset also have
+ *
+ * name2   - dst for copy_file, the snapshot for mount_snapshot ("" when the
+ *           call takes none)
+ * fildes2 - fd_out for copy_range (-1 when the call takes none)
+ * offset  - off_in for copy_range, offset for pread/pwrite/fallocate, the
+ *           cursor readdir started from
+ * offset2 - off_out for copy_range, the cursor readdir left
+ */
+struct trace_entry {
+  uint64_t start;
+  int      op;
+  int      fildes;
+  char     name[TRACE_NAME_MAX];
+  long     arg;
+  int      rtn;
+  uint64_t latency;
+  char     name2[TRACE_NAME_MAX];
+  int      fildes2;
+  long     offset;
+  long     offset2;
+};
+
+/******************************************************************************/
+int trace_start(char *trace_name); /* start recording fs_* calls to a file    */
+int trace_stop();                  /* flush and close the current trace       */
+int trace_active();                /* is a trace being recorded               */
+
+uint64_t trace_now();              /* monotonic clock in nanoseconds          */
+void trace_record(int op, char *name, int fildes, long arg, int rtn,
+                  uint64_t start);
+                                   /* append one call to the current trace    */
+void trace_record_ext(int op, char *name, int fildes, long arg, char *name2,
+                      int fildes2, long offset, long offset2, int rtn,
+                      uint64_t start);
+                                   /* same, for calls with the fields of
+                                      name2, fildes2, offset or offset2       */
+
+int trace_parse(char *line, struct trace_entry *entry);
+                                   /* decode one trace line, 0 on success,
+                                      -1 if malformed or the name is too long */
+const char *trace_op_name(int op); /* printable name of an operation          */
+/******************************************************************************/
+
+#endif
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "fs_internal.h"
+
+/*
+Write-back of data blocks:
+
+physical_block_write leaves the block in a buffer of WB_CACHE_BLOCKS dirty blocks and
+returns, physical_block_read looks there first (physical_blocks_read takes the blocks it
+finds there and reads each run of the others with one block_readv). A flusher thread
+writes the buffer out when the dirty blocks pass the dirty ratio of the buffer or the
+oldest of them passes the maximum age, and a writer that finds the buffer full flushes
+it itself.
+
+A flush writes the dirty blocks in one sweep up the disk starting where the last flush
+ended (C-LOOK), and runs of consecutive blocks go out with one block_writev. Blocks stay
+in the buffer (and readable) until they are written. Flushes are serialized with
+flush_mutex, and wb_mutex is only held while one run is written, so writers only wait
+for the run they touch.
+
+Every commit and checkpoint of metadata flushes first (see commit_metadata), so the
+journal never makes a chain durable before the data it points to.
+*/
+
+#define WB_CACHE_BLOCKS 1024
+
+static pthread_mutex_t wb_mutex    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  wb_cond     = PTHREAD_COND_INITIALIZER;
+static pthread_t       wb_thread;
+static bool            wb_started  = false;   /* buffer allocated and flusher running */
+static bool            wb_stopping = false;
+
+static int   dirty_ratio = 10;       /* percent of the buffer dirty before a flush starts */
+static int   max_age_ms  = 100;      /* longest a block stays dirty */
+
+static char *slot_data;              /* WB_CACHE_BLOCKS blocks */
+static int   slot_block[WB_CACHE_BLOCKS];
+static int   slot_of[DISK_BLOCKS];   /* disk block -> slot, -1 when not buffered */
+static int   free_slots[WB_CACHE_BLOCKS];
+static int   num_free;
+static struct timespec oldest_dirty; /* when the buffer last went from clean to dirty */
+static int   last_block;             /* where the last flush ended */
+
+static struct fs_writeback_stats stats;
+
+static void fork_prepare(){
+	pthread_mutex_lock(&flush_mutex);
+	pthread_mutex_lock(&wb_mutex);
+}
+
+static void fork_parent(){
+	pthread_mutex_unlock(&wb_mutex);
+	pthread_mutex_unlock(&flush_mutex);
+}
+
+/*additional function helps a child process: the flusher is not running there and the
+  dirty blocks are the parent's to write
+*/
+static void fork_child(){
+	pthread_mutex_unlock(&wb_mutex);
+	pthread_mutex_unlock(&flush_mutex);
+	if(wb_started){
+		free(slot_data);
+		slot_data = NULL;
+		wb_started = false;
+	}
+}
+
+static int dirty_blocks(){
+	return WB_CACHE_BLOCKS - num_free;
+}
+
+static int dirty_limit(){
+	int limit = WB_CACHE_BLOCKS * dirty_ratio / 100;
+	return limit > 0 ? limit : 1;
+}
+
+int wb_flush(){
+	int blocks[WB_CACHE_BLOCKS];
+	int count = 0;
+	int rtn = 0;
+
+	pthread_mutex_lock(&flush_mutex);
+	pthread_mutex_lock(&wb_mutex);
+	if(!wb_started || dirty_blocks() == 0){
+		pthread_mutex_unlock(&wb_mutex);
+		pthread_mutex_unlock(&flush_mutex);
+		return 0;
+	}
+
+	//C-LOOK: sweep up from where the last flush ended, then from the lowest block.
+	//the blocks come out sorted from the block to slot table (qsort would allocate)
+	for(int block = 0; block < DISK_BLOCKS && count < dirty_blocks(); block ++){
+		if(slot_of[block] != -1) blocks[count ++] = block;
+	}
+	int start = 0;
+	while(start < count && blocks[start] < last_block) start ++;
+	stats.flushes ++;
+	pthread_mutex_unlock(&wb_mutex);
+
+	for(int done = 0; done < count && rtn == 0; ){
+		int first = (start + done) % count;
+		int run = 1;
+		while(done + run < count && first + run < count && run < WRITEV_BLOCKS_MAX &&
+		      blocks[first + run] == blocks[first] + run){
+			run ++;
+		}
+
+		pthread_mutex_lock(&wb_mutex);
+		char *bufs[WRITEV_BLOCKS_MAX];
+		for(int i = 0; i < run; i ++){
+			bufs[i] = slot_data + (size_t)slot_of[blocks[first + i]] * BLOCK_SIZE;
+		}
+		rtn = block_writev(blocks[first], bufs, run);
+		if(rtn == 0){
+			for(int i = 0; i < run; i ++){
+				int slot = slot_of[blocks[first + i]];
+				slot_of[blocks[first + i]] = -1;
+				slot_block[slot] = -1;
+				free_slots[num_free ++] = slot;
+			}
+			stats.blocks_written += run;
+			stats.writes ++;
+			last_block = blocks[first] + run;
+		}
+		pthread_cond_broadcast(&wb_cond);
+		pthread_mutex_unlock(&wb_mutex);
+		done += run;
+	}
+
+	//blocks written meanwhile start a new age
+	pthread_mutex_lock(&wb_mutex);
+	clock_gettime(CLOCK_REALTIME, &oldest_dirty);
+	pthread_mutex_unlock(&wb_mutex);
+	pthread_mutex_unlock(&flush_mutex);
+	return rtn;
+}
+
+static void *wb_main(void *arg){
+	pthread_mutex_lock(&wb_mutex);
+	while(!wb_stopping){
+		if(dirty_blocks() == 0){
+			pthread_cond_wait(&wb_cond, &wb_mutex);
+			continue;
+		}
+
+		struct timespec until = oldest_dirty;
+		until.tv_sec  += max_age_ms / 1000;
+		until.tv_nsec += (long)(max_age_ms % 1000) * 1000000L;
+		if(until.tv_nsec >= 1000000000L){
+			until.tv_sec ++;
+			until.tv_nsec -= 1000000000L;
+		}
+		if(dirty_blocks() < dirty_limit() &&
+		   pthread_cond_timedwait(&wb_cond, &wb_mutex, &until) != ETIMEDOUT){
+			continue;
+		}
+
+		pthread_mutex_unlock(&wb_mutex);
+		wb_flush();
+		pthread_mutex_lock(&wb_mutex);
+	}
+	pthread_mutex_unlock(&wb_mutex);
+	return NULL;
+}
+
+static void register_fork_handlers(){
+	pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+int wb_start(){
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, register_fork_handlers);
+
+	wb_stop();
+	//the buffer is kept from one mount to the next
+	//aligned, so MOUNT_DIRECT writes the slots without bouncing them
+	if(slot_data == NULL){
+		void *mem;
+		if(posix_memalign(&mem, BLOCK_SIZE, (size_t)WB_CACHE_BLOCKS * BLOCK_SIZE) != 0) return -1;
+		slot_data = mem;
+	}
+	for(int i = 0; i < DISK_BLOCKS; i ++) slot_of[i] = -1;
+	for(int i = 0; i < WB_CACHE_BLOCKS; i ++){
+		slot_block[i] = -1;
+		free_slots[i] = WB_CACHE_BLOCKS - 1 - i;
+	}
+	num_free = WB_CACHE_BLOCKS;
+	last_block = 0;
+	memset(&stats, 0, sizeof(stats));
+
+	wb_stopping = false;
+	if(pthread_create(&wb_thread, NULL, wb_main, NULL) != 0) return -1;
+	pthread_mutex_lock(&wb_mutex);
+	wb_started = true;
+	pthread_mutex_unlock(&wb_mutex);
+	return 0;
+}
+
+int wb_stop(){
+	if(!wb_started) return 0;
+	int rtn = wb_flush();
+
+	pthread_mutex_lock(&wb_mutex);
+	wb_stopping = true;
+	pthread_cond_broadcast(&wb_cond);
+	pthread_mutex_unlock(&wb_mutex);
+	pthread_join(wb_thread, NULL);
+
+	pthread_mutex_lock(&wb_mutex);
+	wb_started = false;
+	pthread_mutex_unlock(&wb_mutex);
+	return rtn;
+}
+
+int wb_write(int block, char *buf){
+	pthread_mutex_lock(&wb_mutex);
+	if(!wb_started || dirty_ratio == 0){
+		pthread_mutex_unlock(&wb_mutex);
+		return block_write(block, buf);
+	}
+
+	int slot = slot_of[block];
+	while(slot == -1 && num_free == 0){
+		//full: write the buffer out before taking more
+		pthread_mutex_unlock(&wb_mutex);
+		if(wb_flush() == -1) return -1;
+		pthread_mutex_lock(&wb_mutex);
+		slot = slot_of[block];
+	}
+	if(slot == -1){
+		if(dirty_blocks() == 0) clock_gettime(CLOCK_REALTIME, &oldest_dirty);
+		slot = free_slots[-- num_free];
+		slot_of[block] = slot;
+		slot_block[slot] = block;
+	}
+	memcpy(slot_data + (size_t)slot * BLOCK_SIZE, buf, BLOCK_SIZE);
+	if(dirty_blocks() == 1 || dirty_blocks() >= dirty_limit()) pthread_cond_broadcast(&wb_cond);
+	pthread_mutex_unlock(&wb_mutex);
+	return 0;
+}
+
+int wb_read(int block, char *buf){
+	pthread_mutex_lock(&wb_mutex);
+	if(wb_started && slot_of[block] != -1){
+		memcpy(buf, slot_data + (size_t)slot_of[block] * BLOCK_SIZE, BLOCK_SIZE);
+		pthread_mutex_unlock(&wb_mutex);
+		return 0;
+	}
+	pthread_mutex_unlock(&wb_mutex);
+	return block_read(block, buf);
+}
+
+int wb_readv(int block, char **bufs, int count){
+	bool buffered[WRITEV_BLOCKS_MAX];
+
+	if(count <= 0 || count > WRITEV_BLOCKS_MAX) return -1;
+
+	//buffered blocks come from the buffer, each run of the others from the disk at once
+	pthread_mutex_lock(&wb_mutex);
+	for(int i = 0; i < count; i ++){
+		buffered[i] = wb_started && slot_of[block + i] != -1;
+		if(buffered[i]) memcpy(bufs[i], slot_data + (size_t)slot_of[block + i] * BLOCK_SIZE, BLOCK_SIZE);
+	}
+	pthread_mutex_unlock(&wb_mutex);
+
+	for(int i = 0; i < count; ){
+		int run = 0;
+		while(i + run < count && !buffered[i + run]) run ++;
+		if(run > 0 && block_readv(block + i, bufs + i, run) == -1) return -1;
+		i += run > 0 ? run : 1;
+	}
+	return 0;
+}
+
+int fs_writeback_tune(int ratio, int age_ms){
+	if(ratio < 0 || ratio > 100 || age_ms <= 0) return -1;
+
+	//going write-through: nothing may stay behind in the buffer
+	if(ratio == 0 && wb_flush() == -1) return -1;
+	pthread_mutex_lock(&wb_mutex);
+	dirty_ratio = ratio;
+	max_age_ms = age_ms;
+	pthread_cond_broadcast(&wb_cond);
+	pthread_mutex_unlock(&wb_mutex);
+	return 0;
+}
+
+int fs_writeback_stats(struct fs_writeback_stats *out){
+	if(out == NULL) return -1;
+	pthread_mutex_lock(&wb_mutex);
+	*out = stats;
+	out->dirty_blocks = wb_started ? dirty_blocks() : 0;
+	pthread_mutex_unlock(&wb_mutex);
+	return 0;
+}